@@ -18,6 +18,8 @@
 namespace {
 const int PRINT_PERIOD = 100, NUM_REPORTS = 5;
 ExecMode_e ExecMode = ActionList_Mode;
+pGroupLayout_E Layout = P_LAYOUT_AOS;
+unsigned int GroupMemory = P_MEM_DEFAULT;
 ParticleContext_t P;
 EffectsManager Efx(P, 500'000);
 StatTimer FPSClock(PRINT_PERIOD);
@@ -40,7 +42,7 @@ void Report(int reportIter)
 // Optimize the working set size
 void RunBenchmarkCache()
 {
-    Efx.particleHandle = P.GenParticleGroups(1, Efx.maxParticles); // Make a particle group
+    Efx.particleHandle = P.GenParticleGroups(1, Efx.maxParticles, Layout, PA_ALL, GroupMemory); // Make a particle group
 
     P.CurrentGroup(Efx.particleHandle);
 
@@ -62,7 +64,7 @@ void RunBenchmarkCache()
 
 void RunBenchmark(int demoNum)
 {
-    Efx.particleHandle = P.GenParticleGroups(1, Efx.maxParticles); // Make a particle group
+    Efx.particleHandle = P.GenParticleGroups(1, Efx.maxParticles, Layout, PA_ALL, GroupMemory); // Make a particle group
 
     P.CurrentGroup(Efx.particleHandle);
 
@@ -192,6 +194,21 @@ static void Args(int argc, char** argv)
         } else if (starg == "-inline") {
             ExecMode = Inline_Mode;
             RemoveArgs(argc, argv, i);
+        } else if (starg == "-soa") {
+            Layout = P_LAYOUT_SOA;
+            RemoveArgs(argc, argv, i);
+        } else if (starg == "-aosoa") {
+            Layout = P_LAYOUT_AOSOA;
+            RemoveArgs(argc, argv, i);
+        } else if (starg == "-hotcold") {
+            Layout = P_LAYOUT_HOTCOLD;
+            RemoveArgs(argc, argv, i);
+        } else if (starg == "-mapped") {
+            Layout = P_LAYOUT_MAPPED;
+            RemoveArgs(argc, argv, i);
+        } else if (starg == "-hugepages") {
+            GroupMemory = P_MEM_HUGE_PAGES | P_MEM_PREFAULT;
+            RemoveArgs(argc, argv, i);
         } else if (starg == "-sort") {
             SortParticles = true;
             RemoveArgs(argc, argv, i);
@@ -127,14 +127,17 @@ void Atom::DoActions(EffectsManager& Efx)
     S.StartingAge(0);
     P.Source(particleRate, PDSphere(Efx.center, 4.f, 3.f), S);
 
+    const PDSphere sphere1(Efx.center, 1.0);
+    const PDSphere sphere2(Efx.center, 8.0);
+
     PATOP
     P.OrbitPoint(PT Efx.center, 100.f);
     P.TargetColor(PT pVec(0, 1, 0), 1, 0.05);
     P.Move(PT true, false);
 
     // Keep orbits from being too eccentric.
-    P.Sink(PT true, PDSphere(Efx.center, 1.0));
-    P.Sink(PT false, PDSphere(Efx.center, 8.0));
+    P.Sink(PT true, sphere1);
+    P.Sink(PT false, sphere2);
     PAEND
 }
 
@@ -169,13 +172,16 @@ void Balloons::DoActions(EffectsManager& Efx)
     float BBOX = 2.5;
     P.Source(particleRate, PDBox(Efx.center - pVec(BBOX), Efx.center + pVec(BBOX)), S);
 
+    const PDBox box(pVec(-12.f), pVec(12.f));
+    const PDPlane plane(pVec(0, 0, 0), pVec(0, 0, 1));
+
     PATOP
     P.Gravity(PT pVec(0.03f, -0.03f, 0.3f));
     P.Damping(PT pVec(0.9, 0.9, 0.67));
-    P.RandomAccel(PT PDBox(pVec(-12.f), pVec(12.f)));
+    P.RandomAccel(PT box);
     P.Move(PT true, false);
     P.KillOld(PT 7.f);
-    P.Sink(PT false, PDPlane(pVec(0, 0, 0), pVec(0, 0, 1)));
+    P.Sink(PT false, plane);
     PAEND
 
     Render(PDPlane(pVec(0, 0, 0), pVec(0, 0, 1)));
@@ -204,19 +210,23 @@ void Boids::DoActions(EffectsManager& Efx)
     S.Size(particleSize);
     P.Source(particleRate, PDSphere(pVec(0, 15, 25), 10.f, 0.f), S);
 
+    const PDRectangle rectangle(pVec(0, -8, 2), pVec(0, 0, 8), pVec(0, 16, 0));
+    const PDPlane plane(pVec(0, 0, 0), pVec(0, 0, 1));
+    const PDSphere sphere(pVec(0.f), 40.f);
+
     PATOP
     P.OrbitPoint(PT goalPoint, 300.f, 10.f); // Follow goal
     P.Damping(PT 0.98f, minSpeed, P_MAXFLOAT);
     P.Gravitate(PT 0.15f, 0.005f);          // Flock centering
     P.MatchVelocity(PT 0.3f, 0.5f, radius); // Velocity matching
     P.Gravitate(PT - 1.f, 0.1f, radius);    // Neighbor collision avoidance
-    P.Avoid(PT 5.f, 0.1f, 1.5f, PREND(PDRectangle(pVec(0, -8, 2), pVec(0, 0, 8), pVec(0, 16, 0))));
-    P.Avoid(PT 5.f, 0.1f, 1.5f, PREND(PDPlane(pVec(0, 0, 0), pVec(0, 0, 1))));
+    P.Avoid(PT 5.f, 0.1f, 1.5f, PREND(rectangle));
+    P.Avoid(PT 5.f, 0.1f, 1.5f, PREND(plane));
     P.SpeedClamp(PT minSpeed, maxSpeed);
     P.TargetColor(PT pVec(0, 0, 0), 1, 0.04f);
     P.Move(PT true, false);
-    P.Sink(PT false, PREND(PDPlane(pVec(0, 0, 0), pVec(0, 0, 1))));
-    P.Sink(PT false, PDSphere(pVec(0.f), 40.f));
+    P.Sink(PT false, PREND(plane));
+    P.Sink(PT false, sphere);
     PAEND
 
     Render(PDSphere(goalPoint, 0.25f));
@@ -269,22 +279,36 @@ void BounceToy::DoActions(EffectsManager& Efx)
     S.Size(particleSize);
     P.Source(particleRate, PDLine(C + pVec(-5, 0, 10), C + pVec(5, 0, 10)), S);
 
+    const PDRectangle rectangle1(C + pVec(-4, -2, 6), pVec(4, 0, 1), Side);
+    const PDRectangle rectangle2(C + pVec(4, -2, 8), pVec(4, 0, -3), Side);
+    const PDRectangle rectangle3(C + pVec(-1, -2, 6), pVec(2, 0, -2), Side);
+    const PDRectangle rectangle4(C + pVec(1, -2, 2), pVec(4, 0, 2), Side);
+    const PDRectangle rectangle5(C + pVec(-6, -2, 6), pVec(3, 0, -5), Side);
+    const PDRectangle rectangle6(C + pVec(6, -2, 2), pVec(5, 0, 3), Side);
+    const PDRectangle rectangle7(C + pVec(4, -2, -1), pVec(5, 0, 1.5), Side);
+    const PDRectangle rectangle8(C + pVec(-3, -2, -1), pVec(5, 0, -1), Side);
+    const PDRectangle rectangle9(C + pVec(-8, -2, -4.1), pVec(14, 0, 2), Side);
+    const PDRectangle rectangle10(C + pVec(-10, -2, 5), pVec(4, 0, 5), Side);
+    const PDBox box(C + pVec(-10, -2, -6), C + pVec(-8, 2, -1));
+    const PDPoint point(pVec(0.0, 0.0, 100.f));
+    const PDPlane plane(pVec(0, 0, 0), pVec(0, 0, 1));
+
     PATOP
     P.Gravity(PT Efx.GravityVec);
-    P.Bounce(PT Fric, Res, FricMinTanVel, PREND(PDRectangle(C + pVec(-4, -2, 6), pVec(4, 0, 1), Side)));
-    P.Bounce(PT Fric, Res, FricMinTanVel, PREND(PDRectangle(C + pVec(4, -2, 8), pVec(4, 0, -3), Side)));
-    P.Bounce(PT Fric, Res, FricMinTanVel, PREND(PDRectangle(C + pVec(-1, -2, 6), pVec(2, 0, -2), Side)));
-    P.Bounce(PT Fric, Res, FricMinTanVel, PREND(PDRectangle(C + pVec(1, -2, 2), pVec(4, 0, 2), Side)));
-    P.Bounce(PT Fric, Res, FricMinTanVel, PREND(PDRectangle(C + pVec(-6, -2, 6), pVec(3, 0, -5), Side)));
-    P.Bounce(PT Fric, Res, FricMinTanVel, PREND(PDRectangle(C + pVec(6, -2, 2), pVec(5, 0, 3), Side)));
-    P.Bounce(PT Fric, Res, FricMinTanVel, PREND(PDRectangle(C + pVec(4, -2, -1), pVec(5, 0, 1.5), Side)));
-    P.Bounce(PT Fric, Res, FricMinTanVel, PREND(PDRectangle(C + pVec(-3, -2, -1), pVec(5, 0, -1), Side)));
-    P.Bounce(PT 0.05f, Res, 0, PREND(PDRectangle(C + pVec(-8, -2, -4.1), pVec(14, 0, 2), Side)));
-    P.Bounce(PT Fric, Res, FricMinTanVel, PREND(PDRectangle(C + pVec(-10, -2, 5), pVec(4, 0, 5), Side)));
-    P.Jet(PT PREND(PDBox(C + pVec(-10, -2, -6), C + pVec(-8, 2, -1))), PDPoint(pVec(0.0, 0.0, 100.f)));
+    P.Bounce(PT Fric, Res, FricMinTanVel, PREND(rectangle1));
+    P.Bounce(PT Fric, Res, FricMinTanVel, PREND(rectangle2));
+    P.Bounce(PT Fric, Res, FricMinTanVel, PREND(rectangle3));
+    P.Bounce(PT Fric, Res, FricMinTanVel, PREND(rectangle4));
+    P.Bounce(PT Fric, Res, FricMinTanVel, PREND(rectangle5));
+    P.Bounce(PT Fric, Res, FricMinTanVel, PREND(rectangle6));
+    P.Bounce(PT Fric, Res, FricMinTanVel, PREND(rectangle7));
+    P.Bounce(PT Fric, Res, FricMinTanVel, PREND(rectangle8));
+    P.Bounce(PT 0.05f, Res, 0, PREND(rectangle9));
+    P.Bounce(PT Fric, Res, FricMinTanVel, PREND(rectangle10));
+    P.Jet(PT PREND(box), point);
     P.TargetColor(PT pVec(0, 0, 1), 1, 0.04);
     P.Move(PT true, false);
-    P.Sink(PT false, PREND(PDPlane(pVec(0, 0, 0), pVec(0, 0, 1))));
+    P.Sink(PT false, PREND(plane));
     PAEND
 
     Render(PDRectangle(C + pVec(-4, -2, 6), pVec(4, 0, 1), Side));
@@ -348,11 +372,14 @@ void Fireflies::DoActions(EffectsManager& Efx)
     S.Size(particleSize);
     P.Source(particleRate, PDBox(Efx.center - pVec(150, 25, 5), Efx.center + pVec(150, 150, 5)), S);
 
+    const PDSphere sphere(pVec(0.f, 0.f, 1.8f), 13.f);
+    const PDPlane plane(pVec(0, 0, 0), pVec(0, 0, 1));
+
     PATOP
-    P.RandomAccel(PT PDSphere(pVec(0.f, 0.f, 1.8f), 13.f));
+    P.RandomAccel(PT sphere);
     P.Move(PT true, false);
     P.KillOld(PT 101.7f);
-    P.Sink(PT false, PREND(PDPlane(pVec(0, 0, 0), pVec(0, 0, 1))));
+    P.Sink(PT false, PREND(plane));
     PAEND
 
     Render(PDPlane(pVec(0, 0, 0), pVec(0, 0, 1)));
@@ -455,10 +482,12 @@ void FlameThrower::DoActions(EffectsManager& Efx)
     S.Size(particleSize);
     P.Source(particleRate, PDSphere(Efx.center, 0.5f), S);
 
+    const PDBox box(pVec(-1.7), pVec(1.7));
+
     PATOP
     P.Gravity(PT pVec(0, 0, .6));
     P.Damping(PT pVec(0.5, 0.5, 0.97));
-    P.RandomAccel(PT PDBox(pVec(-1.7), pVec(1.7)));
+    P.RandomAccel(PT box);
     P.Move(PT true, false);
     P.KillOld(PT particleLifetime);
     PAEND
@@ -493,12 +522,16 @@ void Fountain::DoActions(EffectsManager& Efx)
     S.Size(particleSize);
     P.Source(particleRate, PDLine(pVec(0.0, 0.0, 1.f), pVec(0.0, 0.0, 1.4f)), S);
 
+    const PDDisc disc(pVec(0, 0, 1.f), pVec(0, 0, 1.f), 5);
+    const PDPlane plane(pVec(0, 0, -3), pVec(0, 0, 1));
+    const PDSphere sphere(pVec(0, 0, 0), 0.01);
+
     PATOP
     P.Gravity(PT Efx.GravityVec);
-    P.Bounce(PT 0.f, 0.5f, 0.f, PREND(PDDisc(pVec(0, 0, 1.f), pVec(0, 0, 1.f), 5)));
+    P.Bounce(PT 0.f, 0.5f, 0.f, PREND(disc));
     P.Move(PT true, false);
-    P.Sink(PT false, PDPlane(pVec(0, 0, -3), pVec(0, 0, 1)));
-    P.SinkVelocity(PT true, PDSphere(pVec(0, 0, 0), 0.01));
+    P.Sink(PT false, plane);
+    P.SinkVelocity(PT true, sphere);
     PAEND
 
     Render(PDDisc(pVec(0, 0, 1.f), pVec(0, 0, 1.f), 5));
@@ -573,9 +606,11 @@ void Hail::DoActions(EffectsManager& Efx)
     float D = 200;
     P.Source(particleRate, PDRectangle(pVec(-D / 2, -D / 2, 20), pVec(D, 0, 0), pVec(0, D, 0)), S);
 
+    const PDPlane plane(pVec(0, 0, 0), pVec(0, 0, 1));
+
     PATOP
     P.Gravity(PT Efx.GravityVec);
-    P.Bounce(PT 0.3, 0.3, 0, PREND(PDPlane(pVec(0, 0, 0), pVec(0, 0, 1))));
+    P.Bounce(PT 0.3, 0.3, 0, PREND(plane));
     P.Move(PT true, false);
     P.KillOld(PT particleLifetime);
     PAEND
@@ -606,11 +641,16 @@ void JetSpray::DoActions(EffectsManager& Efx)
     S.Color(PDSphere(pVec(.5, .4, .1), .1));
     P.Source(particleRate, PDRectangle(pVec(-10, -10, 0.1), pVec(20, 0, 0), pVec(0, 20, 0)), S);
 
+    const PDSphere sphere(jet, 1.5);
+    const PDBlob blob(pVec(0, 0, 200.f), 40.f);
+    const PDRectangle rectangle(pVec(-10, -10, 0.0), pVec(20, 0, 0), pVec(0, 20, 0));
+    const PDPlane plane(pVec(0, 0, -10), pVec(0, 0, 1));
+
     PATOP
     P.Gravity(PT Efx.GravityVec);
-    P.Jet(PT PREND(PDSphere(jet, 1.5)), PDBlob(pVec(0, 0, 200.f), 40.f));
-    P.Bounce(PT 0.1, 0.3, 0.1, PREND(PDRectangle(pVec(-10, -10, 0.0), pVec(20, 0, 0), pVec(0, 20, 0))));
-    P.Sink(PT false, PREND(PDPlane(pVec(0, 0, -10), pVec(0, 0, 1))));
+    P.Jet(PT PREND(sphere), blob);
+    P.Bounce(PT 0.1, 0.3, 0.1, PREND(rectangle));
+    P.Sink(PT false, PREND(plane));
     P.Move(PT true, false);
     PAEND
 
@@ -759,19 +799,25 @@ void Shower::DoActions(EffectsManager& Efx)
     S.Color(PDBlob(pVec(.7, .7, .2), .2));
     P.Source(particleRate, PDPoint(jet), S);
 
+    const PDSphere sphere(pVec(0, 0, 0), 1.f);
+    const PDTriangle triangle(pVec(0, -1, 0.1f), pVec(2, 0, 0.1f), pVec(0, 2, 0.1f));
+    const PDRectangle rectangle(pVec(0, -1, 0.1f), pVec(2, 1, 0), pVec(0, 2, 0));
+    const PDPlane plane(pVec(0, 0, 0.1f), pVec(0, 0, 1));
+    const PDDisc disc(pVec(0, 0, 0.1f), pVec(0, 0, 1), 1.f, 0.f);
+
     PATOP
     P.Gravity(PT Efx.GravityVec * 0.1f);
 
     if (SteerShape == STEER_SPHERE) {
-        P.Avoid(PT 3.f, 0.1f, 2.f, PREND(PDSphere(pVec(0, 0, 0), 1.f)));
+        P.Avoid(PT 3.f, 0.1f, 2.f, PREND(sphere));
     } else if (SteerShape == STEER_TRIANGLE) {
-        P.Avoid(PT 3.f, 0.1f, 2.f, PREND(PDTriangle(pVec(0, -1, 0.1f), pVec(2, 0, 0.1f), pVec(0, 2, 0.1f))));
+        P.Avoid(PT 3.f, 0.1f, 2.f, PREND(triangle));
     } else if (SteerShape == STEER_RECTANGLE) {
-        P.Avoid(PT 3.f, 0.1f, 2.f, PREND(PDRectangle(pVec(0, -1, 0.1f), pVec(2, 1, 0), pVec(0, 2, 0))));
+        P.Avoid(PT 3.f, 0.1f, 2.f, PREND(rectangle));
     } else if (SteerShape == STEER_PLANE) {
-        P.Avoid(PT 10.f, 1.f, 2.f, PREND(PDPlane(pVec(0, 0, 0.1f), pVec(0, 0, 1))));
+        P.Avoid(PT 10.f, 1.f, 2.f, PREND(plane));
     } else if (SteerShape == STEER_DISC) {
-        P.Avoid(PT 3.f, 0.1f, 2.f, PREND(PDDisc(pVec(0, 0, 0.1f), pVec(0, 0, 1), 1.f, 0.f)));
+        P.Avoid(PT 3.f, 0.1f, 2.f, PREND(disc));
     }
 
     P.Move(PT true, false);
@@ -827,17 +873,20 @@ void Snake::DoActions(EffectsManager& Efx)
     float BOX = .5f;
     P.Source(particleRate, Render(PDBox(pVec(-BOX), pVec(BOX))), S);
 
+    const PDSphere sphere(pVec(0, 0, 0), 25);
+
     PATOP
     P.Follow(PT 10.f, 1.0f);
     // P.Gravitate(PT 10.f, 1.0f); // Gives an interesting effect, but very slow
     P.Damping(PT pVec(0.9));
     P.Move(PT true, false);
-    P.Sink(PT false, PDSphere(pVec(0, 0, 0), 25));
+    P.Sink(PT false, sphere);
     PAEND
 }
 
 void Snake::StartEffect(EffectsManager& Efx)
 {
+    if (Efx.particleHandle >= 0) Efx.P.SetPreserveOrder(true); // Each particle follows the next one in the list
     particleRate = 10.0f; // Make a few additional particles
     PrimType = PRIM_DISPLAY_LIST;
     WhiteBackground = true;
@@ -858,9 +907,11 @@ void Sphere::DoActions(EffectsManager& Efx)
     S.Size(particleSize);
     P.Source(particleRate, PDPoint(pVec(1, 0, 8)), S);
 
+    const PDSphere sphere(Efx.center, 5);
+
     PATOP
     P.Gravity(PT Efx.GravityVec);
-    P.Bounce(PT 0, 0.55, 0, PREND(PDSphere(Efx.center, 5)));
+    P.Bounce(PT 0, 0.55, 0, PREND(sphere));
     P.Move(PT true, false);
     P.KillOld(PT particleLifetime);
     PAEND
@@ -903,11 +954,13 @@ void Swirl::DoActions(EffectsManager& Efx)
     S.Color(PDSphere(tjet, 0.1));
     P.Source(particleRate, PDPoint(jet), S);
 
+    const PDSphere sphere(Efx.center, 25.f);
+
     PATOP
     P.OrbitLine(PT pVec(2, 0, 3), pVec(1.f, 0.f, 0.f), 100.f, 1.5f);
     P.Damping(PT pVec(0.995f));
     P.Move(PT true, false);
-    P.Sink(PT false, PDSphere(Efx.center, 25.f));
+    P.Sink(PT false, sphere);
     P.KillOld(PT particleLifetime);
     PAEND
 }
@@ -943,13 +996,15 @@ void Tornado::DoActions(EffectsManager& Efx)
     S.Size(particleSize);
     P.Source(particleRate, Render(PDBox(pVec(-7, 0, 12), pVec(7, 0, 16))), S);
 
+    const PDPlane plane(pVec(0, 0, -2), pVec(0, 0, 1));
+
     PATOP
     P.Damping(PT pVec(.95));
     P.Gravity(PT Efx.GravityVec);
     P.Vortex(PT Efx.center + pVec(0, 0, -5.f), pVec(0, 0, 11), 1.8f, 7.f, 80.f, -200.f, 1000.0f);
     P.Move(PT true, false);
     P.KillOld(PT particleLifetime);
-    P.Sink(PT false, PREND(PDPlane(pVec(0, 0, -2), pVec(0, 0, 1))));
+    P.Sink(PT false, PREND(plane));
     PAEND
 
     Render(PDPlane(pVec(0, 0, -2), pVec(0, 0, 1)));
@@ -976,16 +1031,23 @@ void Waterfall::DoActions(EffectsManager& Efx)
     S.Size(particleSize);
     P.Source(particleRate, Render(PDLine(pVec(-5, -1, 8), pVec(-5, 1, 8))), S);
 
+    const PDRectangle rectangle(pVec(-7, -2, 7), pVec(3, 0, 0), pVec(0, 4, 0));
+    const PDSphere sphere1(pVec(-3.7, 1, 6), 0.5);
+    const PDSphere sphere2(pVec(-3.5, 0, 2), 2);
+    const PDSphere sphere3(pVec(3.8, 0, 0), 2);
+    const PDPlane plane(pVec(0, 0, 0), pVec(0, 0, 1));
+    const PDSphere sphere4(pVec(0, 0, 0), 25);
+
     PATOP
     P.Gravity(PT Efx.GravityVec);
-    P.Bounce(PT 0, 0.3, 0, PREND(PDRectangle(pVec(-7, -2, 7), pVec(3, 0, 0), pVec(0, 4, 0))));
-    P.Bounce(PT 0, 0.5, 0, PREND(PDSphere(pVec(-3.7, 1, 6), 0.5)));
-    P.Bounce(PT 0, 0.5, 0, PREND(PDSphere(pVec(-3.5, 0, 2), 2)));
-    P.Bounce(PT 0, 0.5, 0, PREND(PDSphere(pVec(3.8, 0, 0), 2)));
-    P.Bounce(PT - 0.01, 0.35, 0, PREND(PDPlane(pVec(0, 0, 0), pVec(0, 0, 1))));
+    P.Bounce(PT 0, 0.3, 0, PREND(rectangle));
+    P.Bounce(PT 0, 0.5, 0, PREND(sphere1));
+    P.Bounce(PT 0, 0.5, 0, PREND(sphere2));
+    P.Bounce(PT 0, 0.5, 0, PREND(sphere3));
+    P.Bounce(PT - 0.01, 0.35, 0, PREND(plane));
     P.Move(PT true, false);
     P.KillOld(PT particleLifetime);
-    P.Sink(PT false, PDSphere(pVec(0, 0, 0), 25));
+    P.Sink(PT false, sphere4);
     PAEND
 
     Render(PDRectangle(pVec(-7, -2, 7), pVec(3, 0, 0), pVec(0, 4, 0)));
@@ -1045,6 +1107,7 @@ void EffectsManager::ChooseDemo(int newDemoNum, ExecMode_e EM)
     Demo = Effects[demoNum];
 
     std::cerr << Demo->GetName() << '\n';
+    if (particleHandle >= 0) P.SetPreserveOrder(false); // Snake turns it on
     Demo->StartEffect(*this);
 }
 
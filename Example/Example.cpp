@@ -27,15 +27,19 @@ void ComputeParticles()
     // Generate particles along a very small line in the nozzle
     P.Source(200, PDLine(pVec(0.f, 0.f, 0.f), pVec(0.f, 0.f, 0.4f)), S);
 
+    // Make the domains once, outside the loop over particles
+    const PDDisc Disc(pVec(0.f, 0.f, 0.f), pVec(0.f, 0.f, 1.f), 5.f);
+    const PDPlane Floor(pVec(0.f, 0.f, -3.f), pVec(0.f, 0.f, 1.f));
+
     P.ParticleLoop(std::execution::par_unseq, [&](Particle_t& p_) {
         // Gravity
         P.Gravity(p_, pVec(0.f, 0.f, -0.01f));
 
         // Bounce particles off a disc of radius 5
-        P.Bounce(p_, 0.f, 0.5f, 0.f, PDDisc(pVec(0.f, 0.f, 0.f), pVec(0.f, 0.f, 1.f), 5.f));
+        P.Bounce(p_, 0.f, 0.5f, 0.f, Disc);
 
         // Kill particles below Z=-3
-        P.Sink(p_, false, PDPlane(pVec(0.f, 0.f, -3.f), pVec(0.f, 0.f, 1.f)));
+        P.Sink(p_, false, Floor);
 
         // Move particles to their new positions
         P.Move(p_, true, false);
@@ -42,8 +42,8 @@ particle dynamics or collision) </td><td>3 floats </td></tr><tr><td>PositionB </
 floats </td></tr><tr><td>UpB </td><td>initial or target orientation for returning to (see Restore()) </td><td>3 floats </td></tr><tr><td>VelocityB </td><td>can
 be used as velocity from last frame for computing a side vector </td><td>3 floats </td></tr><tr><td>Mass </td><td>how large the particle is for dynamics
 computations (doesn't affect collision location) </td><td>1 float </td></tr><tr><td>Age </td><td>time since the particle's creation </td><td>1 float
-</td></tr><tr><td>Alpha </td><td>opacity, or a fourth color channel </td><td>1 float </td></tr><tr><td>Tmp </td><td>for a sorting key or for tagging particles
-to kill by setting to P_MAXFLOAT </td><td>1 float </td></tr><tr><td>Data </td><td>user data to be passed back to user callbacks </td><td>1 uint32
+</td></tr><tr><td>Alpha </td><td>opacity, or a fourth color channel </td><td>1 float </td></tr><tr><td>Tmp </td><td>for a sorting key or other temporary values
+</td><td>1 float </td></tr><tr><td>Data </td><td>user data to be passed back to user callbacks </td><td>1 uint32
 </td></tr></table>
 
 \subsection actions Actions
@@ -11,13 +11,44 @@
 #include "Particle/pError.h"
 #include "Particle/pInternalShadow.h"
 #include "Particle/pParticle.h"
+#include "Particle/pScheduler.h"
 #include "Particle/pSourceState.h"
 
+#include <cstdint>
+#include <execution>
+#include <string>
+#include <type_traits>
+#include <vector>
+
 namespace PAPI {
 
 class PInternalState_t; // The API-internal struct containing the context's state. Don't try to use it.
 struct Particle_t;
 
+/// How the actions of one type run their loops over particles. Returned by PContextActionList_t::GetActionPolicies().
+struct pActionPolicy_t {
+    std::string name;              ///< The action's name, such as "PAGravity"
+    float ns_per_particle;         ///< The measured time to run the action on one particle on one thread, in nanoseconds. 0 until measured.
+    uint64_t calls;                ///< How many loops over particles actions of this type have run
+    uint64_t parallel_calls;       ///< How many of those ran as tasks of the scheduler instead of serially
+    uint64_t particles;            ///< How many particles those loops ran on in total
+    size_t grain;                  ///< The particles per task of the most recent parallel loop. 0 if none has run in parallel.
+    size_t min_parallel_particles; ///< Loops over fewer particles than this run serially. 0 until measured.
+};
+
+/// The profiling counters of one action. Returned by PContextActionList_t::GetActionProfile().
+struct pActionProfile_t {
+    std::string name;               ///< The action's name, such as "PAGravity", or "PAFused" for a run of actions that run as one
+    std::string abrv;               ///< The action's abbreviation, such as "Gr"
+    std::vector<std::string> fused; ///< For a PAFused, the names of the actions it runs. Their counters are part of the PAFused's.
+    uint64_t ns;                    ///< Time spent in the action, in nanoseconds summed over the threads that ran it
+    uint64_t particles;             ///< How many particles it was applied to
+    uint64_t chunks;                ///< How many working sets, whole groups, and batches of new particles it was applied to
+    uint64_t segments;              ///< How many segments of the list started at it. Each segment makes another pass over the particles.
+    uint64_t killed;                ///< How many particles it killed
+    uint64_t emitted;               ///< How many particles it created
+};
+
 /// Action List Calls
 ///
 /// These calls create and operate on action lists, which are scripts of many actions
@@ -41,11 +72,12 @@ class PContextActionList_t {
 public:
     /// Set the random number seed.
     ///
-    /// The Particle API uses a pseudo-random number generator. The returned number is a function of the numbers already returned. If you start
-    /// two threads, each with a ParticleContext_t they will both generate the same particles if given the same commands. If this is not desired,
-    /// call Seed() on both of them with different seed values.
-    /// The API currently uses the C standard library random number generator, whose state is per-thread, so all contexts in the thread share
-    /// the same random number seed.
+    /// The Particle API uses a counter-based pseudo-random number generator (Philox4x32-10). Each context has its own seed. Each particle
+    /// draws from its own stream, keyed by the seed, the number of actions the context has run, and the particle's index in its group. So the
+    /// particles depend only on the seed and the commands given, not on how many threads process them or in what order. If you make two
+    /// contexts they will both generate the same particles if given the same commands. If this is not desired, call Seed() on both of them
+    /// with different seed values. pRandf() outside of the API draws from a separate stream on each thread, which pSRandf() seeds. Each
+    /// thread's stream is different.
     void Seed(const unsigned int seed);
 
     /// Specify the time step length.
@@ -107,6 +139,14 @@ public:
     /// End the creation of a new action list.
     ///
     /// Obviously, it is an error to call EndActionList() without a corresponding call to NewActionList().
+    /// The list is optimized here. Actions that change nothing, such as Gravity(pVec(0.f)), Damping(pVec(1.f)), or Callback(NULL), are dropped,
+    /// which changes the random numbers that the actions after them draw.
+    /// Actions that kill particles are moved next to each other where the actions between them don't write what they test and don't create
+    /// particles or call back the application.
+    /// Each run of consecutive per-particle actions in the list, such as Gravity(), Bounce(), and Move(), is fused here into one action
+    /// that makes a single pass over the particles of P_LAYOUT_AOS groups. Actions that use random numbers, that look at other particles,
+    /// or that create particles aren't fused. Adjacent fused actions such as two Gravity() or two TargetColor() calls are folded into one
+    /// for the current dt, which only changes the results by rounding.
     void EndActionList();
 
     /// Generate a block of empty action lists.
@@ -124,6 +164,33 @@ public:
     /// list will be created anew. This is as with glNewActionList() in OpenGL.
     void NewActionList(const int action_list_num);
 
+    /// Choose how each action runs its loop over particles from the action's measured cost.
+    ///
+    /// With adaptive execution, which is the default, the time each type of action takes per particle is measured as it runs. An action's loop
+    /// runs serially when the measured cost predicts that splitting it among the scheduler's threads would cost more than it saves, such as for
+    /// cheap actions on small groups or on the working-set chunks of an action list. Otherwise it runs as tasks of the scheduler, sized to take
+    /// a few microseconds each. Call SetAdaptiveExecution(false) to run every action's loop serially on the thread that runs the action, which
+    /// is useful when the scheduler's threads are busy with other work. Actions that don't loop over particles aren't affected.
+    void SetAdaptiveExecution(const bool adaptive);
+
+    /// Return the measured cost and the execution decisions of each type of action that has run with adaptive execution on, sorted by name.
+    std::vector<pActionPolicy_t> GetActionPolicies() const;
+
+    /// Turn the profiling counters of the actions on or off.
+    ///
+    /// While profiling is on, each action of each action list counts the time it takes, the particles and chunks it is applied to, the segments
+    /// that start at it, and the particles it kills and creates. It costs a clock read before and after each action on each working set, so it
+    /// is cheap enough to leave on. Immediate mode actions are counted together by name. Profiling is off by default.
+    void SetActionProfiling(const bool profiling);
+
+    /// Return the profiling counters of each action of the given action list, in the order they run after EndActionList() has optimized the list.
+    ///
+    /// If action_list_num is negative, return the counters of the immediate mode actions instead, one per action name, sorted by name.
+    std::vector<pActionProfile_t> GetActionProfile(const int action_list_num) const;
+
+    /// Set the profiling counters of the actions of the given action list to zero, or of the immediate mode actions if action_list_num is negative.
+    void ResetActionProfile(const int action_list_num);
+
 protected:
     std::shared_ptr<PInternalState_t> PS;                     // The internal API data for this context is stored here.
     void InternalSetup(std::shared_ptr<PInternalState_t> Sr); // Calls this after construction to set up the PS pointer
@@ -177,8 +244,28 @@ public:
     /// Generates p_group_count new particle groups and returns the particle group number of the first one. The groups are numbered sequentially,
     /// beginning with the number returned. Each particle group is set to have at most max_particles particles. Call SetMaxParticles() to change this.
     /// Particle group numbers of groups that have been deleted (using DeleteParticleGroups()) might be reused by GenParticleGroups().
-    int GenParticleGroups(const int p_group_count = 1,   ///< generate this many groups
-                          const size_t max_particles = 0 ///< each created group can have this many particles
+    ///
+    /// The layout controls how the particles are stored in memory. P_LAYOUT_AOS stores an array of Particle_t, which is what
+    /// GetParticlePointer() returns. P_LAYOUT_SOA stores each attribute in its own array. Action lists then copy only the attributes each
+    /// segment of actions touches into a cache-sized working set and back, which saves memory bandwidth on large groups whose actions each
+    /// touch only a few attributes. P_LAYOUT_AOSOA stores blocks of P_BLOCK_WIDTH particles with each attribute contiguous within a block.
+    /// Simple actions such as Move(), Gravity(), and Damping() then run in place on the blocks with vectorized loops, and the others are staged
+    /// as in P_LAYOUT_SOA. P_LAYOUT_HOTCOLD keeps position, velocity, size, color, alpha, age, and mass in one array and the rarely used
+    /// attributes (orientation, vertexB, and user data) in another, so action lists that don't touch the rarely used attributes never load
+    /// them. P_LAYOUT_PACKED stores only the attributes named in attribs, so a point sprite effect that never uses orientation, vertexB, or
+    /// user data moves half as much memory. The attributes that aren't stored read as zero, except size, color, alpha, and mass, which read as
+    /// one, and writes to them are discarded. Actions that only write attributes that aren't stored are skipped. Adding the PA_COLOR_RGBA8,
+    /// PA_COLOR_RGBA16F, or PA_SIZE_16F hints to attribs stores color and alpha, or size, in fewer bits. They are converted to and from float
+    /// as the particles are processed, so a full group with PA_COLOR_RGBA8 and PA_SIZE_16F needs 112 bytes per particle. Actions that need the whole
+    /// group at once, such as Sort() and Gravitate(), are slower in the layouts other than P_LAYOUT_AOS.
+    ///
+    /// The pGroupMemory_E flags in memory control how a P_LAYOUT_AOS group's array of particles is allocated. It is always aligned to a
+    /// cache line. Large groups can also be backed by huge pages to save TLB misses on each sweep, and can be pre-faulted when allocated.
+    int GenParticleGroups(const int p_group_count = 1,                ///< generate this many groups
+                          const size_t max_particles = 0,             ///< each created group can have this many particles
+                          const pGroupLayout_E layout = P_LAYOUT_AOS, ///< how the particles of each created group are stored
+                          const unsigned int attribs = PA_ALL,        ///< the pAttrib_E mask of attributes stored by P_LAYOUT_PACKED groups
+                          const unsigned int memory = P_MEM_DEFAULT   ///< pGroupMemory_E flags saying how each created group's memory is allocated
     );
 
     /// Returns the number of particles existing in the current group.
@@ -252,6 +339,22 @@ public:
     /// Call SetMaxParticles(0) to empty the group.
     void SetMaxParticles(const size_t max_count);
 
+    /// Specify whether killing particles keeps the rest of the current group in order.
+    ///
+    /// By default each killed particle is replaced by a particle from the end of the group, which moves the fewest particles.
+    /// Effects that depend on the order of the particles, such as those using Follow(), should call SetPreserveOrder(true), which slides
+    /// the surviving particles down to fill the gaps instead. Both ways run in parallel, except for preserving the order of a group that
+    /// isn't P_LAYOUT_AOS.
+    void SetPreserveOrder(const bool preserve_order);
+
+    /// Store the current particle group in the given file, which is memory mapped.
+    ///
+    /// This changes the group's layout to P_LAYOUT_MAPPED so that it can hold more particles than fit in RAM, such as for offline renders.
+    /// The file is created or truncated, grows as the group does, and is kept after the group is deleted. Groups created with
+    /// P_LAYOUT_MAPPED by GenParticleGroups() use a temporary file instead. Action lists process the group one working set at a time,
+    /// so the OS streams the file through memory. Actions that need the whole group at once, such as Sort(), still need it all in RAM.
+    void MapGroupToFile(const std::string& file_name);
+
     /// Specify a particle creation callback.
     ///
     /// Specify a callback function within your code that should be called every time a particle is created. The callback is associated only
@@ -283,11 +386,92 @@ public:
     /// You specify the working set size in bytes.
     void SetWorkingSetSize(const int set_size_bytes);
 
+    /// Let each action list tune its own working set size
+    ///
+    /// With auto_tune true, each action list times its calls with working set sizes from 16 KB to 8 MB, starting at the size of the CPU's L2
+    /// cache and stepping by factors of two toward the faster ones. It settles on the fastest size within about ten calls and keeps it until
+    /// the list is redefined. The size given to SetWorkingSetSize() is used by immediate mode actions, and by action lists when auto_tune is false.
+    /// The lists are timed on whichever particle group is current when they are called, so tune them on a group of typical size.
+    void SetWorkingSetAutoTune(const bool auto_tune);
+
+    /// Return the working set size in bytes that the given action list runs with
+    ///
+    /// This is the size being tried or the tuned size if auto-tuning is on and the list has been called. Otherwise it is the size given to
+    /// SetWorkingSetSize(), which is also returned when action_list_num is negative.
+    int GetWorkingSetSize(const int action_list_num = -1) const;
+
+    /// Set the scheduler that runs the context's parallel loops
+    ///
+    /// Action lists run the chunks of each segment of actions as tasks of this scheduler. Actions that loop over particles in parallel,
+    /// committing kills, and ParticleLoop() with a parallel execution policy also run on it. The default is a pThreadPool_t with one thread per
+    /// hardware thread. Pass a pThreadPool_t to choose the thread count or to pin the threads, a pStdParScheduler_t for the standard library's
+    /// parallel algorithms (TBB with libstdc++), a pOpenMPScheduler_t, or your own pScheduler_t. Set pScheduler_t::grain_size to choose how many
+    /// particles a task gets. Passing NULL runs everything on the calling thread. The scheduler may be shared by several contexts.
+    void SetScheduler(std::shared_ptr<pScheduler_t> scheduler);
+
+    /// Return the context's scheduler
+    std::shared_ptr<pScheduler_t> GetScheduler();
+
 protected:
     std::shared_ptr<PInternalState_t> PS;                     // The internal API data for this context is stored here.
     void InternalSetup(std::shared_ptr<PInternalState_t> Sr); // Calls this after construction to set up the PS pointer
 };
 
+struct PADamping_Prep;
+struct PARotDamping_Prep;
+struct PAExplosion_Prep;
+struct PAGravity_Prep;
+struct PAOrbitLine_Prep;
+struct PAOrbitPoint_Prep;
+struct PASpeedClamp_Prep;
+struct PATargetColor_Prep;
+struct PATargetSize_Prep;
+struct PATargetVelocity_Prep;
+struct PATargetRotVelocity_Prep;
+struct PAVortex_Prep;
+template <class D> struct PABounce_Prep;
+
+/// This class makes prepared inline actions.
+///
+/// A prepared action holds an action's parameters along with the values computed from them that do not vary per particle, such as the
+/// normalized axis of Vortex(). Make them before ParticleLoop, once per frame, and call their Apply() on each particle inside it, instead of
+/// the inline action that recomputes those values for every particle. Prepared actions use the time step that is current when they are
+/// made. The parameters are those of the inline actions of the same names. For example: \code
+///
+/// const PDDisc Floor(pVec(0, 0, 1.f), pVec(0, 0, 1.f), 5);
+/// auto vortex = P.Prep.Vortex(pVec(0, 0, -1), pVec(0, 0, 10), 1.8f, 6.f, 0.01f, -0.2f, 1.f);
+/// auto bounce = P.Prep.Bounce(0.f, 0.5f, 0.f, Floor);
+/// P.ParticleLoop(std::execution::par_unseq, [&](Particle_t& p_) {
+///     vortex.Apply(p_);
+///     bounce.Apply(p_);
+///     P.Move(p_, true, false);
+/// });
+/// \endcode
+class PContextPrep_t {
+public:
+    template <class D> PABounce_Prep<D> Bounce(const float friction, const float resilience, const float fric_min_vel, const D& dom) const;
+    PADamping_Prep Damping(const pVec& damping, const float min_vel = 0.0f, const float max_vel = P_MAXFLOAT) const;
+    PARotDamping_Prep RotDamping(const pVec& damping, const float min_vel = 0.0f, const float max_vel = P_MAXFLOAT) const;
+    PAExplosion_Prep Explosion(const pVec& center, const float radius, const float magnitude, const float sigma, const float epsilon = P_EPS) const;
+    PAGravity_Prep Gravity(const pVec& dir) const;
+    PAOrbitLine_Prep OrbitLine(const pVec& p, const pVec& axis, const float magnitude = 1.0f, const float epsilon = P_EPS,
+                               const float max_radius = P_MAXFLOAT) const;
+    PAOrbitPoint_Prep OrbitPoint(const pVec& center, const float magnitude = 1.0f, const float epsilon = P_EPS, const float max_radius = P_MAXFLOAT) const;
+    PASpeedClamp_Prep SpeedClamp(const float min_speed, const float max_speed) const;
+    PATargetColor_Prep TargetColor(const pVec& color, const float alpha, const float scale) const;
+    PATargetSize_Prep TargetSize(const pVec& size, const pVec& scale) const;
+    PATargetVelocity_Prep TargetVelocity(const pVec& vel, const float scale) const;
+    PATargetRotVelocity_Prep TargetRotVelocity(const pVec& rvel, const float scale) const;
+    PAVortex_Prep Vortex(const pVec& tip, const pVec& axis, const float tightnessExponent, const float max_radius, const float inSpeed, const float upSpeed,
+                         const float aroundSpeed) const;
+
+protected:
+    friend class PContextActions_t;
+    float get_dt() const;                                     // The context's current time step
+    std::shared_ptr<PInternalState_t> PS;                     // The internal API data for this context is stored here.
+    void InternalSetup(std::shared_ptr<PInternalState_t> Sr); // Calls this after construction to set up the PS pointer
+};
+
 /// This class contains the Action API.
 ///
 /// Actions modify the position, color, velocity, size, age, and other attributes of
@@ -316,12 +500,15 @@ protected:
 ///
 /// The inline actions are called only from within a call to ParticleLoop(). For example: \code
 ///
+/// PDDisc Floor(pVec(0, 0, 1.f), pVec(0, 0, 1.f), 5);
+/// PDPlane Bottom(pVec(0, 0, -3), pVec(0, 0, 1));
+/// PDSphere Slow(pVec(0, 0, 0), 0.01);
 /// P.ParticleLoop(std::execution::par_unseq, [&](Particle_t& p_) {
 ///     P.Gravity(p_, Efx.GravityVec);
-///     P.Bounce(p_, 0.f, 0.5f, 0.f, PDDisc(pVec(0, 0, 1.f), pVec(0, 0, 1.f), 5));
+///     P.Bounce(p_, 0.f, 0.5f, 0.f, Floor);
 ///     P.Move(p_, true, false);
-///     P.Sink(p_, false, PDPlane(pVec(0, 0, -3), pVec(0, 0, 1)));
-///     P.SinkVelocity(p_, true, PDSphere(pVec(0, 0, 0), 0.01));
+///     P.Sink(p_, false, Bottom);
+///     P.SinkVelocity(p_, true, Slow);
 /// });
 /// P.CommitKills();
 /// \endcode
@@ -339,7 +526,27 @@ public:
 #include "Particle/pActionDecls.h"
 #undef PARG
 
+    /// The inline actions that take domains are also templates on the domains' concrete types, as in P.Bounce<PDDisc>(m, ...).
+    ///
+    /// The types are deduced when the domain arguments have concrete types. The domains' Within and Generate are then inlined into the
+    /// particle loop, with no switch on the domain type and no virtual calls. Construct the domains before ParticleLoop and capture them,
+    /// since a domain constructed inside the loop is constructed for every particle. Debug builds print a warning the first time that happens.
+    template <class D> void Avoid(Particle_t& m, const float magnitude, const float epsilon, const float look_ahead, const D& dom);
+    template <class D> void Bounce(Particle_t& m, const float friction, const float resilience, const float fric_min_vel, const D& dom);
+    template <class D, class A> void Jet(Particle_t& m, const D& dom, const A& acc);
+    template <class D> void RandomAccel(Particle_t& m, const D& dom);
+    template <class D> void RandomDisplace(Particle_t& m, const D& dom);
+    template <class D> void RandomVelocity(Particle_t& m, const D& dom);
+    template <class D> void RandomRotVelocity(Particle_t& m, const D& dom);
+    template <class D> void Sink(Particle_t& m, const bool kill_inside, const D& kill_pos_dom);
+    template <class D> void SinkVelocity(Particle_t& m, const bool kill_inside, const D& kill_vel_dom);
+
+    /// Make prepared inline actions, as in P.Prep.Vortex(...). See PContextPrep_t.
+    PContextPrep_t Prep;
+
     /// Delete particles tagged to be killed by inline P.I.KillOld(), P.I.Sink(), and P.I.SinkVelocity()
+    ///
+    /// The tags are one bit per particle, so this costs almost nothing when no particle was tagged.
     void CommitKills();
 
     /// Sort the particles by their projection onto the look vector.
@@ -397,8 +604,13 @@ public:
     /// <param name="f">a lambda function expressing all operations to be performed on each particle</param>
     template <class UnaryFunction> void ParticleLoop(UnaryFunction f)
     {
-        StartParticleLoop(PS, PSh);
-        std::for_each(PSh.get_pgroup_begin(), PSh.get_pgroup_end(), f);
+#ifdef _DEBUG
+        auto body = [&](Particle_t& m) { pParticleLoopScope loop_scope; f(m); }; // Marks whichever thread runs each particle
+#else
+        UnaryFunction& body = f;
+#endif
+        StartParticleLoop(PS, PSh, PA_ALL);
+        while (NextParticleChunk(PS, PSh)) std::for_each(PSh.get_pgroup_begin(), PSh.get_pgroup_end(), body);
         EndParticleLoop(PS, PSh);
     }
 
@@ -408,10 +620,36 @@ public:
     /// <typeparam name="UnaryFunction"></typeparam>
     /// <param name="f">a lambda function expressing all operations to be performed on each particle</param>
     /// <param name="policy">execution policy to be used for parallelization, for example std::execution::par_unseq</param>
-    template <class ExPol, class UnaryFunction> void ParticleLoop(ExPol&& policy, UnaryFunction f)
+    template <class ExPol, class UnaryFunction> void ParticleLoop(ExPol&& policy, UnaryFunction f) { ParticleLoop(policy, PA_ALL, f); }
+
+    /// <summary>
+    /// Loop over particles executing all actions expressed in function f, which only touches the given particle attributes
+    ///
+    /// For groups that aren't P_LAYOUT_AOS the particles are visited one working set at a time, and only the attributes in attribs are valid
+    /// in the Particle_t passed to f. Only attribs == PA_ALL makes the whole group visible to inter-particle actions such as Gravitate().
+    /// For P_LAYOUT_AOS groups attribs has no effect. Killed particles are tagged in a bitmap kept by the group, not in the Particle_t.
+    /// </summary>
+    /// <typeparam name="UnaryFunction"></typeparam>
+    /// <param name="policy">std::execution::seq to run on the calling thread, or a parallel policy such as std::execution::par_unseq to run on the
+    /// context's scheduler. See PContextParticleGroup_t::SetScheduler().</param>
+    /// <param name="attribs">the pAttrib_E mask of attributes that f reads or writes, for example PA_POS | PA_VEL | PA_AGE</param>
+    /// <param name="f">a lambda function expressing all operations to be performed on each particle</param>
+    template <class ExPol, class UnaryFunction> void ParticleLoop(ExPol&& policy, const unsigned int attribs, UnaryFunction f)
     {
-        StartParticleLoop(PS, PSh);
-        std::for_each(policy, PSh.get_pgroup_begin(), PSh.get_pgroup_end(), f);
+#ifdef _DEBUG
+        auto body = [&](Particle_t& m) { pParticleLoopScope loop_scope; f(m); }; // Marks whichever thread runs each particle
+#else
+        UnaryFunction& body = f;
+#endif
+        StartParticleLoop(PS, PSh, attribs);
+        while (NextParticleChunk(PS, PSh)) {
+            if constexpr (std::is_same_v<std::decay_t<ExPol>, std::execution::sequenced_policy>) {
+                std::for_each(policy, PSh.get_pgroup_begin(), PSh.get_pgroup_end(), body);
+            } else {
+                Particle_t* ibegin = PSh.get_pgroup_begin();
+                PSh.scheduler->ForEach(PSh.get_pgroup_end() - ibegin, PSh.scheduler->grain_size, [&](const size_t i) { body(ibegin[i]); });
+            }
+        }
         EndParticleLoop(PS, PSh);
     }
 
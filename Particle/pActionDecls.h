@@ -307,6 +307,7 @@ void MatchRotVelocity(PARG const float magnitude = 1.0f,  ///< scales each parti
 /// Call an arbitrary user-provided function on each particle in the group.
 ///
 /// The function will receive both your call data and the full Particle_t struct, which contains per-particle user data.
+/// Within an action list, the function isn't called for particles that the actions before it killed.
 void Callback(PARG P_PARTICLE_CALLBACK_ACTION callbackFunc, ///< Pointer to function of yours to call.
               const pdata_t call_data = 0                   ///< Arbitrary data of yours to pass into your function
 );
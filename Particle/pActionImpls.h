@@ -27,8 +27,12 @@
 #include "Particle/pParticle.h"
 #include "Particle/pSourceState.h"
 
+#include <type_traits>
+
 using namespace PAPI;
 
+namespace PAPI {
+
 PINLINE void PAAvoidTriangle_Impl(Particle_t& m, const float dt, const PDTriangle& dom, const float look_ahead, const float magnitude, const float epsilon)
 {
     float magdt = magnitude * dt;
@@ -267,14 +271,20 @@ PINLINE void PAAvoidDisc_Impl(Particle_t& m, const float dt, const PDDisc& dom,
 // This approach uses the actual hit location and hit time to determine whether we actually hit.
 // But it doesn't bounce from the actual location or time. It reverses the velocity immediately, applying
 // the whole velocity in the outward direction for the whole time step.
-PINLINE void PABounceTriangle_Impl(Particle_t& m, const float dt, const PDTriangle& dom, const float friction, const float resilience, const float fric_min_vel)
-{
-    float oneMinusFriction = 1.f - friction;
-    float FricMinTanVelSqr = fsqr(fric_min_vel);
-    // ^^^ Above values do not vary per particle.
+// The values of Bounce that do not vary per particle
+struct PABounceParams_t {
+    float dt, dtinv, oneMinusFriction, resilience, FricMinTanVelSqr;
+
+    PABounceParams_t(const float dt_, const float friction, const float resilience_, const float fric_min_vel) :
+        dt(dt_), dtinv(1.0f / dt_), oneMinusFriction(1.f - friction), resilience(resilience_), FricMinTanVelSqr(fsqr(fric_min_vel))
+    {
+    }
+};
 
+PINLINE void PABounceTriangle_Impl(Particle_t& m, const PDTriangle& dom, const PABounceParams_t& B)
+{
     // See if particle's current and pnext positions cross boundary. If not, skip it.
-    pVec pnext = m.pos + m.vel * dt;
+    pVec pnext = m.pos + m.vel * B.dt;
 
     // Nrm stores the plane normal (the a,b,c of the plane eqn).
     // Old and new distances: dist(p,plane) = n * p + d
@@ -302,18 +312,19 @@ PINLINE void PABounceTriangle_Impl(Particle_t& m, const float dt, const PDTriang
     pVec vt = m.vel - vn;   // Tangent Vt = V - Vn
 
     // Compute new velocity, applying resilience and, unless tangential velocity < fric_min_vel, friction
-    float fric = (vt.lenSqr() <= FricMinTanVelSqr) ? 1.f : oneMinusFriction;
-    m.vel = vt * fric - vn * resilience;
+    float fric = (vt.lenSqr() <= B.FricMinTanVelSqr) ? 1.f : B.oneMinusFriction;
+    m.vel = vt * fric - vn * B.resilience;
 }
 
-PINLINE void PABounceRectangle_Impl(Particle_t& m, const float dt, const PDRectangle& dom, const float friction, const float resilience, const float fric_min_vel)
+PINLINE void PABounceTriangle_Impl(Particle_t& m, const float dt, const PDTriangle& dom, const float friction, const float resilience, const float fric_min_vel)
 {
-    float oneMinusFriction = 1.f - friction;
-    float FricMinTanVelSqr = fsqr(fric_min_vel);
-    // ^^^ Above values do not vary per particle.
+    PABounceTriangle_Impl(m, dom, PABounceParams_t(dt, friction, resilience, fric_min_vel));
+}
 
+PINLINE void PABounceRectangle_Impl(Particle_t& m, const PDRectangle& dom, const PABounceParams_t& B)
+{
     // See if particle's current and pnext positions cross boundary. If not, skip it.
-    pVec pnext = m.pos + m.vel * dt;
+    pVec pnext = m.pos + m.vel * B.dt;
 
     // Nrm stores the plane normal (the a,b,c of the plane eqn).
     // Old and new distances: dist(p,plane) = n * p + d
@@ -341,18 +352,19 @@ PINLINE void PABounceRectangle_Impl(Particle_t& m, const float dt, const PDRecta
     pVec vt = m.vel - vn;   // Tangent Vt = V - Vn
 
     // Compute new velocity, applying resilience and, unless tangential velocity < fric_min_vel, friction
-    float fric = (vt.lenSqr() <= FricMinTanVelSqr) ? 1.f : oneMinusFriction;
-    m.vel = vt * fric - vn * resilience;
+    float fric = (vt.lenSqr() <= B.FricMinTanVelSqr) ? 1.f : B.oneMinusFriction;
+    m.vel = vt * fric - vn * B.resilience;
 }
 
-PINLINE void PABounceBox_Impl(Particle_t& m, const float dt, const PDBox& dom, const float friction, const float resilience, const float fric_min_vel)
+PINLINE void PABounceRectangle_Impl(Particle_t& m, const float dt, const PDRectangle& dom, const float friction, const float resilience, const float fric_min_vel)
 {
-    float oneMinusFriction = 1.f - friction;
-    float FricMinTanVelSqr = fsqr(fric_min_vel);
-    // ^^^ Above values do not vary per particle.
+    PABounceRectangle_Impl(m, dom, PABounceParams_t(dt, friction, resilience, fric_min_vel));
+}
 
+PINLINE void PABounceBox_Impl(Particle_t& m, const PDBox& dom, const PABounceParams_t& B)
+{
     // See if particle's current and pnext positions cross boundary. If not, skip it.
-    pVec pnext = m.pos + m.vel * dt;
+    pVec pnext = m.pos + m.vel * B.dt;
 
     bool oldIn = dom.Within(m.pos);
     bool newIn = dom.Within(pnext);
@@ -371,18 +383,19 @@ PINLINE void PABounceBox_Impl(Particle_t& m, const float dt, const PDBox& dom, c
     }
 
     // Compute new velocity, applying resilience and, unless tangential velocity < fric_min_vel, friction
-    float fric = (vt.lenSqr() <= FricMinTanVelSqr) ? 1.f : oneMinusFriction;
-    m.vel = vt * fric - vn * resilience;
+    float fric = (vt.lenSqr() <= B.FricMinTanVelSqr) ? 1.f : B.oneMinusFriction;
+    m.vel = vt * fric - vn * B.resilience;
 }
 
-PINLINE void PABouncePlane_Impl(Particle_t& m, const float dt, const PDPlane& dom, const float friction, const float resilience, const float fric_min_vel)
+PINLINE void PABounceBox_Impl(Particle_t& m, const float dt, const PDBox& dom, const float friction, const float resilience, const float fric_min_vel)
 {
-    float oneMinusFriction = 1.f - friction;
-    float FricMinTanVelSqr = fsqr(fric_min_vel);
-    // ^^^ Above values do not vary per particle.
+    PABounceBox_Impl(m, dom, PABounceParams_t(dt, friction, resilience, fric_min_vel));
+}
 
+PINLINE void PABouncePlane_Impl(Particle_t& m, const PDPlane& dom, const PABounceParams_t& B)
+{
     // See if particle's current and pnext positions cross boundary. If not, skip it.
-    pVec pnext = m.pos + m.vel * dt;
+    pVec pnext = m.pos + m.vel * B.dt;
 
     // Nrm stores the plane normal (the a,b,c of the plane eqn).
     // Old and new distances: dist(p,plane) = n * p + d
@@ -399,19 +412,19 @@ PINLINE void PABouncePlane_Impl(Particle_t& m, const float dt, const PDPlane& do
     pVec vt = m.vel - vn;   // Tangent Vt = V - Vn
 
     // Compute new velocity, applying resilience and, unless tangential velocity < fric_min_vel, friction
-    float fric = (vt.lenSqr() <= FricMinTanVelSqr) ? 1.f : oneMinusFriction;
-    m.vel = vt * fric - vn * resilience;
+    float fric = (vt.lenSqr() <= B.FricMinTanVelSqr) ? 1.f : B.oneMinusFriction;
+    m.vel = vt * fric - vn * B.resilience;
 }
 
-PINLINE void PABounceSphere_Impl(Particle_t& m, const float dt, const PDSphere& dom, const float friction, const float resilience, const float fric_min_vel)
+PINLINE void PABouncePlane_Impl(Particle_t& m, const float dt, const PDPlane& dom, const float friction, const float resilience, const float fric_min_vel)
 {
-    float oneMinusFriction = 1.f - friction;
-    float FricMinTanVelSqr = fsqr(fric_min_vel);
-    float dtinv = 1.0f / dt;
-    // ^^^ Above values do not vary per particle.
+    PABouncePlane_Impl(m, dom, PABounceParams_t(dt, friction, resilience, fric_min_vel));
+}
 
+PINLINE void PABounceSphere_Impl(Particle_t& m, const PDSphere& dom, const PABounceParams_t& B)
+{
     // See if particle's current and pnext positions cross boundary. If not, skip it.
-    pVec pnext = m.pos + m.vel * dt;
+    pVec pnext = m.pos + m.vel * B.dt;
 
     if (dom.Within(m.pos)) {           // We are bouncing off the inside of the sphere.
         if (dom.Within(pnext)) return; // Still inside. Do nothing.
@@ -433,11 +446,11 @@ PINLINE void PABounceSphere_Impl(Particle_t& m, const float dt, const PDSphere&
         if (nmag < 0) vn = -vn; // Don't reverse if it's already heading inward
 
         // Compute new velocity, applying resilience and, unless tangential velocity < fric_min_vel, friction
-        float fric = (vt.lenSqr() <= FricMinTanVelSqr) ? 1.f : oneMinusFriction;
-        m.vel = vt * fric + vn * resilience;
+        float fric = (vt.lenSqr() <= B.FricMinTanVelSqr) ? 1.f : B.oneMinusFriction;
+        m.vel = vt * fric + vn * B.resilience;
 
         // Now see where the point will end up. Make sure we fixed it to stay inside.
-        pVec pthree = m.pos + m.vel * dt;
+        pVec pthree = m.pos + m.vel * B.dt;
         if (dom.Within(pthree)) {
             return; // Still inside. We're good.
         } else {
@@ -445,7 +458,7 @@ PINLINE void PABounceSphere_Impl(Particle_t& m, const float dt, const PDSphere&
             pVec toctr = dom.ctr - pthree;
             float dist = toctr.length();
             pVec pwish = dom.ctr - toctr * (0.999f * dom.radOut / dist); // Pwish is a point just inside the sphere.
-            m.vel = (pwish - m.pos) * dtinv;                             // Compute a velocity to get us to pwish on this timestep
+            m.vel = (pwish - m.pos) * B.dtinv;                           // Compute a velocity to get us to pwish on this timestep
         }
     } else { // We are bouncing off the outside of the sphere.
         if (!dom.Within(pnext)) return;
@@ -464,19 +477,20 @@ PINLINE void PABounceSphere_Impl(Particle_t& m, const float dt, const PDSphere&
         pVec vt = m.vel - vn; // Tangent Vt = V - Vn
 
         // Compute new velocity, applying resilience and, unless tangential velocity < fric_min_vel, friction
-        float fric = (vt.lenSqr() <= FricMinTanVelSqr) ? 1.f : oneMinusFriction;
-        m.vel = vt * fric - vn * resilience;
+        float fric = (vt.lenSqr() <= B.FricMinTanVelSqr) ? 1.f : B.oneMinusFriction;
+        m.vel = vt * fric - vn * B.resilience;
     }
 }
 
-PINLINE void PABounceDisc_Impl(Particle_t& m, const float dt, const PDDisc& dom, const float friction, const float resilience, const float fric_min_vel)
+PINLINE void PABounceSphere_Impl(Particle_t& m, const float dt, const PDSphere& dom, const float friction, const float resilience, const float fric_min_vel)
 {
-    float oneMinusFriction = 1.f - friction;
-    float FricMinTanVelSqr = fsqr(fric_min_vel);
-    // ^^^ Above values do not vary per particle.
+    PABounceSphere_Impl(m, dom, PABounceParams_t(dt, friction, resilience, fric_min_vel));
+}
 
+PINLINE void PABounceDisc_Impl(Particle_t& m, const PDDisc& dom, const PABounceParams_t& B)
+{
     // See if particle's current and pnext positions cross boundary. If not, skip it.
-    pVec pnext = m.pos + m.vel * dt;
+    pVec pnext = m.pos + m.vel * B.dt;
 
     // Nrm stores the plane normal (the a,b,c of the plane eqn).
     // Old and new distances: dist(p,plane) = n * p + d
@@ -501,10 +515,44 @@ PINLINE void PABounceDisc_Impl(Particle_t& m, const float dt, const PDDisc& dom,
     pVec vt = m.vel - vn;      // Tangent Vt = V - Vn
 
     // Compute new velocity, applying resilience and, unless tangential velocity < fric_min_vel, friction
-    float fric = (vt.lenSqr() <= FricMinTanVelSqr) ? 1.f : oneMinusFriction;
-    m.vel = vt * fric - vn * resilience;
+    float fric = (vt.lenSqr() <= B.FricMinTanVelSqr) ? 1.f : B.oneMinusFriction;
+    m.vel = vt * fric - vn * B.resilience;
 }
 
+PINLINE void PABounceDisc_Impl(Particle_t& m, const float dt, const PDDisc& dom, const float friction, const float resilience, const float fric_min_vel)
+{
+    PABounceDisc_Impl(m, dom, PABounceParams_t(dt, friction, resilience, fric_min_vel));
+}
+
+// Bounce off a domain of concrete type D, with the values that do not vary per particle computed once
+template <class D> struct PABounce_Prep {
+    D dom;
+    PABounceParams_t B;
+
+    PABounce_Prep(const float dt, const D& dom_, const float friction, const float resilience, const float fric_min_vel) :
+        dom(dom_), B(dt, friction, resilience, fric_min_vel)
+    {
+    }
+
+    PINLINE void Apply(Particle_t& m) const
+    {
+        if constexpr (std::is_same_v<D, PDBox>)
+            PABounceBox_Impl(m, dom, B);
+        else if constexpr (std::is_same_v<D, PDDisc>)
+            PABounceDisc_Impl(m, dom, B);
+        else if constexpr (std::is_same_v<D, PDPlane>)
+            PABouncePlane_Impl(m, dom, B);
+        else if constexpr (std::is_same_v<D, PDRectangle>)
+            PABounceRectangle_Impl(m, dom, B);
+        else if constexpr (std::is_same_v<D, PDSphere>)
+            PABounceSphere_Impl(m, dom, B);
+        else if constexpr (std::is_same_v<D, PDTriangle>)
+            PABounceTriangle_Impl(m, dom, B);
+        else
+            static_assert(sizeof(D) == 0, "Bounce is not implemented for this domain");
+    }
+};
+
 // Set the secondary position and velocity from current
 PINLINE void PACopyVertexB_Impl(Particle_t& m, const float dt, const bool copy_pos, const bool copy_vel)
 {
@@ -520,63 +568,110 @@ PINLINE void PACopyVertexB_Impl(Particle_t& m, const float dt, const bool copy_p
     }
 }
 
+struct PACopyVertexB_Prep {
+    float dt;
+    bool copy_pos, copy_vel;
+
+    PACopyVertexB_Prep(const float dt_, const bool copy_pos_, const bool copy_vel_) : dt(dt_), copy_pos(copy_pos_), copy_vel(copy_vel_) {}
+
+    PINLINE void Apply(Particle_t& m) const { PACopyVertexB_Impl(m, dt, copy_pos, copy_vel); }
+};
+
 // Dampen velocities
-PINLINE void PADamping_Impl(Particle_t& m, const float dt, const pVec damping, const float min_vel, const float max_vel)
-{
-    pVec scale(pVec(1.f) - ((pVec(1.f) - damping) * dt)); // This is important if dt is != 1.
-    float min_vel_sqr = fsqr(min_vel);
-    float max_vel_sqr = fsqr(max_vel);
-    // ^^^ Above values do not vary per particle.
+struct PADamping_Prep {
+    pVec scale; // This is important if dt is != 1.
+    float min_vel_sqr, max_vel_sqr;
+
+    PADamping_Prep(const float dt, const pVec damping, const float min_vel, const float max_vel) :
+        scale(pVec(1.f) - ((pVec(1.f) - damping) * dt)), min_vel_sqr(fsqr(min_vel)), max_vel_sqr(fsqr(max_vel))
+    {
+    }
 
-    float vSqr = m.vel.lenSqr();
+    PINLINE void Apply(Particle_t& m) const
+    {
+        float vSqr = m.vel.lenSqr();
 
-    if (vSqr >= min_vel_sqr && vSqr <= max_vel_sqr) { m.vel = CompMult(m.vel, scale); }
+        if (vSqr >= min_vel_sqr && vSqr <= max_vel_sqr) { m.vel = CompMult(m.vel, scale); }
+    }
+};
+
+PINLINE void PADamping_Impl(Particle_t& m, const float dt, const pVec damping, const float min_vel, const float max_vel)
+{
+    PADamping_Prep(dt, damping, min_vel, max_vel).Apply(m);
 }
 
 // Dampen rotational velocities
-PINLINE void PARotDamping_Impl(Particle_t& m, const float dt, const pVec damping, const float min_vel, const float max_vel)
-{
-    pVec scale(pVec(1.f) - ((pVec(1.f) - damping) * dt)); // This is important if dt is != 1.
-    float min_vel_sqr = fsqr(min_vel);
-    float max_vel_sqr = fsqr(max_vel);
-    // ^^^ Above values do not vary per particle.
+struct PARotDamping_Prep {
+    pVec scale; // This is important if dt is != 1.
+    float min_vel_sqr, max_vel_sqr;
+
+    PARotDamping_Prep(const float dt, const pVec damping, const float min_vel, const float max_vel) :
+        scale(pVec(1.f) - ((pVec(1.f) - damping) * dt)), min_vel_sqr(fsqr(min_vel)), max_vel_sqr(fsqr(max_vel))
+    {
+    }
+
+    PINLINE void Apply(Particle_t& m) const
+    {
+        float vSqr = m.rvel.lenSqr();
 
-    float vSqr = m.rvel.lenSqr();
+        if (vSqr >= min_vel_sqr && vSqr <= max_vel_sqr) { m.rvel = CompMult(m.rvel, scale); }
+    }
+};
 
-    if (vSqr >= min_vel_sqr && vSqr <= max_vel_sqr) { m.rvel = CompMult(m.rvel, scale); }
+PINLINE void PARotDamping_Impl(Particle_t& m, const float dt, const pVec damping, const float min_vel, const float max_vel)
+{
+    PARotDamping_Prep(dt, damping, min_vel, max_vel).Apply(m);
 }
 
 // Exert force on each particle away from explosion center
-PINLINE void PAExplosion_Impl(Particle_t& m, const float dt, const pVec center, const float radius, const float magnitude, const float stdev, const float epsilon)
-{
-    float magdt = magnitude * dt;
-    float oneOverSigma = 1.0f / stdev;
-    float inexp = -0.5f * fsqr(oneOverSigma);
-    float outexp = P_ONEOVERSQRT2PI * oneOverSigma;
-    // ^^^ Above values do not vary per particle.
+struct PAExplosion_Prep {
+    pVec center;
+    float radius, epsilon, magdt, inexp, outexp;
+
+    PAExplosion_Prep(const float dt, const pVec center_, const float radius_, const float magnitude, const float stdev, const float epsilon_) :
+        center(center_), radius(radius_), epsilon(epsilon_), magdt(magnitude * dt)
+    {
+        float oneOverSigma = 1.0f / stdev;
+        inexp = -0.5f * fsqr(oneOverSigma);
+        outexp = P_ONEOVERSQRT2PI * oneOverSigma;
+    }
+
+    PINLINE void Apply(Particle_t& m) const
+    {
+        // Figure direction to particle.
+        pVec dir(m.pos - center);
+        float distSqr = dir.lenSqr();
+        float dist = sqrtf(distSqr);
+        float DistFromWaveSqr = fsqr(radius - dist);
 
-    // Figure direction to particle.
-    pVec dir(m.pos - center);
-    float distSqr = dir.lenSqr();
-    float dist = sqrtf(distSqr);
-    float DistFromWaveSqr = fsqr(radius - dist);
+        float Gd = exp(DistFromWaveSqr * inexp) * outexp;
+        pVec acc(dir * (Gd * magdt / (dist * (distSqr + epsilon))));
 
-    float Gd = exp(DistFromWaveSqr * inexp) * outexp;
-    pVec acc(dir * (Gd * magdt / (dist * (distSqr + epsilon))));
+        m.vel += acc;
+    }
+};
 
-    m.vel += acc;
+PINLINE void PAExplosion_Impl(Particle_t& m, const float dt, const pVec center, const float radius, const float magnitude, const float stdev, const float epsilon)
+{
+    PAExplosion_Prep(dt, center, radius, magnitude, stdev, epsilon).Apply(m);
 }
 
 // Acceleration in a constant direction
-PINLINE void PAGravity_Impl(Particle_t& m, const float dt, const pVec direction)
-{
-    pVec ddir(direction * dt);
+struct PAGravity_Prep {
+    pVec ddir;
 
-    m.vel += ddir;
-}
+    PAGravity_Prep(const float dt, const pVec direction) : ddir(direction * dt) {}
+
+    PINLINE void Apply(Particle_t& m) const { m.vel += ddir; }
+};
+
+PINLINE void PAGravity_Impl(Particle_t& m, const float dt, const pVec direction) { PAGravity_Prep(dt, direction).Apply(m); }
+
+// The domain parameters of the actions below are templates so that a concrete domain type binds at compile time and its Within and
+// Generate are inlined. With pDomain they are virtual calls.
 
 // For particles in the domain of influence, accelerate them with a domain.
-PINLINE void PAJet_Impl(Particle_t& m, const float dt, const pDomain& dom, const pDomain& acc)
+template <class D, class A> PINLINE void PAJet_Impl(Particle_t& m, const float dt, const D& dom, const A& acc)
 {
     if (dom.Within(m.pos)) {
         pVec accel = acc.Generate();
@@ -593,50 +688,83 @@ PINLINE void PAMove_Impl(Particle_t& m, const float dt, const bool move_velocity
     if (move_velocity) { m.pos += m.vel * dt; }
 }
 
+struct PAMove_Prep {
+    float dt;
+    bool move_velocity, move_rotational_velocity;
+
+    PAMove_Prep(const float dt_, const bool move_velocity_, const bool move_rotational_velocity_) :
+        dt(dt_), move_velocity(move_velocity_), move_rotational_velocity(move_rotational_velocity_)
+    {
+    }
+
+    PINLINE void Apply(Particle_t& m) const { PAMove_Impl(m, dt, move_velocity, move_rotational_velocity); }
+};
+
 // Accelerate particles towards a line
-PINLINE void PAOrbitLine_Impl(Particle_t& m, const float dt, const pVec p, const pVec axis, const float magnitude, const float epsilon, const float max_radius)
-{
-    float magdt = magnitude * dt;
-    float max_radiusSqr = fsqr(max_radius);
-    pVec axisNrm(axis);
-    axisNrm.normalize(); // Do we need this? Should we make it user responsibilty?
-    // ^^^ Above values do not vary per particle.
+struct PAOrbitLine_Prep {
+    pVec p, axisNrm;
+    float epsilon, magdt, max_radiusSqr;
+
+    PAOrbitLine_Prep(const float dt, const pVec p_, const pVec axis, const float magnitude, const float epsilon_, const float max_radius) :
+        p(p_), axisNrm(axis), epsilon(epsilon_), magdt(magnitude * dt), max_radiusSqr(fsqr(max_radius))
+    {
+        axisNrm.normalize(); // Do we need this? Should we make it user responsibilty?
+    }
 
-    // Figure direction to particle from base of line.
-    pVec f = m.pos - p;
+    PINLINE void Apply(Particle_t& m) const
+    {
+        // Figure direction to particle from base of line.
+        pVec f = m.pos - p;
 
-    // Projection of particle onto line
-    pVec w = axisNrm * dot(f, axisNrm);
+        // Projection of particle onto line
+        pVec w = axisNrm * dot(f, axisNrm);
 
-    // Direction from particle to nearest point on line.
-    pVec into = w - f;
+        // Direction from particle to nearest point on line.
+        pVec into = w - f;
 
-    // Distance to line (force drops as 1/r^2, normalize by 1/r)
-    // Soften by epsilon to avoid tight encounters to infinity
-    float rSqr = into.lenSqr();
+        // Distance to line (force drops as 1/r^2, normalize by 1/r)
+        // Soften by epsilon to avoid tight encounters to infinity
+        float rSqr = into.lenSqr();
 
-    if (rSqr < max_radiusSqr) m.vel += into * (magdt / (sqrtf(rSqr) * (rSqr + epsilon)));
+        if (rSqr < max_radiusSqr) m.vel += into * (magdt / (sqrtf(rSqr) * (rSqr + epsilon)));
+    }
+};
+
+PINLINE void PAOrbitLine_Impl(Particle_t& m, const float dt, const pVec p, const pVec axis, const float magnitude, const float epsilon, const float max_radius)
+{
+    PAOrbitLine_Prep(dt, p, axis, magnitude, epsilon, max_radius).Apply(m);
 }
 
 // Accelerate particles towards a point
-PINLINE void PAOrbitPoint_Impl(Particle_t& m, const float dt, const pVec center, const float magnitude, const float epsilon, const float max_radius)
-{
-    float magdt = magnitude * dt;
-    float max_radiusSqr = fsqr(max_radius);
-    // ^^^ Above values do not vary per particle.
+struct PAOrbitPoint_Prep {
+    pVec center;
+    float epsilon, magdt, max_radiusSqr;
 
-    // Figure direction from particle to center
-    pVec dir(center - m.pos);
+    PAOrbitPoint_Prep(const float dt, const pVec center_, const float magnitude, const float epsilon_, const float max_radius) :
+        center(center_), epsilon(epsilon_), magdt(magnitude * dt), max_radiusSqr(fsqr(max_radius))
+    {
+    }
 
-    // Distance to gravity well (force drops as 1/r^2, normalize by 1/r)
-    // Soften by epsilon to avoid tight encounters to infinity
-    float rSqr = dir.lenSqr();
+    PINLINE void Apply(Particle_t& m) const
+    {
+        // Figure direction from particle to center
+        pVec dir(center - m.pos);
+
+        // Distance to gravity well (force drops as 1/r^2, normalize by 1/r)
+        // Soften by epsilon to avoid tight encounters to infinity
+        float rSqr = dir.lenSqr();
+
+        if (rSqr < max_radiusSqr) m.vel += dir * (magdt / (sqrtf(rSqr) * (rSqr + epsilon)));
+    }
+};
 
-    if (rSqr < max_radiusSqr) m.vel += dir * (magdt / (sqrtf(rSqr) * (rSqr + epsilon)));
+PINLINE void PAOrbitPoint_Impl(Particle_t& m, const float dt, const pVec center, const float magnitude, const float epsilon, const float max_radius)
+{
+    PAOrbitPoint_Prep(dt, center, magnitude, epsilon, max_radius).Apply(m);
 }
 
 // Accelerate in random direction each time step
-PINLINE void PARandomAccel_Impl(Particle_t& m, const float dt, const pDomain& gen_acc)
+template <class D> PINLINE void PARandomAccel_Impl(Particle_t& m, const float dt, const D& gen_acc)
 {
     pVec accel = gen_acc.Generate();
 
@@ -646,7 +774,7 @@ PINLINE void PARandomAccel_Impl(Particle_t& m, const float dt, const pDomain& ge
 }
 
 // Immediately displace position randomly
-PINLINE void PARandomDisplace_Impl(Particle_t& m, const float dt, const pDomain& gen_disp)
+template <class D> PINLINE void PARandomDisplace_Impl(Particle_t& m, const float dt, const D& gen_disp)
 {
     pVec disp = gen_disp.Generate();
 
@@ -656,7 +784,7 @@ PINLINE void PARandomDisplace_Impl(Particle_t& m, const float dt, const pDomain&
 }
 
 // Immediately assign a random velocity
-PINLINE void PARandomVelocity_Impl(Particle_t& m, const float dt, const pDomain& gen_vel)
+template <class D> PINLINE void PARandomVelocity_Impl(Particle_t& m, const float dt, const D& gen_vel)
 {
     pVec velocity = gen_vel.Generate();
 
@@ -665,7 +793,7 @@ PINLINE void PARandomVelocity_Impl(Particle_t& m, const float dt, const pDomain&
 }
 
 // Immediately assign a random rotational velocity
-PINLINE void PARandomRotVelocity_Impl(Particle_t& m, const float dt, const pDomain& gen_vel)
+template <class D> PINLINE void PARandomRotVelocity_Impl(Particle_t& m, const float dt, const D& gen_vel)
 
 {
     pVec velocity = gen_vel.Generate();
@@ -706,116 +834,177 @@ PINLINE void PARestore_Impl(Particle_t& m, const float dt, const float time_left
     }
 }
 
+struct PARestore_Prep {
+    float dt, time_left;
+    bool restore_velocity, restore_rvelocity;
+
+    PARestore_Prep(const float dt_, const float time_left_, const bool restore_velocity_, const bool restore_rvelocity_) :
+        dt(dt_), time_left(time_left_), restore_velocity(restore_velocity_), restore_rvelocity(restore_rvelocity_)
+    {
+    }
+
+    PINLINE void Apply(Particle_t& m) const { PARestore_Impl(m, dt, time_left, restore_velocity, restore_rvelocity); }
+};
+
 // Clamp particle velocities to the given range
-PINLINE void PASpeedClamp_Impl(Particle_t& m, const float dt, const float min_speed, const float max_speed)
-{
-    float min_sqr = fsqr(min_speed);
-    float max_sqr = fsqr(max_speed);
-    // ^^^ Above values do not vary per particle.
+struct PASpeedClamp_Prep {
+    float min_speed, max_speed, min_sqr, max_sqr;
 
-    float sSqr = m.vel.lenSqr();
-    if (sSqr < min_sqr && sSqr) {
-        float s = sqrtf(sSqr);
-        m.vel *= (min_speed / s);
-    } else if (sSqr > max_sqr) {
-        float s = sqrtf(sSqr);
-        m.vel *= (max_speed / s);
+    PASpeedClamp_Prep(const float dt, const float min_speed_, const float max_speed_) :
+        min_speed(min_speed_), max_speed(max_speed_), min_sqr(fsqr(min_speed_)), max_sqr(fsqr(max_speed_))
+    {
     }
+
+    PINLINE void Apply(Particle_t& m) const
+    {
+        float sSqr = m.vel.lenSqr();
+        if (sSqr < min_sqr && sSqr) {
+            float s = sqrtf(sSqr);
+            m.vel *= (min_speed / s);
+        } else if (sSqr > max_sqr) {
+            float s = sqrtf(sSqr);
+            m.vel *= (max_speed / s);
+        }
+    }
+};
+
+PINLINE void PASpeedClamp_Impl(Particle_t& m, const float dt, const float min_speed, const float max_speed)
+{
+    PASpeedClamp_Prep(dt, min_speed, max_speed).Apply(m);
 }
 
 // Change color of all particles toward the specified color
+struct PATargetColor_Prep {
+    pVec color;
+    float alpha, scaleFac;
+
+    PATargetColor_Prep(const float dt, const pVec color_, const float alpha_, const float scale) : color(color_), alpha(alpha_), scaleFac(scale * dt) {}
+
+    PINLINE void Apply(Particle_t& m) const
+    {
+        m.color += (color - m.color) * scaleFac;
+        m.alpha += (alpha - m.alpha) * scaleFac;
+    }
+};
+
 PINLINE void PATargetColor_Impl(Particle_t& m, const float dt, const pVec color, const float alpha, const float scale)
 {
-    float scaleFac = scale * dt;
-    // ^^^ Above values do not vary per particle.
-
-    m.color += (color - m.color) * scaleFac;
-    m.alpha += (alpha - m.alpha) * scaleFac;
+    PATargetColor_Prep(dt, color, alpha, scale).Apply(m);
 }
 
 // Change sizes of all particles toward the specified size
-PINLINE void PATargetSize_Impl(Particle_t& m, const float dt, const pVec size, const pVec scale)
-{
-    pVec scaleFac = scale * dt;
-    // ^^^ Above values do not vary per particle.
+struct PATargetSize_Prep {
+    pVec size, scaleFac;
 
-    pVec dif = size - m.size;
-    m.size += CompMult(dif, scaleFac);
-}
+    PATargetSize_Prep(const float dt, const pVec size_, const pVec scale) : size(size_), scaleFac(scale * dt) {}
+
+    PINLINE void Apply(Particle_t& m) const
+    {
+        pVec dif = size - m.size;
+        m.size += CompMult(dif, scaleFac);
+    }
+};
+
+PINLINE void PATargetSize_Impl(Particle_t& m, const float dt, const pVec size, const pVec scale) { PATargetSize_Prep(dt, size, scale).Apply(m); }
 
 // Change velocity of all particles toward the specified velocity
+struct PATargetVelocity_Prep {
+    pVec velocity;
+    float scaleFac;
+
+    PATargetVelocity_Prep(const float dt, const pVec velocity_, const float scale) : velocity(velocity_), scaleFac(scale * dt) {}
+
+    PINLINE void Apply(Particle_t& m) const { m.vel += (velocity - m.vel) * scaleFac; }
+};
+
 PINLINE void PATargetVelocity_Impl(Particle_t& m, const float dt, const pVec velocity, const float scale)
 {
-    float scaleFac = scale * dt;
-    // ^^^ Above values do not vary per particle.
-
-    m.vel += (velocity - m.vel) * scaleFac;
+    PATargetVelocity_Prep(dt, velocity, scale).Apply(m);
 }
 
 // Change velocity of all particles toward the specified velocity
+struct PATargetRotVelocity_Prep {
+    pVec rot_velocity;
+    float scaleFac;
+
+    PATargetRotVelocity_Prep(const float dt, const pVec rot_velocity_, const float scale) : rot_velocity(rot_velocity_), scaleFac(scale * dt) {}
+
+    PINLINE void Apply(Particle_t& m) const { m.rvel += (rot_velocity - m.rvel) * scaleFac; }
+};
+
 PINLINE void PATargetRotVelocity_Impl(Particle_t& m, const float dt, const pVec rot_velocity, const float scale)
 {
-    float scaleFac = scale * dt;
-    // ^^^ Above values do not vary per particle.
-
-    m.rvel += (rot_velocity - m.rvel) * scaleFac;
+    PATargetRotVelocity_Prep(dt, rot_velocity, scale).Apply(m);
 }
 
 // This one just rotates a particle around the axis. Amount is based on radius, magnitude, and mass.
-PINLINE void PAVortex_Impl(Particle_t& m, const float dt, const pVec tip, const pVec axis, const float tightnessExponent, const float max_radius,
-                           const float inSpeed, const float upSpeed, float aroundSpeed)
-{
-    float max_radiusSqr = fsqr(max_radius);
-    float axisLength = axis.length();
-    float axisLengthInv = 1.0f / axisLength;
-    pVec axisN = axis;
-    axisN.normalize();
-    // ^^^ Above values do not vary per particle.
+struct PAVortex_Prep {
+    pVec tip, axisN;
+    float tightnessExponent, max_radius, inSpeed, upSpeed, aroundSpeed, dt, max_radiusSqr, axisLengthInv;
+
+    PAVortex_Prep(const float dt_, const pVec tip_, const pVec axis, const float tightnessExponent_, const float max_radius_, const float inSpeed_,
+                  const float upSpeed_, const float aroundSpeed_) :
+        tip(tip_), axisN(axis), tightnessExponent(tightnessExponent_), max_radius(max_radius_), inSpeed(inSpeed_), upSpeed(upSpeed_), aroundSpeed(aroundSpeed_),
+        dt(dt_), max_radiusSqr(fsqr(max_radius_))
+    {
+        float axisLength = axis.length();
+        axisLengthInv = 1.0f / axisLength;
+        axisN.normalize();
+    }
 
-    // Direction to particle from base of line.
-    pVec tipToPar = m.pos - tip;
+    PINLINE void Apply(Particle_t& m) const
+    {
+        // Direction to particle from base of line.
+        pVec tipToPar = m.pos - tip;
 
-    // Projection of particle onto line
-    float axisScale = dot(tipToPar, axisN);
-    pVec parOnAxis = axisN * axisScale;
+        // Projection of particle onto line
+        float axisScale = dot(tipToPar, axisN);
+        pVec parOnAxis = axisN * axisScale;
 
-    // Distance to axis
-    float alongAxis = axisScale * axisLengthInv;
+        // Distance to axis
+        float alongAxis = axisScale * axisLengthInv;
 
-    // How much to scale the vortex's force by as a function of how far up the axis the particle is.
-    float alongAxisPow = powf(alongAxis, tightnessExponent);
-    float silhouetteSqr = fsqr(alongAxisPow * max_radius);
+        // How much to scale the vortex's force by as a function of how far up the axis the particle is.
+        float alongAxisPow = powf(alongAxis, tightnessExponent);
+        float silhouetteSqr = fsqr(alongAxisPow * max_radius);
 
-    // Direction from particle to nearest point on line.
-    pVec parToAxis = parOnAxis - tipToPar;
-    float rSqr = parToAxis.lenSqr();
+        // Direction from particle to nearest point on line.
+        pVec parToAxis = parOnAxis - tipToPar;
+        float rSqr = parToAxis.lenSqr();
 
-    if (rSqr >= max_radiusSqr || axisScale < 0.0f || alongAxis > 1.0f) {
-        // m.color = pVec(0,0,1);
-        return;
-    }
+        if (rSqr >= max_radiusSqr || axisScale < 0.0f || alongAxis > 1.0f) {
+            // m.color = pVec(0,0,1);
+            return;
+        }
 
-    float r = sqrtf(rSqr);
-    parToAxis /= r;
-    float dtOverMass = dt / m.mass;
+        float r = sqrtf(rSqr);
+        parToAxis /= r;
+        float dtOverMass = dt / m.mass;
 
-    if (rSqr >= silhouetteSqr) {
-        // Accelerate toward axis. Force is NOT affected by 1/r^2.
-        pVec AccelIn = parToAxis * (inSpeed * dtOverMass);
-        m.vel += AccelIn;
-        // m.color = pVec(0,1,0);
-        return;
-    }
+        if (rSqr >= silhouetteSqr) {
+            // Accelerate toward axis. Force is NOT affected by 1/r^2.
+            pVec AccelIn = parToAxis * (inSpeed * dtOverMass);
+            m.vel += AccelIn;
+            // m.color = pVec(0,1,0);
+            return;
+        }
+
+        // Particles inside the cone have their velocity totally replaced right now. :(
+        // m.color = pVec(1,0,0);
+        // Accelerate up or down to simulate gravity or something
+        pVec AccelUp = axisN * (upSpeed * dtOverMass);
 
-    // Particles inside the cone have their velocity totally replaced right now. :(
-    // m.color = pVec(1,0,0);
-    // Accelerate up or down to simulate gravity or something
-    pVec AccelUp = axisN * (upSpeed * dtOverMass);
+        // Accelerate around axis by constructing orthogonal vector frame of axis, parToAxis, and RotDir.
+        pVec RotDir = Cross(axisN, parToAxis);
+        pVec AccelAround = RotDir * (aroundSpeed * dtOverMass);
+        m.vel = AccelUp + AccelAround; // NOT += because we want to stop its inward travel.
+    }
+};
 
-    // Accelerate around axis by constructing orthogonal vector frame of axis, parToAxis, and RotDir.
-    pVec RotDir = Cross(axisN, parToAxis);
-    pVec AccelAround = RotDir * (aroundSpeed * dtOverMass);
-    m.vel = AccelUp + AccelAround; // NOT += because we want to stop its inward travel.
+PINLINE void PAVortex_Impl(Particle_t& m, const float dt, const pVec tip, const pVec axis, const float tightnessExponent, const float max_radius,
+                           const float inSpeed, const float upSpeed, float aroundSpeed)
+{
+    PAVortex_Prep(dt, tip, axis, tightnessExponent, max_radius, inSpeed, upSpeed, aroundSpeed).Apply(m);
 }
 
 //////////////////////////////////////////////////////////////////
@@ -912,27 +1101,35 @@ PINLINE void PAMatchRotVelocity_Impl(Particle_t& m, const float dt, const float
 //////////////////////////////////////////////////////////////////
 // Other exceptional actions
 
-// These actions that kill particles actually just tag them for killing py setting m.tmp0 == P_MAXFLOAT.
-// Actual killing needs to happen outside the per-particle inline functions.
+// These actions that kill particles only return whether the particle should die.
+// The caller tags it in the group's kill bitmap, and actual killing happens when the group commits the kills.
 
 // Get rid of older particles
-PINLINE void PAKillOld_Impl(Particle_t& m, const float dt, const float age_limit, const bool kill_less_than)
+PINLINE bool PAKillOld_Impl(const Particle_t& m, const float dt, const float age_limit, const bool kill_less_than)
 {
-    // TODO: Not sure whether this straight-line code is more efficient than branching and only writing when killing.
-    m.tmp0 = ((m.age < age_limit) ^ kill_less_than) ? m.tmp0 : P_MAXFLOAT;
+    return !((m.age < age_limit) ^ kill_less_than);
 }
 
+// This one returns whether to kill the particle instead of applying anything to it
+struct PAKillOld_Prep {
+    float dt, age_limit;
+    bool kill_less_than;
+
+    PAKillOld_Prep(const float dt_, const float age_limit_, const bool kill_less_than_) : dt(dt_), age_limit(age_limit_), kill_less_than(kill_less_than_) {}
+
+    PINLINE bool Kills(const Particle_t& m) const { return PAKillOld_Impl(m, dt, age_limit, kill_less_than); }
+};
+
 // Kill particles with positions on wrong side of the specified domain
-PINLINE void PASink_Impl(Particle_t& m, const float dt, const bool kill_inside, const pDomain& kill_pos_dom)
+template <class D> PINLINE bool PASink_Impl(const Particle_t& m, const float dt, const bool kill_inside, const D& kill_pos_dom)
 {
-    m.tmp0 = (kill_pos_dom.Within(m.pos) ^ kill_inside) ? m.tmp0 : P_MAXFLOAT;
+    return !(kill_pos_dom.Within(m.pos) ^ kill_inside);
 }
 
 // Kill particles with velocities on wrong side of the specified domain
-// PINLINE void PASinkVelocity_Impl(Particle_t& m, const float dt, const bool kill_inside, const pDomain& kill_vel_dom)
-PINLINE void PASinkVelocity_Impl(Particle_t& m, const float dt, const bool kill_inside, const pDomain& kill_vel_dom)
+template <class D> PINLINE bool PASinkVelocity_Impl(const Particle_t& m, const float dt, const bool kill_inside, const D& kill_vel_dom)
 {
-    m.tmp0 = (kill_vel_dom.Within(m.vel) ^ kill_inside) ? m.tmp0 : P_MAXFLOAT;
+    return !(kill_vel_dom.Within(m.vel) ^ kill_inside);
 }
 
 // Project the particle onto the Look vector to get sort key and store it in tmp0
@@ -942,7 +1139,7 @@ PINLINE void PASort_Impl(Particle_t& m, const float dt, const pVec Eye, const pV
     // ^^^ Above values do not vary per particle.
 
     pVec toP = m.pos - Eye;
-    float sortKey = m.tmp0 == P_MAXFLOAT ? P_MAXFLOAT : (dot(toP, Look) * scale); // Don't rescue particles slated for killing
+    float sortKey = dot(toP, Look) * scale;
     m.tmp0 = (clamp_negative && sortKey < 0.f) ? 0.f : sortKey;
 }
 
@@ -977,4 +1174,143 @@ PINLINE void PASource_Impl(Particle_t& m, const float dt, const pDomain& gen_pos
     m.data = SrcSt.Data_;
 }
 
+//////////////////////////////////////////////////////////////////
+// Block kernels
+
+// These apply an action to all P_BLOCK_WIDTH lanes of a ParticleBlock_t of a P_LAYOUT_AOSOA group, including any unused lanes
+// at the end of the last block. Each lane's attributes that the action reads (R) are copied to a Particle_t, the per-particle
+// function above is applied, and the attributes it writes (W) are copied back. The Particle_t lives in registers, so the compiler
+// vectorizes the lane loop across the block with no gather or scatter. Runtime flags of the action select the masks outside the loop.
+template <unsigned int R, unsigned int W, class F> PINLINE void PBlockLoop(ParticleBlock_t& b, F f)
+{
+    for (int l = 0; l < P_BLOCK_WIDTH; l++) {
+        Particle_t m;
+        b.GetLane<R>(l, m);
+        f(m);
+        b.SetLane<W>(l, m);
+    }
+}
+
+PINLINE void PACopyVertexB_Block(ParticleBlock_t& b, const float dt, const bool copy_pos, const bool copy_vel)
+{
+    if (copy_pos && copy_vel)
+        PBlockLoop<PA_POS | PA_UP | PA_VEL, PA_POSB | PA_UPB | PA_VELB>(b, [&](Particle_t& m) { PACopyVertexB_Impl(m, dt, true, true); });
+    else if (copy_pos)
+        PBlockLoop<PA_POS | PA_UP, PA_POSB | PA_UPB>(b, [&](Particle_t& m) { PACopyVertexB_Impl(m, dt, true, false); });
+    else if (copy_vel)
+        PBlockLoop<PA_VEL, PA_VELB>(b, [&](Particle_t& m) { PACopyVertexB_Impl(m, dt, false, true); });
+}
+
+PINLINE void PADamping_Block(ParticleBlock_t& b, const float dt, const pVec damping, const float min_vel, const float max_vel)
+{
+    const PADamping_Prep prep(dt, damping, min_vel, max_vel);
+    PBlockLoop<PA_VEL, PA_VEL>(b, [&](Particle_t& m) { prep.Apply(m); });
+}
+
+PINLINE void PARotDamping_Block(ParticleBlock_t& b, const float dt, const pVec damping, const float min_vel, const float max_vel)
+{
+    const PARotDamping_Prep prep(dt, damping, min_vel, max_vel);
+    PBlockLoop<PA_RVEL, PA_RVEL>(b, [&](Particle_t& m) { prep.Apply(m); });
+}
+
+PINLINE void PAExplosion_Block(ParticleBlock_t& b, const float dt, const pVec center, const float radius, const float magnitude, const float stdev,
+                               const float epsilon)
+{
+    const PAExplosion_Prep prep(dt, center, radius, magnitude, stdev, epsilon);
+    PBlockLoop<PA_POS | PA_VEL, PA_VEL>(b, [&](Particle_t& m) { prep.Apply(m); });
+}
+
+PINLINE void PAGravity_Block(ParticleBlock_t& b, const float dt, const pVec direction)
+{
+    const PAGravity_Prep prep(dt, direction);
+    PBlockLoop<PA_VEL, PA_VEL>(b, [&](Particle_t& m) { prep.Apply(m); });
+}
+
+PINLINE void PAMove_Block(ParticleBlock_t& b, const float dt, const bool move_velocity, const bool move_rotational_velocity)
+{
+    if (move_velocity && move_rotational_velocity)
+        PBlockLoop<PA_AGE | PA_POS | PA_VEL | PA_UP | PA_RVEL, PA_AGE | PA_POS | PA_UP>(b, [&](Particle_t& m) { PAMove_Impl(m, dt, true, true); });
+    else if (move_velocity)
+        PBlockLoop<PA_AGE | PA_POS | PA_VEL, PA_AGE | PA_POS>(b, [&](Particle_t& m) { PAMove_Impl(m, dt, true, false); });
+    else if (move_rotational_velocity)
+        PBlockLoop<PA_AGE | PA_UP | PA_RVEL, PA_AGE | PA_UP>(b, [&](Particle_t& m) { PAMove_Impl(m, dt, false, true); });
+    else
+        PBlockLoop<PA_AGE, PA_AGE>(b, [&](Particle_t& m) { PAMove_Impl(m, dt, false, false); });
+}
+
+PINLINE void PAOrbitLine_Block(ParticleBlock_t& b, const float dt, const pVec p, const pVec axis, const float magnitude, const float epsilon,
+                               const float max_radius)
+{
+    const PAOrbitLine_Prep prep(dt, p, axis, magnitude, epsilon, max_radius);
+    PBlockLoop<PA_POS | PA_VEL, PA_VEL>(b, [&](Particle_t& m) { prep.Apply(m); });
+}
+
+PINLINE void PAOrbitPoint_Block(ParticleBlock_t& b, const float dt, const pVec center, const float magnitude, const float epsilon, const float max_radius)
+{
+    const PAOrbitPoint_Prep prep(dt, center, magnitude, epsilon, max_radius);
+    PBlockLoop<PA_POS | PA_VEL, PA_VEL>(b, [&](Particle_t& m) { prep.Apply(m); });
+}
+
+PINLINE void PARestore_Block(ParticleBlock_t& b, const float dt, const float time_left, const bool restore_velocity, const bool restore_rvelocity)
+{
+    const unsigned int RV = PA_POS | PA_POSB | PA_VEL, RR = PA_UP | PA_UPB | PA_RVEL;
+    if (restore_velocity && restore_rvelocity)
+        PBlockLoop<RV | RR, PA_POS | PA_VEL | PA_UP | PA_RVEL>(b, [&](Particle_t& m) { PARestore_Impl(m, dt, time_left, true, true); });
+    else if (restore_velocity)
+        PBlockLoop<RV, PA_POS | PA_VEL>(b, [&](Particle_t& m) { PARestore_Impl(m, dt, time_left, true, false); });
+    else if (restore_rvelocity)
+        PBlockLoop<RR, PA_UP | PA_RVEL>(b, [&](Particle_t& m) { PARestore_Impl(m, dt, time_left, false, true); });
+}
+
+PINLINE void PASpeedClamp_Block(ParticleBlock_t& b, const float dt, const float min_speed, const float max_speed)
+{
+    const PASpeedClamp_Prep prep(dt, min_speed, max_speed);
+    PBlockLoop<PA_VEL, PA_VEL>(b, [&](Particle_t& m) { prep.Apply(m); });
+}
+
+PINLINE void PATargetColor_Block(ParticleBlock_t& b, const float dt, const pVec color, const float alpha, const float scale)
+{
+    const PATargetColor_Prep prep(dt, color, alpha, scale);
+    PBlockLoop<PA_COLOR | PA_ALPHA, PA_COLOR | PA_ALPHA>(b, [&](Particle_t& m) { prep.Apply(m); });
+}
+
+PINLINE void PATargetSize_Block(ParticleBlock_t& b, const float dt, const pVec size, const pVec scale)
+{
+    const PATargetSize_Prep prep(dt, size, scale);
+    PBlockLoop<PA_SIZE, PA_SIZE>(b, [&](Particle_t& m) { prep.Apply(m); });
+}
+
+PINLINE void PATargetVelocity_Block(ParticleBlock_t& b, const float dt, const pVec velocity, const float scale)
+{
+    const PATargetVelocity_Prep prep(dt, velocity, scale);
+    PBlockLoop<PA_VEL, PA_VEL>(b, [&](Particle_t& m) { prep.Apply(m); });
+}
+
+PINLINE void PATargetRotVelocity_Block(ParticleBlock_t& b, const float dt, const pVec rot_velocity, const float scale)
+{
+    const PATargetRotVelocity_Prep prep(dt, rot_velocity, scale);
+    PBlockLoop<PA_RVEL, PA_RVEL>(b, [&](Particle_t& m) { prep.Apply(m); });
+}
+
+PINLINE void PAVortex_Block(ParticleBlock_t& b, const float dt, const pVec tip, const pVec axis, const float tightnessExponent, const float max_radius,
+                            const float inSpeed, const float upSpeed, float aroundSpeed)
+{
+    const PAVortex_Prep prep(dt, tip, axis, tightnessExponent, max_radius, inSpeed, upSpeed, aroundSpeed);
+    PBlockLoop<PA_POS | PA_VEL | PA_MASS, PA_VEL>(b, [&](Particle_t& m) { prep.Apply(m); });
+}
+
+// Returns the mask of lanes to kill
+PINLINE uint64_t PAKillOld_Block(const ParticleBlock_t& b, const float dt, const float age_limit, const bool kill_less_than)
+{
+    uint64_t mask = 0;
+    for (int l = 0; l < P_BLOCK_WIDTH; l++) {
+        Particle_t m;
+        b.GetLane<PA_AGE>(l, m);
+        mask |= uint64_t(PAKillOld_Impl(m, dt, age_limit, kill_less_than)) << l;
+    }
+    return mask;
+}
+
+}; // namespace PAPI
+
 #endif
@@ -21,6 +21,24 @@ const float P_MAXFLOAT = 1.0e16f; // Actually this must be < sqrt(MAXFLOAT) sinc
 /// A very small float value added to some physical calculations to dampen them and improve stability
 const float P_EPS = 1e-3f;
 
+/// The memory layout of the particles of a particle group. See GenParticleGroups().
+enum pGroupLayout_E {
+    P_LAYOUT_AOS,     ///< An array of Particle_t structs. This is the default and is the only layout that supports GetParticlePointer().
+    P_LAYOUT_SOA,     ///< A separate array for each particle attribute, so actions only stream the attributes they touch
+    P_LAYOUT_AOSOA,   ///< Blocks of P_BLOCK_WIDTH particles with each attribute contiguous within the block, for vectorized action kernels
+    P_LAYOUT_HOTCOLD, ///< One array of the attributes most actions touch and a parallel array of orientation, vertexB, and user data
+    P_LAYOUT_PACKED,  ///< An array of records holding only the attributes the application uses. See GenParticleGroups().
+    P_LAYOUT_MAPPED   ///< An array of Particle_t in a memory-mapped file, for groups larger than RAM. See MapGroupToFile().
+};
+
+/// How the memory of a particle group is allocated. These flags can be combined. See GenParticleGroups().
+enum pGroupMemory_E : unsigned int {
+    P_MEM_DEFAULT = 0,    ///< Cache-line-aligned memory from the heap
+    P_MEM_HUGE_PAGES = 1, ///< Ask the OS to back large groups with transparent huge pages to save TLB misses. Only on Linux.
+    P_MEM_HUGETLB = 2,    ///< Take large groups from the reserved huge page pool, or fall back to P_MEM_HUGE_PAGES. Only on Linux.
+    P_MEM_PREFAULT = 4    ///< Touch all the memory of the group when it is allocated so the first sweeps don't take page faults
+};
+
 /// This is the type of the particle birth and death callback functions that you can register.
 typedef void (*P_PARTICLE_CALLBACK)(struct Particle_t& particle, const pdata_t data);
 
@@ -11,13 +11,34 @@
 #include "Particle/pError.h"
 #include "Particle/pVec.h"
 
+#include <algorithm>
 #include <string>
 #include <vector>
 
+#ifdef _DEBUG
+#include <atomic>
+#include <cstdio>
+#endif
+
 namespace PAPI {
 ///< How small the dot product must be to declare that a point is in a plane for Within().
 #define P_PLANAR_EPSILON 1e-3f
 
+#ifdef _DEBUG
+/// Nonzero while this thread runs the body of a ParticleLoop. A domain constructed there is constructed again for every particle, so debug
+/// builds warn about it.
+inline thread_local int pParticleLoopDepth = 0;
+
+/// True once a domain has been constructed inside a ParticleLoop and the warning printed. It is only printed once per process.
+inline std::atomic<bool> pDomainInLoopWarned{false};
+
+/// Marks this thread as running the body of a ParticleLoop until the end of the scope
+struct pParticleLoopScope {
+    pParticleLoopScope() { pParticleLoopDepth++; }
+    ~pParticleLoopScope() { pParticleLoopDepth--; }
+};
+#endif
+
 /// Enums for the different types of domains that can be stored in a pDomain
 enum pDomainType_E {
     PDUnion_e,
@@ -50,16 +71,48 @@ enum pDomainType_E {
 ///
 /// The second basic operation is Within, which tells whether a given point is within the domain.
 ///
+/// Both also come in batches, GenerateN and WithinN, which the actions call once per run of particles. Each domain overrides them with a
+/// loop that inlines its own Generate or Within math and draws its random numbers with pRandBatch_t::Rand4, so the loop vectorizes.
+///
 /// The application programmer never calls the Generate or Within functions. The application will use the pDomain struct and its derivatives solely
 /// as a way to communicate the domain to the API. The API's action commands will then perform operations on the domain, such as generating particles within it.
 class pDomain {
 public:
 #define P_N_FLOATS_IN_DOMAIN 30
     pDomainType_E Which;
+
+#ifdef _DEBUG
+    // This only warns, since it is legal and the loop may be running on the scheduler's threads, where throwing would end the process
+    pDomain()
+    {
+        if (pParticleLoopDepth && !pDomainInLoopWarned.exchange(true))
+            fprintf(stderr, "Particle API: Construct domains before ParticleLoop and capture them, not once per particle inside it\n");
+    }
+#endif
     virtual bool Within(const pVec&) const = 0; ///< Returns true if the given point is within the domain.
     virtual pVec Generate() const = 0;          ///< Returns a random point in the domain.
     virtual float Size() const = 0;             ///< Returns the size of the domain (length, area, or volume).
 
+    /// Writes a random point in the domain to each of pos[0 .. n), drawing point i from stream i of R.
+    virtual void GenerateN(pVec* pos, const size_t n, const pRandBatch_t& R) const
+    {
+        for (size_t i = 0; i < n; i++) {
+            pRandStream_t S = R.Stream(i);
+            pRandStreamScope scope(S);
+            pos[i] = Generate();
+        }
+    }
+
+    /// Sets within[i] to whether pos[i] is within the domain, for each i in [0 .. n). Domains whose Within is random draw from stream i of R.
+    virtual void WithinN(const pVec* pos, const size_t n, bool* within, const pRandBatch_t& R) const
+    {
+        for (size_t i = 0; i < n; i++) {
+            pRandStream_t S = R.Stream(i);
+            pRandStreamScope scope(S);
+            within[i] = Within(pos[i]);
+        }
+    }
+
     virtual std::shared_ptr<pDomain> copy() const = 0; // Returns a pointer to a heap-allocated copy of the derived class
 };
 
@@ -90,7 +143,7 @@ PINLINE void NewBasis(const pVec& u, const pVec& v, pVec& s1, pVec& s2)
 /// Thus, to properly distribute probability of Generate() choosing each domain, it is wise to only combine domains that have the same
 /// dimensionality. Note that thin shelled cylinders, cones, and spheres, where InnerRadius==OuterRadius, are considered 2D, not 3D.
 /// Thin shelled discs (circles) are considered 1D. Points are 0D.
-struct PDUnion : public pDomain {
+struct PDUnion final : public pDomain {
     std::vector<std::shared_ptr<pDomain>> Doms;
     float TotalSize;
 
@@ -173,7 +226,7 @@ struct PDUnion : public pDomain {
 /// A single point.
 ///
 /// Generate always returns this point. Within returns true if the point is exactly equal.
-struct PDPoint : public pDomain {
+struct PDPoint final : public pDomain {
     pVec p;
 
     PINLINE PDPoint(const pVec& p0)
@@ -194,6 +247,16 @@ struct PDPoint : public pDomain {
         return p;
     }
 
+    void GenerateN(pVec* pos, const size_t n, const pRandBatch_t& R) const
+    {
+        for (size_t i = 0; i < n; i++) pos[i] = p;
+    }
+
+    void WithinN(const pVec* pos, const size_t n, bool* within, const pRandBatch_t& R) const
+    {
+        for (size_t i = 0; i < n; i++) within[i] = PDPoint::Within(pos[i]);
+    }
+
     PINLINE float Size() const { return 1.0f; }
 
     std::shared_ptr<pDomain> copy() const { return std::shared_ptr<pDomain>(new PDPoint(*this)); }
@@ -204,7 +267,7 @@ struct PDPoint : public pDomain {
 /// e0 and e1 are the endpoints of the segment.
 ///
 /// Generate returns a random point on this segment. Within returns true for points within epsilon of the line segment.
-struct PDLine : public pDomain {
+struct PDLine final : public pDomain {
     pVec p0, p1, vec, vecNrm;
     float len;
 
@@ -237,6 +300,20 @@ struct PDLine : public pDomain {
         return p0 + vec * pRandf();
     }
 
+    void GenerateN(pVec* pos, const size_t n, const pRandBatch_t& R) const
+    {
+        for (size_t i = 0; i < n; i++) {
+            float r[4];
+            R.Rand4(i, 0, r);
+            pos[i] = p0 + vec * r[0];
+        }
+    }
+
+    void WithinN(const pVec* pos, const size_t n, bool* within, const pRandBatch_t& R) const
+    {
+        for (size_t i = 0; i < n; i++) within[i] = PDLine::Within(pos[i]);
+    }
+
     PINLINE float Size() const { return len; }
 
     std::shared_ptr<pDomain> copy() const { return std::shared_ptr<pDomain>(new PDLine(*this)); }
@@ -249,7 +326,7 @@ struct PDLine : public pDomain {
 ///
 /// Generate returns a random point in the triangle. Within returns true for points within epsilon of the triangle. Currently it is not
 /// possible to sink particles that enter/exit a polygonal model. Suggestions?
-struct PDTriangle : public pDomain {
+struct PDTriangle final : public pDomain {
     pVec p, u, v, uNrm, vNrm, nrm, s1, s2;
     float uLen, vLen, D, area;
 
@@ -312,6 +389,22 @@ struct PDTriangle : public pDomain {
         return pos;
     }
 
+    void GenerateN(pVec* pos, const size_t n, const pRandBatch_t& R) const
+    {
+        for (size_t i = 0; i < n; i++) {
+            float r[4];
+            R.Rand4(i, 0, r);
+            bool fold = r[0] + r[1] >= 1.0f; // Reflect points in the other half of the parallelogram back into the triangle
+            float r1 = fold ? 1.0f - r[0] : r[0], r2 = fold ? 1.0f - r[1] : r[1];
+            pos[i] = p + u * r1 + v * r2;
+        }
+    }
+
+    void WithinN(const pVec* pos, const size_t n, bool* within, const pRandBatch_t& R) const
+    {
+        for (size_t i = 0; i < n; i++) within[i] = PDTriangle::Within(pos[i]);
+    }
+
     PINLINE float Size() const { return area; }
 
     std::shared_ptr<pDomain> copy() const { return std::shared_ptr<pDomain>(new PDTriangle(*this)); }
@@ -322,7 +415,7 @@ struct PDTriangle : public pDomain {
 /// p0 is a point on the plane. u0 and v0 are (non-parallel) basis vectors in the plane. They don't need to be normal or orthogonal.
 ///
 /// Generate returns a random point in the diamond-shaped patch whose corners are o, o+u, o+u+v, and o+v. Within returns true for points within epsilon of the patch.
-struct PDRectangle : public pDomain {
+struct PDRectangle final : public pDomain {
     pVec p, u, v, uNrm, vNrm, nrm, s1, s2;
     float uLen, vLen, D, area;
 
@@ -378,6 +471,20 @@ struct PDRectangle : public pDomain {
         return pos;
     }
 
+    void GenerateN(pVec* pos, const size_t n, const pRandBatch_t& R) const
+    {
+        for (size_t i = 0; i < n; i++) {
+            float r[4];
+            R.Rand4(i, 0, r);
+            pos[i] = p + u * r[0] + v * r[1];
+        }
+    }
+
+    void WithinN(const pVec* pos, const size_t n, bool* within, const pRandBatch_t& R) const
+    {
+        for (size_t i = 0; i < n; i++) within[i] = PDRectangle::Within(pos[i]);
+    }
+
     PINLINE float Size() const { return area; }
 
     std::shared_ptr<pDomain> copy() const { return std::shared_ptr<pDomain>(new PDRectangle(*this)); }
@@ -389,7 +496,7 @@ struct PDRectangle : public pDomain {
 /// the domain is a flat washer, rather than a disc. The normal will get normalized, so it need not already be unit length.
 ///
 /// Generate returns a point inside the disc shell. Within returns true for points within epsilon of the disc.
-struct PDDisc : public pDomain {
+struct PDDisc final : public pDomain {
     pVec p, nrm, u, v;
     float radIn, radOut, radInSqr, radOutSqr, dif, D, area;
 
@@ -461,6 +568,22 @@ struct PDDisc : public pDomain {
         return pos;
     }
 
+    void GenerateN(pVec* pos, const size_t n, const pRandBatch_t& R) const
+    {
+        for (size_t i = 0; i < n; i++) {
+            float r[4];
+            R.Rand4(i, 0, r);
+            float theta = r[0] * 2.0f * float(M_PI);
+            float rad = radIn + r[1] * dif;
+            pos[i] = p + u * (rad * cosf(theta)) + v * (rad * sinf(theta));
+        }
+    }
+
+    void WithinN(const pVec* pos, const size_t n, bool* within, const pRandBatch_t& R) const
+    {
+        for (size_t i = 0; i < n; i++) within[i] = PDDisc::Within(pos[i]);
+    }
+
     PINLINE float Size() const
     {
         return 1.0f; // A plane is infinite, so what sensible thing can I return?
@@ -475,7 +598,7 @@ struct PDDisc : public pDomain {
 /// n = [a,b,c] and you can compute a suitable point p0 as p0 = -n*d. The normal will get normalized, so it need not already be unit length.
 ///
 /// Generate returns the point p0. Within returns true if the point is in the positive half-space of the plane (in the plane or on the side that Normal points to).
-struct PDPlane : public pDomain {
+struct PDPlane final : public pDomain {
     pVec p, nrm;
     float D;
 
@@ -507,6 +630,16 @@ struct PDPlane : public pDomain {
         return p;
     }
 
+    void GenerateN(pVec* pos, const size_t n, const pRandBatch_t& R) const
+    {
+        for (size_t i = 0; i < n; i++) pos[i] = p;
+    }
+
+    void WithinN(const pVec* pos, const size_t n, bool* within, const pRandBatch_t& R) const
+    {
+        for (size_t i = 0; i < n; i++) within[i] = PDPlane::Within(pos[i]);
+    }
+
     PINLINE float Size() const
     {
         return 1.0f; // A plane is infinite, so what sensible thing can I return?
@@ -520,7 +653,7 @@ struct PDPlane : public pDomain {
 /// e0 and e1 are opposite corners of an axis-aligned box. It doesn't matter which of each coordinate is min and which is max.
 ///
 /// Generate returns a random point in this box. Within returns true if the point is in the box.
-struct PDBox : public pDomain {
+struct PDBox final : public pDomain {
     // P0 is the min corner. p1 is the max corner.
     pVec p0, p1, dif;
     float vol;
@@ -563,6 +696,20 @@ struct PDBox : public pDomain {
         return p0 + CompMult(pRandVec(), dif);
     }
 
+    void GenerateN(pVec* pos, const size_t n, const pRandBatch_t& R) const
+    {
+        for (size_t i = 0; i < n; i++) {
+            float r[4];
+            R.Rand4(i, 0, r);
+            pos[i] = p0 + CompMult(pVec(r[0], r[1], r[2]), dif);
+        }
+    }
+
+    void WithinN(const pVec* pos, const size_t n, bool* within, const pRandBatch_t& R) const
+    {
+        for (size_t i = 0; i < n; i++) within[i] = PDBox::Within(pos[i]);
+    }
+
     PINLINE float Size() const { return vol; }
 
     std::shared_ptr<pDomain> copy() const { return std::shared_ptr<pDomain>(new PDBox(*this)); }
@@ -574,7 +721,7 @@ struct PDBox : public pDomain {
 /// radius for a cylindrical shell. InnerRadius = 0 for a solid cylinder with no empty space in the middle.
 ///
 /// Generate returns a random point in the cylindrical shell. Within returns true if the point is within the cylindrical shell.
-struct PDCylinder : public pDomain {
+struct PDCylinder final : public pDomain {
     pVec apex, axis, u, v; // Apex is one end. Axis is vector from one end to the other.
     float radIn, radOut, radInSqr, radOutSqr, radDif, axisLenInvSqr, vol;
     bool ThinShell;
@@ -670,6 +817,22 @@ struct PDCylinder : public pDomain {
         return pos;
     }
 
+    void GenerateN(pVec* pos, const size_t n, const pRandBatch_t& R) const
+    {
+        for (size_t i = 0; i < n; i++) {
+            float r[4];
+            R.Rand4(i, 0, r);
+            float theta = r[1] * 2.0f * float(M_PI);
+            float rad = radIn + r[2] * radDif;
+            pos[i] = apex + axis * r[0] + u * (rad * cosf(theta)) + v * (rad * sinf(theta));
+        }
+    }
+
+    void WithinN(const pVec* pos, const size_t n, bool* within, const pRandBatch_t& R) const
+    {
+        for (size_t i = 0; i < n; i++) within[i] = PDCylinder::Within(pos[i]);
+    }
+
     PINLINE float Size() const /// Returns the thick cylindrical shell volume or the thin cylindrical shell area if OuterRadius==InnerRadius.
     {
         return vol;
@@ -687,7 +850,7 @@ struct PDCylinder : public pDomain {
 /// no empty space in the middle.
 ///
 /// Generate returns a random point in the conical shell. Within returns true if the point is within the conical shell.
-struct PDCone : public pDomain {
+struct PDCone final : public pDomain {
     pVec apex, axis, u, v; // Apex is one end. Axis is vector from one end to the other.
     float radIn, radOut, radInSqr, radOutSqr, radDif, axisLenInvSqr, vol;
     bool ThinShell;
@@ -791,6 +954,22 @@ struct PDCone : public pDomain {
         return pos;
     }
 
+    void GenerateN(pVec* pos, const size_t n, const pRandBatch_t& R) const
+    {
+        for (size_t i = 0; i < n; i++) {
+            float r[4];
+            R.Rand4(i, 0, r);
+            float theta = r[1] * 2.0f * float(M_PI);
+            float rad = (radIn + r[2] * radDif) * r[0]; // Scale radius along axis for cones
+            pos[i] = apex + axis * r[0] + u * (rad * cosf(theta)) + v * (rad * sinf(theta));
+        }
+    }
+
+    void WithinN(const pVec* pos, const size_t n, bool* within, const pRandBatch_t& R) const
+    {
+        for (size_t i = 0; i < n; i++) within[i] = PDCone::Within(pos[i]);
+    }
+
     PINLINE float Size() const /// Returns the thick conical shell volume or the thin conical shell area if OuterRadius==InnerRadius.
     {
         return vol;
@@ -805,7 +984,7 @@ struct PDCone : public pDomain {
 ///
 /// Generate returns a random point in the thick shell at a distance between OuterRadius and InnerRadius from point Center. If InnerRadius
 /// is 0, then it is the whole sphere. Within returns true if the point lies within the thick shell at a distance between InnerRadius to OuterRadius from point Center.
-struct PDSphere : public pDomain {
+struct PDSphere final : public pDomain {
     pVec ctr;
     float radIn, radOut, radInSqr, radOutSqr, radDif, vol;
     bool ThinShell;
@@ -870,6 +1049,25 @@ struct PDSphere : public pDomain {
         return pos;
     }
 
+    /// Unlike Generate, this makes the direction from two uniform numbers instead of by rejection, so every point takes one block of its stream.
+    void GenerateN(pVec* pos, const size_t n, const pRandBatch_t& R) const
+    {
+        for (size_t i = 0; i < n; i++) {
+            float r[4];
+            R.Rand4(i, 0, r);
+            float z = r[0] * 2.0f - 1.0f; // Uniform z on the unit sphere makes uniform area
+            float phi = r[1] * 2.0f * float(M_PI);
+            float s = sqrtf(std::max(0.0f, 1.0f - z * z));
+            float rad = ThinShell ? radOut : radIn + r[2] * radDif;
+            pos[i] = ctr + pVec(s * cosf(phi), s * sinf(phi), z) * rad;
+        }
+    }
+
+    void WithinN(const pVec* pos, const size_t n, bool* within, const pRandBatch_t& R) const
+    {
+        for (size_t i = 0; i < n; i++) within[i] = PDSphere::Within(pos[i]);
+    }
+
     PINLINE float Size() const /// Returns the thick spherical shell volume or the thin spherical shell area if OuterRadius==InnerRadius.
     {
         return vol;
@@ -884,7 +1082,7 @@ struct PDSphere : public pDomain {
 /// The blob domain allows for some very natural-looking effects because there is no sharp, artificial-looking boundary at the edge of the domain.
 ///
 /// Generate returns a point with normal probability density. Within has a probability of returning true equal to the probability density at the specified point.
-struct PDBlob : public pDomain {
+struct PDBlob final : public pDomain {
     pVec ctr;
     float stdev, Scale1, Scale2;
 
@@ -915,6 +1113,22 @@ struct PDBlob : public pDomain {
         return ctr + pNRandVec(stdev);
     }
 
+    void GenerateN(pVec* pos, const size_t n, const pRandBatch_t& R) const
+    {
+        pNRandVecN(pos, n, R, stdev);
+        for (size_t i = 0; i < n; i++) pos[i] += ctr;
+    }
+
+    void WithinN(const pVec* pos, const size_t n, bool* within, const pRandBatch_t& R) const
+    {
+        for (size_t i = 0; i < n; i++) {
+            float r[4];
+            R.Rand4(i, 0, r);
+            pVec x = pos[i] - ctr;
+            within[i] = r[0] < expf(x.lenSqr() * Scale1) * Scale2;
+        }
+    }
+
     PINLINE float Size() const /// Returns the probability density integral, which is 1.0.
     {
         return 1.0f;
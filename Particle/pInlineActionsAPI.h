@@ -7,15 +7,18 @@
 /// It is a header file so that the action implementations are inlined.
 /// The intended usage is as follows:
 ///
+/// PDDisc Floor(pVec(0, 0, 1.f), pVec(0, 0, 1.f), 5);
 /// P.ParticleLoop(std::execution::par_unseq, [&](Particle_t& m) {
-///     P.I.Gravity(Efx.GravityVec);
-///     P.I.Bounce(0.f, 0.5f, 0.f, PDDisc(pVec(0, 0, 1.f), pVec(0, 0, 1.f), 5));
-///     P.I.Move(true, false);
+///     P.Gravity(m, Efx.GravityVec);
+///     P.Bounce(m, 0.f, 0.5f, 0.f, Floor);
+///     P.Move(m, true, false);
 /// });
 
 #include "Particle/pAPI.h"
 #include "Particle/pActionImpls.h"
 
+#include <type_traits>
+
 namespace PAPI {
 
 #ifdef _DEBUG
@@ -86,6 +89,7 @@ PINLINE void PContextActions_t::Gravity(Particle_t& m, const pVec& dir)
 PINLINE void PContextActions_t::Jet(Particle_t& m, const pDomain& dom, const pDomain& accel)
 {
     P_CHECK_ERR;
+    pRandStreamScope scope(PSh.rand_stream(&m - PSh.get_pgroup_begin()));
     PAJet_Impl(m, PSh.get_dt(), dom, accel);
 }
 
@@ -110,24 +114,28 @@ PINLINE void PContextActions_t::OrbitPoint(Particle_t& m, const pVec& center, co
 PINLINE void PContextActions_t::RandomAccel(Particle_t& m, const pDomain& gen_acc)
 {
     P_CHECK_ERR;
+    pRandStreamScope scope(PSh.rand_stream(&m - PSh.get_pgroup_begin()));
     PARandomAccel_Impl(m, PSh.get_dt(), gen_acc);
 }
 
 PINLINE void PContextActions_t::RandomDisplace(Particle_t& m, const pDomain& gen_disp)
 {
     P_CHECK_ERR;
+    pRandStreamScope scope(PSh.rand_stream(&m - PSh.get_pgroup_begin()));
     PARandomDisplace_Impl(m, PSh.get_dt(), gen_disp);
 }
 
 PINLINE void PContextActions_t::RandomVelocity(Particle_t& m, const pDomain& gen_vel)
 {
     P_CHECK_ERR;
+    pRandStreamScope scope(PSh.rand_stream(&m - PSh.get_pgroup_begin()));
     PARandomVelocity_Impl(m, PSh.get_dt(), gen_vel);
 }
 
 PINLINE void PContextActions_t::RandomRotVelocity(Particle_t& m, const pDomain& gen_vel)
 {
     P_CHECK_ERR;
+    pRandStreamScope scope(PSh.rand_stream(&m - PSh.get_pgroup_begin()));
     PARandomRotVelocity_Impl(m, PSh.get_dt(), gen_vel);
 }
 
@@ -213,19 +221,166 @@ PINLINE void PContextActions_t::Callback(Particle_t& m, P_PARTICLE_CALLBACK_ACTI
 PINLINE void PContextActions_t::KillOld(Particle_t& m, const float age_limit, const bool kill_less_than)
 {
     P_CHECK_ERR;
-    PAKillOld_Impl(m, PSh.get_dt(), age_limit, kill_less_than);
+    if (PAKillOld_Impl(m, PSh.get_dt(), age_limit, kill_less_than)) PSh.kill(&m - PSh.get_pgroup_begin());
 }
 
 PINLINE void PContextActions_t::Sink(Particle_t& m, const bool kill_inside, const pDomain& kill_pos_dom)
 {
     P_CHECK_ERR;
-    PASink_Impl(m, PSh.get_dt(), kill_inside, kill_pos_dom);
+    if (PASink_Impl(m, PSh.get_dt(), kill_inside, kill_pos_dom)) PSh.kill(&m - PSh.get_pgroup_begin());
 }
 
 PINLINE void PContextActions_t::SinkVelocity(Particle_t& m, const bool kill_inside, const pDomain& kill_vel_dom)
 {
     P_CHECK_ERR;
-    PASinkVelocity_Impl(m, PSh.get_dt(), kill_inside, kill_vel_dom);
+    if (PASinkVelocity_Impl(m, PSh.get_dt(), kill_inside, kill_vel_dom)) PSh.kill(&m - PSh.get_pgroup_begin());
+}
+
+//////////////////////////////////////////////////////////////////
+// Inline actions with domains of concrete types
+
+// Domains that an action doesn't implement, and pDomain itself, go to the overload that switches on the domain's type.
+template <class D> PINLINE void PContextActions_t::Avoid(Particle_t& m, const float magnitude, const float epsilon, const float look_ahead, const D& dom)
+{
+    P_CHECK_ERR;
+    if constexpr (std::is_same_v<D, PDDisc>)
+        PAAvoidDisc_Impl(m, PSh.get_dt(), dom, look_ahead, magnitude, epsilon);
+    else if constexpr (std::is_same_v<D, PDPlane>)
+        PAAvoidPlane_Impl(m, PSh.get_dt(), dom, look_ahead, magnitude, epsilon);
+    else if constexpr (std::is_same_v<D, PDRectangle>)
+        PAAvoidRectangle_Impl(m, PSh.get_dt(), dom, look_ahead, magnitude, epsilon);
+    else if constexpr (std::is_same_v<D, PDSphere>)
+        PAAvoidSphere_Impl(m, PSh.get_dt(), dom, look_ahead, magnitude, epsilon);
+    else if constexpr (std::is_same_v<D, PDTriangle>)
+        PAAvoidTriangle_Impl(m, PSh.get_dt(), dom, look_ahead, magnitude, epsilon);
+    else
+        Avoid(m, magnitude, epsilon, look_ahead, static_cast<const pDomain&>(dom));
+}
+
+template <class D> PINLINE void PContextActions_t::Bounce(Particle_t& m, const float friction, const float resilience, const float fric_min_vel, const D& dom)
+{
+    P_CHECK_ERR;
+    if constexpr (std::is_same_v<D, PDBox>)
+        PABounceBox_Impl(m, PSh.get_dt(), dom, friction, resilience, fric_min_vel);
+    else if constexpr (std::is_same_v<D, PDDisc>)
+        PABounceDisc_Impl(m, PSh.get_dt(), dom, friction, resilience, fric_min_vel);
+    else if constexpr (std::is_same_v<D, PDPlane>)
+        PABouncePlane_Impl(m, PSh.get_dt(), dom, friction, resilience, fric_min_vel);
+    else if constexpr (std::is_same_v<D, PDRectangle>)
+        PABounceRectangle_Impl(m, PSh.get_dt(), dom, friction, resilience, fric_min_vel);
+    else if constexpr (std::is_same_v<D, PDSphere>)
+        PABounceSphere_Impl(m, PSh.get_dt(), dom, friction, resilience, fric_min_vel);
+    else if constexpr (std::is_same_v<D, PDTriangle>)
+        PABounceTriangle_Impl(m, PSh.get_dt(), dom, friction, resilience, fric_min_vel);
+    else
+        Bounce(m, friction, resilience, fric_min_vel, static_cast<const pDomain&>(dom));
+}
+
+template <class D, class A> PINLINE void PContextActions_t::Jet(Particle_t& m, const D& dom, const A& acc)
+{
+    P_CHECK_ERR;
+    pRandStreamScope scope(PSh.rand_stream(&m - PSh.get_pgroup_begin()));
+    PAJet_Impl(m, PSh.get_dt(), dom, acc);
+}
+
+template <class D> PINLINE void PContextActions_t::RandomAccel(Particle_t& m, const D& gen_acc)
+{
+    P_CHECK_ERR;
+    pRandStreamScope scope(PSh.rand_stream(&m - PSh.get_pgroup_begin()));
+    PARandomAccel_Impl(m, PSh.get_dt(), gen_acc);
+}
+
+template <class D> PINLINE void PContextActions_t::RandomDisplace(Particle_t& m, const D& gen_disp)
+{
+    P_CHECK_ERR;
+    pRandStreamScope scope(PSh.rand_stream(&m - PSh.get_pgroup_begin()));
+    PARandomDisplace_Impl(m, PSh.get_dt(), gen_disp);
+}
+
+template <class D> PINLINE void PContextActions_t::RandomVelocity(Particle_t& m, const D& gen_vel)
+{
+    P_CHECK_ERR;
+    pRandStreamScope scope(PSh.rand_stream(&m - PSh.get_pgroup_begin()));
+    PARandomVelocity_Impl(m, PSh.get_dt(), gen_vel);
+}
+
+template <class D> PINLINE void PContextActions_t::RandomRotVelocity(Particle_t& m, const D& gen_vel)
+{
+    P_CHECK_ERR;
+    pRandStreamScope scope(PSh.rand_stream(&m - PSh.get_pgroup_begin()));
+    PARandomRotVelocity_Impl(m, PSh.get_dt(), gen_vel);
+}
+
+template <class D> PINLINE void PContextActions_t::Sink(Particle_t& m, const bool kill_inside, const D& kill_pos_dom)
+{
+    P_CHECK_ERR;
+    if (PASink_Impl(m, PSh.get_dt(), kill_inside, kill_pos_dom)) PSh.kill(&m - PSh.get_pgroup_begin());
+}
+
+template <class D> PINLINE void PContextActions_t::SinkVelocity(Particle_t& m, const bool kill_inside, const D& kill_vel_dom)
+{
+    P_CHECK_ERR;
+    if (PASinkVelocity_Impl(m, PSh.get_dt(), kill_inside, kill_vel_dom)) PSh.kill(&m - PSh.get_pgroup_begin());
+}
+
+//////////////////////////////////////////////////////////////////
+// Prepared inline actions
+
+template <class D> PINLINE PABounce_Prep<D> PContextPrep_t::Bounce(const float friction, const float resilience, const float fric_min_vel, const D& dom) const
+{
+    return PABounce_Prep<D>(get_dt(), dom, friction, resilience, fric_min_vel);
+}
+
+PINLINE PADamping_Prep PContextPrep_t::Damping(const pVec& damping, const float min_vel, const float max_vel) const
+{
+    return PADamping_Prep(get_dt(), damping, min_vel, max_vel);
+}
+
+PINLINE PARotDamping_Prep PContextPrep_t::RotDamping(const pVec& damping, const float min_vel, const float max_vel) const
+{
+    return PARotDamping_Prep(get_dt(), damping, min_vel, max_vel);
+}
+
+PINLINE PAExplosion_Prep PContextPrep_t::Explosion(const pVec& center, const float radius, const float magnitude, const float sigma, const float epsilon) const
+{
+    return PAExplosion_Prep(get_dt(), center, radius, magnitude, sigma, epsilon);
+}
+
+PINLINE PAGravity_Prep PContextPrep_t::Gravity(const pVec& dir) const { return PAGravity_Prep(get_dt(), dir); }
+
+PINLINE PAOrbitLine_Prep PContextPrep_t::OrbitLine(const pVec& p, const pVec& axis, const float magnitude, const float epsilon, const float max_radius) const
+{
+    return PAOrbitLine_Prep(get_dt(), p, axis, magnitude, epsilon, max_radius);
+}
+
+PINLINE PAOrbitPoint_Prep PContextPrep_t::OrbitPoint(const pVec& center, const float magnitude, const float epsilon, const float max_radius) const
+{
+    return PAOrbitPoint_Prep(get_dt(), center, magnitude, epsilon, max_radius);
+}
+
+PINLINE PASpeedClamp_Prep PContextPrep_t::SpeedClamp(const float min_speed, const float max_speed) const
+{
+    return PASpeedClamp_Prep(get_dt(), min_speed, max_speed);
+}
+
+PINLINE PATargetColor_Prep PContextPrep_t::TargetColor(const pVec& color, const float alpha, const float scale) const
+{
+    return PATargetColor_Prep(get_dt(), color, alpha, scale);
+}
+
+PINLINE PATargetSize_Prep PContextPrep_t::TargetSize(const pVec& size, const pVec& scale) const { return PATargetSize_Prep(get_dt(), size, scale); }
+
+PINLINE PATargetVelocity_Prep PContextPrep_t::TargetVelocity(const pVec& vel, const float scale) const { return PATargetVelocity_Prep(get_dt(), vel, scale); }
+
+PINLINE PATargetRotVelocity_Prep PContextPrep_t::TargetRotVelocity(const pVec& rvel, const float scale) const
+{
+    return PATargetRotVelocity_Prep(get_dt(), rvel, scale);
+}
+
+PINLINE PAVortex_Prep PContextPrep_t::Vortex(const pVec& tip, const pVec& axis, const float tightnessExponent, const float max_radius, const float inSpeed,
+                                             const float upSpeed, const float aroundSpeed) const
+{
+    return PAVortex_Prep(get_dt(), tip, axis, tightnessExponent, max_radius, inSpeed, upSpeed, aroundSpeed);
 }
 
 #undef P_CHECK_ERR
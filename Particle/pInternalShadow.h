@@ -8,19 +8,173 @@
 #ifndef PInternalShadow_h
 #define PInternalShadow_h
 
+#include "Particle/pVec.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
 namespace PAPI {
 struct Particle_t;
+class pScheduler_t;
+
+inline int pPopCount(const uint64_t x)
+{
+#ifdef _MSC_VER
+    return (int)__popcnt64(x);
+#else
+    return __builtin_popcountll(x);
+#endif
+}
+
+inline int pCountTrailingZeros(const uint64_t x) // x must not be 0.
+{
+#ifdef _MSC_VER
+    unsigned long i;
+    _BitScanForward64(&i, x);
+    return (int)i;
+#else
+    return __builtin_ctzll(x);
+#endif
+}
+
+// One bit per particle of a group saying whether the particle has been tagged to be killed.
+// Actions running in parallel tag particles by atomically setting bits, and the group later commits the kills.
+// The bits are indexed by position in the group, so they must be committed before particles are removed or reordered.
+class KillBitmap_t {
+    std::unique_ptr<std::atomic<uint64_t>[]> bits;
+    size_t words;
+    std::atomic<bool> any; // False if no bit is set, so committing can be skipped
+
+public:
+    KillBitmap_t() : words(0), any(false) {}
+    KillBitmap_t(const KillBitmap_t& rhs) : words(0), any(false) { *this = rhs; }
+    KillBitmap_t(KillBitmap_t&& rhs) noexcept : words(0), any(false) { *this = std::move(rhs); }
+
+    KillBitmap_t& operator=(const KillBitmap_t& rhs)
+    {
+        if (this != &rhs) {
+            Reserve(rhs.words * 64);
+            for (size_t w = 0; w < words; w++) bits[w].store(w < rhs.words ? rhs.bits[w].load(std::memory_order_relaxed) : 0, std::memory_order_relaxed);
+            any.store(rhs.any.load());
+        }
+        return *this;
+    }
+
+    KillBitmap_t& operator=(KillBitmap_t&& rhs) noexcept
+    {
+        if (this != &rhs) {
+            bits = std::move(rhs.bits);
+            words = rhs.words;
+            any.store(rhs.any.load());
+            rhs.words = 0;
+            rhs.any.store(false);
+        }
+        return *this;
+    }
+
+    // Make room for n particles, keeping the existing tags. Not thread safe.
+    void Reserve(const size_t n)
+    {
+        size_t w = (n + 63) / 64;
+        if (w <= words) return;
+
+        w = std::max(w, words * 2);
+        std::unique_ptr<std::atomic<uint64_t>[]> new_bits(new std::atomic<uint64_t>[w]);
+        for (size_t i = 0; i < w; i++) new_bits[i].store(i < words ? bits[i].load(std::memory_order_relaxed) : 0, std::memory_order_relaxed);
+        bits.swap(new_bits);
+        words = w;
+    }
+
+    inline bool Any() const { return any.load(std::memory_order_relaxed); }
+
+    // Tag particle i. Thread safe.
+    inline void Set(const size_t i) { SetBits(i, 1); }
+
+    // Tag the particles starting at i whose bits are set in mask. mask must not cross a 64-bit word. Thread safe.
+    inline void SetBits(const size_t i, const uint64_t mask)
+    {
+        if (!mask) return;
+        bits[i >> 6].fetch_or(mask << (i & 63), std::memory_order_relaxed);
+        if (!any.load(std::memory_order_relaxed)) any.store(true, std::memory_order_relaxed);
+    }
+
+    inline bool Test(const size_t i) const { return (Word(i >> 6) >> (i & 63)) & 1; }
+
+    // The tags of particles [64 * w, 64 * w + 64)
+    inline uint64_t Word(const size_t w) const { return w < words ? bits[w].load(std::memory_order_relaxed) : 0; }
+
+    // Make particle i's tag be v. Not thread safe.
+    inline void Assign(const size_t i, const bool v)
+    {
+        uint64_t b = bits[i >> 6].load(std::memory_order_relaxed), m = uint64_t(1) << (i & 63);
+        bits[i >> 6].store(v ? (b | m) : (b & ~m), std::memory_order_relaxed);
+    }
+
+    // Return the first tagged particle in [i, n), or n if there is none
+    size_t NextSet(size_t i, const size_t n) const
+    {
+        while (i < n && (i >> 6) < words) {
+            uint64_t b = Word(i >> 6) >> (i & 63);
+            if (b) return std::min(i + pCountTrailingZeros(b), n);
+            i = (i | 63) + 1;
+        }
+        return n;
+    }
+
+    // Return the first untagged particle in [i, n), or n if there is none
+    size_t NextClear(size_t i, const size_t n) const
+    {
+        while (i < n) {
+            uint64_t b = ~Word(i >> 6) >> (i & 63);
+            if (b) return std::min(i + pCountTrailingZeros(b), n);
+            i = (i | 63) + 1;
+        }
+        return n;
+    }
+
+    // How many of particles [first, last) are tagged
+    size_t Count(const size_t first, const size_t last) const
+    {
+        size_t c = 0;
+        for (size_t i = first; i < last;) {
+            size_t e = std::min((i | 63) + 1, last);
+            uint64_t b = Word(i >> 6) >> (i & 63);
+            if (e - i < 64) b &= (uint64_t(1) << (e - i)) - 1;
+            c += pPopCount(b);
+            i = e;
+        }
+        return c;
+    }
+
+    // How many of particles [0, n) are tagged
+    size_t Count(const size_t n) const { return Any() ? Count(0, n) : 0; }
+
+    // Untag particles n and above, such as when the group shrinks. Not thread safe.
+    void Truncate(const size_t n)
+    {
+        if (!Any()) return;
+        if (n == 0) any.store(false);
+        for (size_t w = (n + 63) / 64; w < words; w++) bits[w].store(0, std::memory_order_relaxed);
+        if ((n & 63) && (n >> 6) < words) bits[n >> 6].fetch_and((uint64_t(1) << (n & 63)) - 1, std::memory_order_relaxed);
+    }
+};
 
 // Shadow copy of some information from PInternalState_t that is used by the inline actions API
 // It is owned by pContextActions_t.
-// It is updated by StartParticleLoop(), called from pContextActions_t::ParticleLoop().
+// It is updated by StartParticleLoop() and NextParticleChunk(), called from pContextActions_t::ParticleLoop().
 class PInternalShadow_t {
 public:
     float get_dt() { return dt; }
-    const Particle_t* get_const_pgroup_begin() { return ibegin; } // Iterator to beginning of current particle group
-    const Particle_t* get_const_pgroup_end() { return iend; }     // Iterator to end of current particle group
-    Particle_t* get_pgroup_begin() { return ibegin; }             // Iterator to beginning of current particle group
-    Particle_t* get_pgroup_end() { return iend; }                 // Iterator to end of current particle group
+    const Particle_t* get_const_pgroup_begin() { return ibegin; } // Iterator to beginning of current chunk of particle group
+    const Particle_t* get_const_pgroup_end() { return iend; }     // Iterator to end of current chunk of particle group
+    Particle_t* get_pgroup_begin() { return ibegin; }             // Iterator to beginning of current chunk of particle group
+    Particle_t* get_pgroup_end() { return iend; }                 // Iterator to end of current chunk of particle group
     bool get_in_new_list() const { return in_new_list; }
     bool get_in_particle_loop() const { return in_particle_loop; }
 
@@ -28,13 +182,34 @@ public:
     Particle_t* ibegin;
     Particle_t* iend;
 
+    unsigned int attribs; // The attributes the loop touches
+    size_t chunk_first;   // Index in the group of *ibegin
+    KillBitmap_t* kills;  // The kill tags of the group
+
+    uint32_t seed;  // The random number streams of this loop are keyed by seed, frame, and particle index
+    uint64_t frame;
+
+    pScheduler_t* scheduler; // Runs the loop on the particles of each chunk when given a parallel execution policy
+
+    // Tag particle i of the current chunk to be killed
+    inline void kill(const size_t i) { kills->Set(chunk_first + i); }
+
+    // The random number stream of particle i of the current chunk. Successive inline actions on the same particle continue its stream.
+    inline pRandStream_t& rand_stream(const size_t i)
+    {
+        static thread_local pRandStream_t R;
+        if (!R.HasKey(seed, frame, chunk_first + i)) R.Reset(seed, frame, chunk_first + i);
+        return R;
+    }
+
     bool in_new_list;
     bool in_particle_loop;
 };
 
 class PInternalState_t; // The API-internal struct containing the context's state. Don't try to use it.
 
-void StartParticleLoop(std::shared_ptr<PInternalState_t> PS, PInternalShadow_t& PSh);
+void StartParticleLoop(std::shared_ptr<PInternalState_t> PS, PInternalShadow_t& PSh, const unsigned int attribs);
+bool NextParticleChunk(std::shared_ptr<PInternalState_t> PS, PInternalShadow_t& PSh); // Returns false when the whole group has been visited
 void EndParticleLoop(std::shared_ptr<PInternalState_t> PS, PInternalShadow_t& PSh);
 } // namespace PAPI
 
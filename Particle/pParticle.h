@@ -51,6 +51,102 @@ struct Particle_t {
 };
 
 static_assert(sizeof(Particle_t) == 32 * 4, "Unexpected change in Particle_t size!");
+
+/// Bit masks naming the attributes of a particle.
+///
+/// These are used to say which attributes a ParticleLoop() touches, and internally to say which attributes an action reads and writes, so that
+/// particle groups stored in a layout other than P_LAYOUT_AOS only stream the attributes that are needed.
+enum pAttrib_E : unsigned int {
+    PA_POS = 1u << 0,
+    PA_POSB = 1u << 1,
+    PA_UP = 1u << 2,
+    PA_UPB = 1u << 3,
+    PA_VEL = 1u << 4,
+    PA_VELB = 1u << 5,
+    PA_RVEL = 1u << 6,
+    PA_SIZE = 1u << 7,
+    PA_COLOR = 1u << 8,
+    PA_ALPHA = 1u << 9,
+    PA_AGE = 1u << 10,
+    PA_MASS = 1u << 11,
+    PA_TMP0 = 1u << 12,
+    PA_DATA = 1u << 13,
+    PA_ALL = (1u << 14) - 1u,
+
+    // Storage hints for P_LAYOUT_PACKED groups. These aren't attributes.
+    PA_COLOR_RGBA8 = 1u << 16,   ///< Store color and alpha as 8-bit unsigned normalized values, clamped to [0,1]. Very slow fades may stall.
+    PA_COLOR_RGBA16F = 1u << 17, ///< Store color and alpha as half floats
+    PA_SIZE_16F = 1u << 18       ///< Store size as half floats
+};
+
+// Invokes X(mask, member) for every attribute of Particle_t
+#define P_PARTICLE_ATTRIBS(X)                                                                                                                        \
+    X(PA_POS, pos) X(PA_POSB, posB) X(PA_UP, up) X(PA_UPB, upB) X(PA_VEL, vel) X(PA_VELB, velB) X(PA_RVEL, rvel) X(PA_SIZE, size) X(PA_COLOR, color) \
+        X(PA_ALPHA, alpha) X(PA_AGE, age) X(PA_MASS, mass) X(PA_TMP0, tmp0) X(PA_DATA, data)
+
+/// The number of particles in each block of a P_LAYOUT_AOSOA particle group. 16 floats fill an AVX-512 register.
+const int P_BLOCK_WIDTH = 16;
+
+// One vector attribute of a block of particles, with each component stored contiguously
+struct pVecBlock {
+    float x[P_BLOCK_WIDTH];
+    float y[P_BLOCK_WIDTH];
+    float z[P_BLOCK_WIDTH];
+
+    PINLINE pVec Get(const int l) const { return pVec(x[l], y[l], z[l]); }
+
+    PINLINE void Set(const int l, const pVec& v)
+    {
+        x[l] = v.x();
+        y[l] = v.y();
+        z[l] = v.z();
+    }
+};
+
+PINLINE void pGetLane(const pVecBlock& b, const int l, pVec& v) { v = b.Get(l); }
+PINLINE void pSetLane(pVecBlock& b, const int l, const pVec& v) { b.Set(l, v); }
+template <class T> PINLINE void pGetLane(const T (&b)[P_BLOCK_WIDTH], const int l, T& v) { v = b[l]; }
+template <class T> PINLINE void pSetLane(T (&b)[P_BLOCK_WIDTH], const int l, const T& v) { b[l] = v; }
+
+// A block of P_BLOCK_WIDTH particles with each attribute stored contiguously within the block.
+// This is the unit of storage of the P_LAYOUT_AOSOA layout. A loop over the lanes of a block vectorizes to full-width loads and stores,
+// while all the attributes of a particle are still within one 2 KB block for swap-removal.
+struct alignas(64) ParticleBlock_t {
+    pVecBlock pos;
+    pVecBlock posB;
+    pVecBlock up;
+    pVecBlock upB;
+    pVecBlock vel;
+    pVecBlock velB;
+    pVecBlock rvel;
+    pVecBlock size;
+    pVecBlock color;
+    float alpha[P_BLOCK_WIDTH];
+    float age[P_BLOCK_WIDTH];
+    float mass[P_BLOCK_WIDTH];
+    float tmp0[P_BLOCK_WIDTH];
+    pdata_t data[P_BLOCK_WIDTH];
+
+    // Copy the attributes in mask A of lane l to m
+    template <unsigned int A> PINLINE void GetLane(const int l, Particle_t& m) const
+    {
+#define P_GET_LANE(bit, name) \
+    if constexpr ((A & bit) != 0) pGetLane(name, l, m.name);
+        P_PARTICLE_ATTRIBS(P_GET_LANE)
+#undef P_GET_LANE
+    }
+
+    // Copy the attributes in mask A of m to lane l
+    template <unsigned int A> PINLINE void SetLane(const int l, const Particle_t& m)
+    {
+#define P_SET_LANE(bit, name) \
+    if constexpr ((A & bit) != 0) pSetLane(name, l, m.name);
+        P_PARTICLE_ATTRIBS(P_SET_LANE)
+#undef P_SET_LANE
+    }
+};
+
+static_assert(sizeof(ParticleBlock_t) == sizeof(Particle_t) * P_BLOCK_WIDTH, "Unexpected change in ParticleBlock_t size!");
 }; // namespace PAPI
 
 #endif
@@ -0,0 +1,157 @@
+/// pScheduler.h
+///
+/// Copyright 1997-2007, 2022 by David K. McAllister
+///
+/// This file defines pScheduler_t, which runs the parallel loops of a context, and the schedulers that come with the API.
+
+#ifndef pscheduler_h
+#define pscheduler_h
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace PAPI {
+
+/// Runs the parallel loops of a context
+///
+/// The action lists, the actions, committing kills, and ParticleLoop() with a parallel execution policy split their work into a range of
+/// items and hand it to the context's scheduler. See PContextParticleGroup_t::SetScheduler(). Derive from this to plug in your own backend.
+class pScheduler_t {
+public:
+    /// The fewest particles a task gets in ParticleLoop() and the actions that loop over particles in parallel
+    size_t grain_size = 1024;
+
+    virtual ~pScheduler_t() {}
+
+    /// Call f(b, e) on disjoint subranges [b, e) that cover [0, n). Each subrange starts at a multiple of grain, and is usually grain items long.
+    /// The calls may be made in parallel and in any order. Returns when all of them are done. If a call of f throws, the calls that haven't
+    /// started are skipped, and the first exception is rethrown once the calls in progress are done.
+    virtual void ParallelFor(const size_t n, const size_t grain, const std::function<void(size_t, size_t)>& f) = 0;
+
+    /// How many threads ParallelFor() may run on at once, counting the calling thread
+    virtual int ThreadCount() const = 0;
+
+    /// Call f(i) for each i in [0, n), in parallel on tasks of grain items
+    template <class F> void ForEach(const size_t n, const size_t grain, F f)
+    {
+        if (n == 0) return;
+        if (n <= grain || ThreadCount() == 1) {
+            for (size_t i = 0; i < n; i++) f(i);
+            return;
+        }
+
+        ParallelFor(n, grain, [&](size_t b, size_t e) {
+            for (size_t i = b; i < e; i++) f(i);
+        });
+    }
+};
+
+/// Runs everything on the calling thread
+class pSerialScheduler_t : public pScheduler_t {
+public:
+    void ParallelFor(const size_t n, const size_t grain, const std::function<void(size_t, size_t)>& f)
+    {
+        if (n) f(0, n);
+    }
+
+    int ThreadCount() const { return 1; }
+};
+
+/// Runs the tasks with std::for_each(std::execution::par). This is TBB with libstdc++ and the Concurrency Runtime with MSVC.
+class pStdParScheduler_t : public pScheduler_t {
+public:
+    void ParallelFor(const size_t n, const size_t grain, const std::function<void(size_t, size_t)>& f);
+    int ThreadCount() const;
+};
+
+#ifdef _OPENMP
+/// Runs the tasks with an OpenMP parallel for loop with dynamic scheduling. Only defined when compiling with OpenMP.
+class pOpenMPScheduler_t : public pScheduler_t {
+public:
+    void ParallelFor(const size_t n, const size_t grain, const std::function<void(size_t, size_t)>& f)
+    {
+        const size_t g = std::max(grain, size_t(1));
+        const long long tasks = (long long)((n + g - 1) / g);
+
+        // An exception can't leave an OpenMP parallel region, so keep the first one and rethrow it here.
+        std::exception_ptr error;
+        std::atomic<bool> failed{false};
+#pragma omp parallel for schedule(dynamic)
+        for (long long t = 0; t < tasks; t++) {
+            if (failed.load(std::memory_order_relaxed)) continue;
+            try {
+                f(t * g, std::min(n, (size_t)t * g + g));
+            } catch (...) {
+                if (!failed.exchange(true)) error = std::current_exception();
+            }
+        }
+        if (error) std::rethrow_exception(error);
+    }
+
+    int ThreadCount() const { return omp_get_max_threads(); }
+};
+#endif
+
+/// A work-stealing thread pool. This is the default scheduler of a context.
+///
+/// Each ParallelFor() splits the tasks evenly among the pool's threads and the calling thread. A thread that runs out of tasks steals the
+/// second half of the remaining tasks of another thread. A ParallelFor() made from inside a task of any pool runs on the thread that made it,
+/// so each task of an action list runs its actions serially on its own chunk of particles. A ParallelFor() made while another thread's is
+/// running on the same pool also runs on the thread that made it. The threads are started by the first ParallelFor() that needs them.
+class pThreadPool_t : public pScheduler_t {
+public:
+    /// Make a pool that runs tasks on thread_count threads, counting the thread calling ParallelFor().
+    /// thread_count <= 0 means one per hardware thread. If pin_threads is true, the pool's threads are each bound to one hardware thread.
+    pThreadPool_t(const int thread_count = 0, const bool pin_threads = false);
+    ~pThreadPool_t();
+
+    void ParallelFor(const size_t n, const size_t grain, const std::function<void(size_t, size_t)>& f);
+    int ThreadCount() const { return thread_count; }
+
+private:
+    void Start();                                // Start the threads
+    void WorkerMain(const int p, uint64_t seen); // The loop of pool thread p, which is participant p of each job after generation seen
+    void Work(const int p);                      // Run tasks of the current job as participant p until none are left
+    bool Pop(const int p, size_t& t);
+    bool Steal(const int p, size_t& t);
+
+    // The tasks [lo, hi) that participant p has left of the current job, packed as lo << 32 | hi so they can be claimed by compare and swap.
+    // The owner takes tasks from the front and thieves take them from the back.
+    struct alignas(64) TaskRange_t {
+        std::atomic<uint64_t> lohi;
+    };
+
+    int thread_count;
+    bool pin_threads;
+    std::vector<std::thread> threads;
+    std::unique_ptr<TaskRange_t[]> ranges; // One per participant. Participant 0 is the thread that called ParallelFor().
+
+    std::mutex job_mutex; // Held by the thread running a ParallelFor() on the pool
+    std::mutex mutex;     // Guards the job fields below and wakes the threads
+    std::condition_variable wake, done;
+    uint64_t generation = 0; // Incremented for each job
+    int active = 0;          // How many pool threads are working on the current job
+    bool stop = false;
+
+    const std::function<void(size_t, size_t)>* job_f = NULL;
+    size_t job_n = 0, job_grain = 0;
+    std::atomic<size_t> pending{0};     // Tasks of the current job that haven't finished
+    std::atomic<bool> job_failed{false}; // True once a task of the current job has thrown
+    std::exception_ptr job_error;        // The first exception thrown by a task of the current job
+};
+}; // namespace PAPI
+
+#endif
@@ -7,7 +7,9 @@
 #ifndef pvec_h
 #define pvec_h
 
+#include <atomic>
 #include <cmath>
+#include <cstdint>
 #include <iostream>
 
 #ifndef M_PI
@@ -26,33 +28,260 @@ const float P_ONEOVERSQRT2PI = (1.f / P_SQRT2PI);
 
 PINLINE float fsqr(float f) { return f * f; }
 
-#ifdef unix
-PINLINE float pRandf() { return drand48(); }
-PINLINE void pSRandf(int x) { srand48(x); }
-#else
-const float P_ONEOVER_RAND_MAX = (1.0f / ((float)RAND_MAX));
-PINLINE float pRandf() { return ((float)rand()) * P_ONEOVER_RAND_MAX; }
-PINLINE void pSRandf(int x) { srand(x); }
-#endif
+/// Apply the Philox4x32-10 counter-based bijection to ctr with the given key. The output looks random for every counter, so a
+/// stream is just a key and an incrementing counter, with no state shared between threads.
+PINLINE void pPhilox4x32(uint32_t ctr[4], uint32_t k0, uint32_t k1)
+{
+    for (int r = 0; r < 10; r++) {
+        uint64_t p0 = uint64_t(0xD2511F53u) * ctr[0], p1 = uint64_t(0xCD9E8D57u) * ctr[2];
+        uint32_t c1 = ctr[1], c3 = ctr[3];
+        ctr[0] = uint32_t(p1 >> 32) ^ c1 ^ k0;
+        ctr[1] = uint32_t(p1);
+        ctr[2] = uint32_t(p0 >> 32) ^ c3 ^ k1;
+        ctr[3] = uint32_t(p0);
+        k0 += 0x9E3779B9u;
+        k1 += 0xBB67AE85u;
+    }
+}
+
+/// A stream of random numbers keyed by (seed, frame, index). The same key always gives the same stream, on any thread and in any order.
+/// The actions key each particle's stream by the context's seed, a count of the actions run so far, and the particle's index in its group.
+struct pRandStream_t {
+    uint32_t seed, frame_lo;
+    uint32_t ctr[4]; // index, index, frame, block of four numbers
+    uint32_t out[4];
+    int avail; // How many of out haven't been returned yet
+
+    pRandStream_t(const uint32_t seed_ = 0, const uint64_t frame = 0, const uint64_t index = 0) { Reset(seed_, frame, index); }
+
+    PINLINE void Reset(const uint32_t seed_, const uint64_t frame, const uint64_t index)
+    {
+        seed = seed_;
+        frame_lo = uint32_t(frame);
+        ctr[0] = uint32_t(index);
+        ctr[1] = uint32_t(index >> 32);
+        ctr[2] = uint32_t(frame >> 32);
+        ctr[3] = 0;
+        avail = 0;
+    }
+
+    PINLINE bool HasKey(const uint32_t seed_, const uint64_t frame, const uint64_t index) const
+    {
+        return seed == seed_ && frame_lo == uint32_t(frame) && ctr[0] == uint32_t(index) && ctr[1] == uint32_t(index >> 32) && ctr[2] == uint32_t(frame >> 32);
+    }
+
+    PINLINE uint32_t Next()
+    {
+        if (avail == 0) {
+            for (int i = 0; i < 4; i++) out[i] = ctr[i];
+            pPhilox4x32(out, seed, frame_lo);
+            ctr[3]++;
+            avail = 4;
+        }
+        return out[4 - avail--];
+    }
+
+    /// Return a uniform random float in [0, 1)
+    PINLINE float Randf() { return float(Next() >> 8) * (1.0f / 16777216.0f); }
+};
+
+/// The streams of a batch of particles with consecutive indices. Element i of the batch draws from the stream keyed (seed, frame, first + i),
+/// starting at block `block`. Rand4 computes any block of any element's stream straight from its key, so a loop over the batch carries no
+/// state from one element to the next and the compiler can vectorize it.
+struct pRandBatch_t {
+    uint32_t seed;
+    uint64_t frame, first;
+    uint32_t block;
+
+    pRandBatch_t(const uint32_t seed_ = 0, const uint64_t frame_ = 0, const uint64_t first_ = 0, const uint32_t block_ = 0)
+        : seed(seed_), frame(frame_), first(first_), block(block_)
+    {
+    }
+
+    /// Returns the batch that starts at element k of this one
+    PINLINE pRandBatch_t Offset(const size_t k) const { return pRandBatch_t(seed, frame, first + k, block); }
+
+    /// Returns a batch of the same elements whose streams are independent of these, for drawing the s'th of several values per element
+    PINLINE pRandBatch_t Sub(const uint32_t s) const { return pRandBatch_t(seed, frame, first, block + (s << 24)); }
+
+    /// Returns element i's stream, for domains that draw a varying number of values per element
+    PINLINE pRandStream_t Stream(const size_t i) const
+    {
+        pRandStream_t R(seed, frame, first + i);
+        R.ctr[3] = block;
+        return R;
+    }
+
+    /// Writes block b of element i's stream to r: the four numbers that Stream(i).Next() returns after 4*b draws
+    PINLINE void Bits4(const size_t i, const uint32_t b, uint32_t r[4]) const
+    {
+        const uint64_t index = first + i;
+        r[0] = uint32_t(index);
+        r[1] = uint32_t(index >> 32);
+        r[2] = uint32_t(frame >> 32);
+        r[3] = block + b;
+        pPhilox4x32(r, seed, uint32_t(frame));
+    }
+
+    /// Writes block b of element i's stream to r as four floats in [0, 1), the same ones that Stream(i).Randf() returns after 4*b draws
+    PINLINE void Rand4(const size_t i, const uint32_t b, float r[4]) const
+    {
+        uint32_t u[4];
+        Bits4(i, b, u);
+        for (int k = 0; k < 4; k++) r[k] = float(u[k] >> 8) * (1.0f / 16777216.0f);
+    }
+};
+
+/// The seed of the default streams of the threads that haven't drawn from theirs yet. pSRandf() sets it.
+inline std::atomic<uint32_t> pDefaultRandSeed{0};
+
+/// Numbers the threads in the order that they first draw from their default stream
+inline std::atomic<uint64_t> pRandThreadCount{0};
+
+/// This thread's number, which keys its default stream so that each thread draws different numbers. The first thread to draw is 0.
+inline thread_local const uint64_t pRandThreadIndex = pRandThreadCount++;
+
+/// The stream that pRandf() draws from on this thread when none is installed by a pRandStreamScope. It is keyed by pDefaultRandSeed and
+/// pRandThreadIndex, so which numbers a thread other than the first gets depends on the order in which the threads first draw.
+inline thread_local pRandStream_t pThreadDefaultRandStream(pDefaultRandSeed.load(), 0, pRandThreadIndex);
+
+/// The stream that pRandf() draws from on this thread, or NULL for pThreadDefaultRandStream
+inline thread_local pRandStream_t* pThreadRandStream = NULL;
+
+/// Returns the stream that pRandf() draws from on this thread
+PINLINE pRandStream_t& pCurrentRandStream() { return pThreadRandStream ? *pThreadRandStream : pThreadDefaultRandStream; }
+
+PINLINE float pRandf() { return pCurrentRandStream().Randf(); }
+
+/// Seed this thread's default stream, and those of the threads that haven't drawn from theirs yet. Other threads keep their streams.
+PINLINE void pSRandf(int x)
+{
+    pDefaultRandSeed = uint32_t(x);
+    pThreadDefaultRandStream.Reset(uint32_t(x), 0, pRandThreadIndex);
+}
+
+/// Makes pRandf() draw from the given stream on this thread until the end of the scope
+struct pRandStreamScope {
+    pRandStream_t* prev;
+
+    explicit pRandStreamScope(pRandStream_t& R) : prev(pThreadRandStream) { pThreadRandStream = &R; }
+    ~pRandStreamScope() { pThreadRandStream = prev; }
+};
 
 PINLINE bool pSameSign(const float& a, const float& b) { return a * b >= 0.0f; }
 
+/// The tables of the 128-layer Ziggurat of Marsaglia and Tsang, for drawing standard normal numbers. The low seven bits of a random
+/// 32-bit number choose a layer, and all 32 bits, as a signed number, choose a position across it. About 99% of positions are inside the
+/// layer's rectangle, and Fast() turns them into a normal number with one table lookup and one multiply. Slow() handles the rest, which
+/// fall in the wedge under the curve or in the tail, by drawing more numbers from a stream.
+struct pZiggurat_t {
+    uint32_t kn[128]; // How far across layer i a position can be and still be inside its rectangle, scaled to 2^31
+    float wn[128];    // Scales a position in layer i to x
+    float fn[128];    // The density at the top edge of layer i
+
+    pZiggurat_t()
+    {
+        const double m1 = 2147483648.0, vn = 9.91256303526217e-3; // 2^31 and the area of each layer
+        double dn = 3.442619855899, tn = dn;                       // Where the tail begins
+        double q = vn / exp(-0.5 * dn * dn);
+
+        kn[0] = uint32_t((dn / q) * m1);
+        kn[1] = 0;
+        wn[0] = float(q / m1);
+        wn[127] = float(dn / m1);
+        fn[0] = 1.0f;
+        fn[127] = float(exp(-0.5 * dn * dn));
+
+        for (int i = 126; i >= 1; i--) {
+            dn = sqrt(-2.0 * log(vn / dn + exp(-0.5 * dn * dn)));
+            kn[i + 1] = uint32_t((dn / tn) * m1);
+            tn = dn;
+            fn[i] = float(exp(-0.5 * dn * dn));
+            wn[i] = float(dn / m1);
+        }
+    }
+
+    /// Writes the normal number of the random bits u to x. Returns false if u isn't inside its layer's rectangle, so x is wrong and Slow() is needed.
+    PINLINE bool Fast(const uint32_t u, float& x) const
+    {
+        const uint32_t iz = u & 127;
+        x = float(int32_t(u)) * wn[iz];
+        return (int32_t(u) < 0 ? 0u - u : u) < kn[iz];
+    }
+
+    /// Returns the normal number of the random bits u that Fast() rejected, drawing any more numbers it needs from S
+    float Slow(uint32_t u, pRandStream_t& S) const
+    {
+        const float r = 3.442620f; // Where the tail begins
+        for (;;) {
+            const uint32_t iz = u & 127;
+            float x = float(int32_t(u)) * wn[iz];
+
+            if (iz == 0) { // Sample the tail beyond r
+                float y;
+                do {
+                    x = -logf(1.0f - S.Randf()) * (1.0f / r);
+                    y = -logf(1.0f - S.Randf());
+                } while (y + y < x * x);
+                return int32_t(u) > 0 ? r + x : -r - x;
+            }
+
+            if (fn[iz] + S.Randf() * (fn[iz - 1] - fn[iz]) < expf(-0.5f * x * x)) return x; // In the wedge under the curve
+
+            u = S.Next();
+            if (Fast(u, x)) return x;
+        }
+    }
+};
+
+/// The Ziggurat tables, built the first time they are needed
+PINLINE const pZiggurat_t& pZigguratTables()
+{
+    static const pZiggurat_t Z;
+    return Z;
+}
+
 /// Return a random number with a normal distribution.
 PINLINE float pNRandf(float sigma = 1.0f)
 {
-    float x, y, r2;
-    do {
-        x = pRandf() * 2.0f - 1.0f;
-        y = pRandf() * 2.0f - 1.0f;
-        r2 = x * x + y * y;
-    } while (r2 > 1.0f || r2 == 0.0f);
+    const pZiggurat_t& Z = pZigguratTables();
+    pRandStream_t& S = pCurrentRandStream();
+    uint32_t u = S.Next();
+    float x;
+    if (!Z.Fast(u, x)) x = Z.Slow(u, S);
 
-    float m = sqrtf(-2.0f * logf(r2) / r2);
+    return x * sigma;
+}
 
-    float px = x * m * sigma;
-    // float py = y*m*sigma;
+/// Finish normal number c of element i of R, whose bits in block 0 of its stream missed the Ziggurat's rectangles. Each c continues
+/// from its own later block of the stream so that the misses of one element don't share numbers.
+PINLINE float pNRandSlow(const pZiggurat_t& Z, const pRandBatch_t& R, const size_t i, const uint32_t c)
+{
+    uint32_t u[4];
+    R.Bits4(i, 0, u);
+    pRandStream_t S = R.Stream(i);
+    S.ctr[3] += 1 + (c << 16);
+    return Z.Slow(u[c], S);
+}
 
-    return px;
+/// Writes a normal random number with standard deviation sigma to each of x[0 .. n), drawing number i from stream i of R. The first loop
+/// of each run of 64 does the Ziggurat's fast path for all of them, so it vectorizes. The few that miss are finished one at a time.
+PINLINE void pNRandN(float* x, const size_t n, const pRandBatch_t& R, const float sigma = 1.0f)
+{
+    const pZiggurat_t& Z = pZigguratTables();
+    for (size_t i0 = 0; i0 < n; i0 += 64) {
+        const size_t m = n - i0 < 64 ? n - i0 : 64;
+        bool miss[64];
+        for (size_t j = 0; j < m; j++) {
+            uint32_t u[4];
+            R.Bits4(i0 + j, 0, u);
+            miss[j] = !Z.Fast(u[0], x[i0 + j]);
+        }
+        for (size_t j = 0; j < m; j++) {
+            if (miss[j]) x[i0 + j] = pNRandSlow(Z, R, i0 + j, 0);
+            x[i0 + j] *= sigma;
+        }
+    }
 }
 
 /// A single-precision floating point three-vector.
@@ -178,18 +407,40 @@ PINLINE pVec pRandVec() { return pVec(pRandf(), pRandf(), pRandf()); }
 
 PINLINE pVec pNRandVec(float sigma)
 {
-    float x, y, r2;
-    do {
-        x = pRandf() * 2.0f - 1.0f;
-        y = pRandf() * 2.0f - 1.0f;
-        r2 = x * x + y * y;
-    } while (r2 > 1.0f || r2 == 0.0f);
-
-    float m = sqrtf(-2.0f * logf(r2) / r2);
-
-    float px = x * m * sigma;
-    float py = y * m * sigma;
-    return pVec(px, py, pNRandf(sigma));
+    float px = pNRandf(sigma);
+    float py = pNRandf(sigma);
+    float pz = pNRandf(sigma);
+    return pVec(px, py, pz);
+}
+
+/// Writes a vector of three normal random numbers with standard deviation sigma to each of v[0 .. n), drawing vector i from stream i of R.
+/// Works like pNRandN, with the three numbers of each vector coming from one block of its stream.
+PINLINE void pNRandVecN(pVec* v, const size_t n, const pRandBatch_t& R, const float sigma = 1.0f)
+{
+    const pZiggurat_t& Z = pZigguratTables();
+    for (size_t i0 = 0; i0 < n; i0 += 64) {
+        const size_t m = n - i0 < 64 ? n - i0 : 64;
+        bool miss[64];
+        for (size_t j = 0; j < m; j++) {
+            uint32_t u[4];
+            float x, y, z;
+            R.Bits4(i0 + j, 0, u);
+            miss[j] = !(Z.Fast(u[0], x) & Z.Fast(u[1], y) & Z.Fast(u[2], z));
+            v[i0 + j] = pVec(x, y, z);
+        }
+        for (size_t j = 0; j < m; j++) {
+            pVec& p = v[i0 + j];
+            if (miss[j]) {
+                uint32_t u[4];
+                float x[3];
+                R.Bits4(i0 + j, 0, u);
+                for (uint32_t c = 0; c < 3; c++)
+                    if (!Z.Fast(u[c], x[c])) x[c] = pNRandSlow(Z, R, i0 + j, c);
+                p = pVec(x[0], x[1], x[2]);
+            }
+            p *= sigma;
+        }
+    }
 }
 }; // namespace PAPI
 
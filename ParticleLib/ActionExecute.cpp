@@ -11,21 +11,185 @@
 #include "Particle/pActionImpls.h"
 
 #include <algorithm>
+#include <atomic>
 #include <execution>
+#include <numeric>
 #include <sstream>
 #include <string>
-#include <typeinfo>
+#include <variant>
+#include <vector>
 
-// Remove these if not C++17.
-// #define P_EXPOL std::execution::par_unseq
+// The policy of the algorithms that don't run through ForEachAdaptive(). Remove this if not C++17.
 #define P_EXPOL std::execution::seq
 
-// For some reason most actions are slower with par_unseq. Use the following on the ones that get a speedup.
-// #define P_EXPOLP std::execution::seq
-#define P_EXPOLP std::execution::par_unseq
-
 namespace PAPI {
 
+namespace {
+// Particles per batch of the actions that call pDomain::GenerateN and WithinN. Each batch's points and flags live on the stack.
+const size_t P_DOMAIN_BATCH = 256;
+
+// Particles per tile of a PAFused. Each action of the PAFused is applied to a whole tile before the next action is.
+const size_t P_FUSED_TILE = 64;
+
+// Loops whose serial time is predicted to be less than this many nanoseconds run serially. Waking the scheduler's threads would cost more.
+const float P_PARALLEL_MIN_NS = 100000.f;
+
+// How many nanoseconds each task of a parallel loop should take, so that scheduling it costs little in comparison
+const float P_TASK_NS = 20000.f;
+
+// The fewest particles in a task of a parallel loop, and in a loop whose time is used to measure the cost of an action
+const size_t P_MIN_GRAIN = 256;
+
+// Call f(i) for each i in [0, n), where item i covers per_item particles. The items run serially or as tasks of the group's scheduler,
+// whichever the measured cost of A predicts is faster, and their thread time measures the cost again. Serial if A has no cost.
+template <class F> void ForEachAdaptive(PActionBase& A, ParticleGroup& group, const size_t n, const size_t per_item, F f)
+{
+    if (n == 0) return;
+
+    ActionCost_t* C = A.cost;
+    pScheduler_t& S = group.GetScheduler();
+    const size_t grain = C ? C->Grain(n * per_item, S.ThreadCount()) / per_item : 0;
+
+    if (grain == 0) {
+        const int64_t t0 = C ? NowNs() : 0;
+        for (size_t i = 0; i < n; i++) f(i);
+        if (C) C->Record(n * per_item, double(NowNs() - t0), 0);
+        return;
+    }
+
+    std::atomic<int64_t> ns{0};
+    S.ParallelFor(n, grain, [&](size_t b, size_t e) {
+        const int64_t t0 = NowNs();
+        for (size_t i = b; i < e; i++) f(i);
+        ns.fetch_add(NowNs() - t0, std::memory_order_relaxed);
+    });
+    C->Record(n * per_item, (double)ns.load(), grain * per_item);
+}
+
+// Call f on each particle of [ibegin, iend), serially or in parallel as A's cost says
+template <class F> void ForEachParticle(PActionBase& A, ParticleGroup& group, ParticleList::iterator ibegin, ParticleList::iterator iend, F f)
+{
+    ForEachAdaptive(A, group, iend - ibegin, 1, [&](const size_t i) { f(ibegin[i]); });
+}
+
+// Call f on each block of [bbegin, bend), serially or in parallel as A's cost says
+template <class F> void ForEachBlock(PActionBase& A, ParticleGroup& group, ParticleBlock_t* bbegin, ParticleBlock_t* bend, F f)
+{
+    ForEachAdaptive(A, group, bend - bbegin, P_BLOCK_WIDTH, [&](const size_t i) { f(bbegin[i]); });
+}
+
+// Call f(m, first, count) for each batch of the particles in [ibegin, iend), serially or in parallel as A's cost says. m points to the batch's
+// count particles, and first is the index in the group of m[0], which keys the batch's random streams.
+template <class F> void ForEachBatch(PActionBase& A, ParticleGroup& group, ParticleList::iterator ibegin, ParticleList::iterator iend, F f)
+{
+    if (ibegin == iend) return;
+
+    const size_t n = iend - ibegin, first = group.IndexOf(*ibegin);
+    ForEachAdaptive(A, group, (n + P_DOMAIN_BATCH - 1) / P_DOMAIN_BATCH, P_DOMAIN_BATCH, [&](const size_t b) {
+        size_t k = b * P_DOMAIN_BATCH;
+        f(&ibegin[k], first + k, std::min(P_DOMAIN_BATCH, n - k));
+    });
+}
+
+// Generate a point of dom for each of the count particles at m and store it in attribute A
+template <class D> PINLINE void GenerateAttr(Particle_t* m, const size_t count, const D& dom, const pRandBatch_t& R, pVec Particle_t::*A)
+{
+    pVec v[P_DOMAIN_BATCH];
+    dom.GenerateN(v, count, R);
+    for (size_t i = 0; i < count; i++) m[i].*A = v[i];
+}
+
+// Fill v with a point of dom for each of the count particles, calling the GenerateN of dom's concrete type
+PINLINE void GenerateN(const pDomainVariant_t& dom, pVec* v, const size_t count, const pRandBatch_t& R)
+{
+    std::visit([&](const auto& D) { D.GenerateN(v, count, R); }, dom);
+}
+
+// Test whether each of the count points in v is within dom, calling the WithinN of dom's concrete type
+PINLINE void WithinN(const pDomainVariant_t& dom, const pVec* v, const size_t count, bool* within, const pRandBatch_t& R)
+{
+    std::visit([&](const auto& D) { D.WithinN(v, count, within, R); }, dom);
+}
+
+// Approaching t1 by fraction a and then t2 by fraction b is the same as approaching (t1 a (1 - b) + t2 b) / k by fraction k = a + b - a b.
+// Returns false if k is 0, so the pair can't be written as one approach.
+template <class T> bool MergeTargets(T& t1, float& a, const T& t2, const float b)
+{
+    const float k = a + b - a * b;
+    if (k == 0.f) return false;
+
+    t1 = (t1 * (a * (1.f - b)) + t2 * b) / k;
+    a = k;
+    return true;
+}
+
+// Damping that applies at every speed
+template <class S> bool DampsAllSpeeds(const S& D) { return D.min_vel_sqr <= 0.f && D.max_vel_sqr >= fsqr(P_MAXFLOAT); }
+
+// Fold instruction t of a PAFused program into the instruction s before it where the pair can be done as one instruction for this dt
+bool MergeFusedSteps(pFusedStep_t& s, const pFusedStep_t& t)
+{
+    if (PAGravity_Prep* A = std::get_if<PAGravity_Prep>(&s)) {
+        if (const PAGravity_Prep* B = std::get_if<PAGravity_Prep>(&t)) {
+            A->ddir += B->ddir;
+            return true;
+        }
+    } else if (PADamping_Prep* A = std::get_if<PADamping_Prep>(&s)) {
+        if (const PADamping_Prep* B = std::get_if<PADamping_Prep>(&t); B && DampsAllSpeeds(*A) && DampsAllSpeeds(*B)) {
+            A->scale = CompMult(A->scale, B->scale);
+            return true;
+        }
+    } else if (PARotDamping_Prep* A = std::get_if<PARotDamping_Prep>(&s)) {
+        if (const PARotDamping_Prep* B = std::get_if<PARotDamping_Prep>(&t); B && DampsAllSpeeds(*A) && DampsAllSpeeds(*B)) {
+            A->scale = CompMult(A->scale, B->scale);
+            return true;
+        }
+    } else if (PATargetColor_Prep* A = std::get_if<PATargetColor_Prep>(&s)) {
+        if (const PATargetColor_Prep* B = std::get_if<PATargetColor_Prep>(&t)) {
+            float a = A->scaleFac;
+            if (!MergeTargets(A->alpha, a, B->alpha, B->scaleFac)) return false;
+            return MergeTargets(A->color, A->scaleFac, B->color, B->scaleFac);
+        }
+    } else if (PATargetVelocity_Prep* A = std::get_if<PATargetVelocity_Prep>(&s)) {
+        if (const PATargetVelocity_Prep* B = std::get_if<PATargetVelocity_Prep>(&t)) return MergeTargets(A->velocity, A->scaleFac, B->velocity, B->scaleFac);
+    } else if (PATargetRotVelocity_Prep* A = std::get_if<PATargetRotVelocity_Prep>(&s)) {
+        if (const PATargetRotVelocity_Prep* B = std::get_if<PATargetRotVelocity_Prep>(&t))
+            return MergeTargets(A->rot_velocity, A->scaleFac, B->rot_velocity, B->scaleFac);
+    }
+
+    return false;
+}
+} // namespace
+
+size_t ActionCost_t::Grain(const size_t n, const int threads) const
+{
+    const float c = ns_per_particle.load(std::memory_order_relaxed);
+    if (threads <= 1 || c <= 0.f || c * n < P_PARALLEL_MIN_NS) return 0;
+
+    const size_t g = std::max(P_MIN_GRAIN, std::min((size_t)(P_TASK_NS / c), n / (4 * threads)));
+    return g < n ? g : 0;
+}
+
+size_t ActionCost_t::MinParallelParticles() const
+{
+    const float c = ns_per_particle.load(std::memory_order_relaxed);
+    return c > 0.f ? size_t(P_PARALLEL_MIN_NS / c) + 1 : 0;
+}
+
+void ActionCost_t::Record(const size_t n, const double ns, const size_t grain_)
+{
+    calls.fetch_add(1, std::memory_order_relaxed);
+    particles.fetch_add(n, std::memory_order_relaxed);
+    if (grain_) {
+        parallel_calls.fetch_add(1, std::memory_order_relaxed);
+        grain.store(grain_, std::memory_order_relaxed);
+    }
+    if (n < P_MIN_GRAIN) return; // Too few to time reliably
+
+    const float m = float(ns / n), c = ns_per_particle.load(std::memory_order_relaxed);
+    ns_per_particle.store(c == 0.f ? m : c + (m - c) * 0.125f, std::memory_order_relaxed);
+}
+
 std::string PActionBase::name = "PActionBase";
 std::string PActionBase::abrv = "XXX";
 
@@ -45,6 +209,8 @@ std::string PADamping::abrv = "Da";
 std::string PADamping::name = "PADamping";
 std::string PAExplosion::abrv = "Ex";
 std::string PAExplosion::name = "PAExplosion";
+std::string PAFused::abrv = "Fu";
+std::string PAFused::name = "PAFused";
 std::string PAFollow::abrv = "Fo";
 std::string PAFollow::name = "PAFollow";
 std::string PAGravitate::abrv = "Gre";
@@ -100,47 +266,33 @@ std::string PAVortex::name = "PAVortex";
 
 void PAAvoid::Exec(const PDTriangle& dom, ParticleGroup& group, ParticleList::iterator ibegin, ParticleList::iterator iend)
 {
-    std::for_each(P_EXPOLP, ibegin, iend, [&](Particle_t& m) { PAAvoidTriangle_Impl(m, dt, dom, look_ahead, magnitude, epsilon); });
+    ForEachParticle(*this, group, ibegin, iend, [&](Particle_t& m) { PAAvoidTriangle_Impl(m, dt, dom, look_ahead, magnitude, epsilon); });
 }
 
 void PAAvoid::Exec(const PDRectangle& dom, ParticleGroup& group, ParticleList::iterator ibegin, ParticleList::iterator iend)
 {
-    std::for_each(P_EXPOLP, ibegin, iend, [&](Particle_t& m) { PAAvoidRectangle_Impl(m, dt, dom, look_ahead, magnitude, epsilon); });
+    ForEachParticle(*this, group, ibegin, iend, [&](Particle_t& m) { PAAvoidRectangle_Impl(m, dt, dom, look_ahead, magnitude, epsilon); });
 }
 
 void PAAvoid::Exec(const PDPlane& dom, ParticleGroup& group, ParticleList::iterator ibegin, ParticleList::iterator iend)
 {
-    std::for_each(P_EXPOLP, ibegin, iend, [&](Particle_t& m) { PAAvoidPlane_Impl(m, dt, dom, look_ahead, magnitude, epsilon); });
+    ForEachParticle(*this, group, ibegin, iend, [&](Particle_t& m) { PAAvoidPlane_Impl(m, dt, dom, look_ahead, magnitude, epsilon); });
 }
 
 // Only works for points on the OUTSIDE of the sphere. Ignores inner radius.
 void PAAvoid::Exec(const PDSphere& dom, ParticleGroup& group, ParticleList::iterator ibegin, ParticleList::iterator iend)
 {
-    std::for_each(P_EXPOLP, ibegin, iend, [&](Particle_t& m) { PAAvoidSphere_Impl(m, dt, dom, look_ahead, magnitude, epsilon); });
+    ForEachParticle(*this, group, ibegin, iend, [&](Particle_t& m) { PAAvoidSphere_Impl(m, dt, dom, look_ahead, magnitude, epsilon); });
 }
 
 void PAAvoid::Exec(const PDDisc& dom, ParticleGroup& group, ParticleList::iterator ibegin, ParticleList::iterator iend)
 {
-    std::for_each(P_EXPOLP, ibegin, iend, [&](Particle_t& m) { PAAvoidDisc_Impl(m, dt, dom, look_ahead, magnitude, epsilon); });
+    ForEachParticle(*this, group, ibegin, iend, [&](Particle_t& m) { PAAvoidDisc_Impl(m, dt, dom, look_ahead, magnitude, epsilon); });
 }
 
 void PAAvoid::Execute(ParticleGroup& group, ParticleList::iterator ibegin, ParticleList::iterator iend)
 {
-    switch (position->Which) {
-    // case PDBlob_e: Exec(*dynamic_cast<const PDBlob_e*>(position.get()), group, ibegin, iend); return;
-    // case PDBox_e: Exec(*dynamic_cast<const PDBox_e*>(position.get()), group, ibegin, iend); return;
-    // case PDCone_e: Exec(*dynamic_cast<const PDCone_e*>(position.get()), group, ibegin, iend); return;
-    // case PDCylinder_e: Exec(*dynamic_cast<const PDCylinder_e*>(position.get()), group, ibegin, iend); return;
-    // case PDLine_e: Exec(*dynamic_cast<const PDLine_e*>(position.get()), group, ibegin, iend); return;
-    // case PDPoint_e: Exec(*dynamic_cast<const PDPoint_e*>(position.get()), group, ibegin, iend); return;
-    // case PDUnion_e: Exec(*dynamic_cast<const PDUnion_e*>(position.get()), group, ibegin, iend); return;
-    case PDDisc_e: Exec(*dynamic_cast<const PDDisc*>(position.get()), group, ibegin, iend); return;
-    case PDPlane_e: Exec(*dynamic_cast<const PDPlane*>(position.get()), group, ibegin, iend); return;
-    case PDRectangle_e: Exec(*dynamic_cast<const PDRectangle*>(position.get()), group, ibegin, iend); return;
-    case PDSphere_e: Exec(*dynamic_cast<const PDSphere*>(position.get()), group, ibegin, iend); return;
-    case PDTriangle_e: Exec(*dynamic_cast<const PDTriangle*>(position.get()), group, ibegin, iend); return;
-    default: throw PErrNotImplemented(std::string("Avoid not implemented for domain ") + std::string(typeid(position.get()).name()));
-    }
+    std::visit([&](const auto& dom) { Exec(dom, group, ibegin, iend); }, position);
 }
 
 // Bounce() doesn't work correctly with small time step sizes for particles sliding along a surface.
@@ -153,172 +305,465 @@ void PAAvoid::Execute(ParticleGroup& group, ParticleList::iterator ibegin, Parti
 // the whole velocity in the outward direction for the whole time step.
 void PABounce::Exec(const PDTriangle& dom, ParticleGroup& group, ParticleList::iterator ibegin, ParticleList::iterator iend)
 {
-    std::for_each(P_EXPOL, ibegin, iend, [&](Particle_t& m) { PABounceTriangle_Impl(m, dt, dom, friction, resilience, fric_min_vel); });
+    const PABounceParams_t B(dt, friction, resilience, fric_min_vel);
+    ForEachParticle(*this, group, ibegin, iend, [&](Particle_t& m) { PABounceTriangle_Impl(m, dom, B); });
 }
 
 void PABounce::Exec(const PDRectangle& dom, ParticleGroup& group, ParticleList::iterator ibegin, ParticleList::iterator iend)
 {
-    std::for_each(P_EXPOL, ibegin, iend, [&](Particle_t& m) { PABounceRectangle_Impl(m, dt, dom, friction, resilience, fric_min_vel); });
+    const PABounceParams_t B(dt, friction, resilience, fric_min_vel);
+    ForEachParticle(*this, group, ibegin, iend, [&](Particle_t& m) { PABounceRectangle_Impl(m, dom, B); });
 }
 
 void PABounce::Exec(const PDBox& dom, ParticleGroup& group, ParticleList::iterator ibegin, ParticleList::iterator iend)
 {
-    std::for_each(P_EXPOL, ibegin, iend, [&](Particle_t& m) { PABounceBox_Impl(m, dt, dom, friction, resilience, fric_min_vel); });
+    const PABounceParams_t B(dt, friction, resilience, fric_min_vel);
+    ForEachParticle(*this, group, ibegin, iend, [&](Particle_t& m) { PABounceBox_Impl(m, dom, B); });
 }
 
 void PABounce::Exec(const PDPlane& dom, ParticleGroup& group, ParticleList::iterator ibegin, ParticleList::iterator iend)
 {
-    std::for_each(P_EXPOL, ibegin, iend, [&](Particle_t& m) { PABouncePlane_Impl(m, dt, dom, friction, resilience, fric_min_vel); });
+    const PABounceParams_t B(dt, friction, resilience, fric_min_vel);
+    ForEachParticle(*this, group, ibegin, iend, [&](Particle_t& m) { PABouncePlane_Impl(m, dom, B); });
 }
 
 void PABounce::Exec(const PDSphere& dom, ParticleGroup& group, ParticleList::iterator ibegin, ParticleList::iterator iend)
 {
     LIB_ASSERT(dom.radIn == 0.0f, "Bouncing doesn't work on thick shells. radIn must be 0.");
 
-    std::for_each(P_EXPOL, ibegin, iend, [&](Particle_t& m) { PABounceSphere_Impl(m, dt, dom, friction, resilience, fric_min_vel); });
+    const PABounceParams_t B(dt, friction, resilience, fric_min_vel);
+    ForEachParticle(*this, group, ibegin, iend, [&](Particle_t& m) { PABounceSphere_Impl(m, dom, B); });
 }
 
 void PABounce::Exec(const PDDisc& dom, ParticleGroup& group, ParticleList::iterator ibegin, ParticleList::iterator iend)
 {
-    std::for_each(P_EXPOL, ibegin, iend, [&](Particle_t& m) { PABounceDisc_Impl(m, dt, dom, friction, resilience, fric_min_vel); });
+    const PABounceParams_t B(dt, friction, resilience, fric_min_vel);
+    ForEachParticle(*this, group, ibegin, iend, [&](Particle_t& m) { PABounceDisc_Impl(m, dom, B); });
 }
 
 void PABounce::Execute(ParticleGroup& group, ParticleList::iterator ibegin, ParticleList::iterator iend)
 {
-    switch (position->Which) {
-    // case PDBlob_e: Exec(*dynamic_cast<const PDBlob*>(position.get()), group, ibegin, iend); return;
-    // case PDCone_e: Exec(*dynamic_cast<const PDCone*>(position.get()), group, ibegin, iend); return;
-    // case PDCylinder_e: Exec(*dynamic_cast<const PDCylinder*>(position.get()), group, ibegin, iend); return;
-    // case PDLine_e: Exec(*dynamic_cast<const PDLine*>(position.get()), group, ibegin, iend); return;
-    // case PDPoint_e: Exec(*dynamic_cast<const PDPoint*>(position.get()), group, ibegin, iend); return;
-    // case PDUnion_e: Exec(*dynamic_cast<const PDUnion*>(position.get()), group, ibegin, iend); return;
-    case PDBox_e: Exec(*dynamic_cast<const PDBox*>(position.get()), group, ibegin, iend); return;
-    case PDDisc_e: Exec(*dynamic_cast<const PDDisc*>(position.get()), group, ibegin, iend); return;
-    case PDPlane_e: Exec(*dynamic_cast<const PDPlane*>(position.get()), group, ibegin, iend); return;
-    case PDRectangle_e: Exec(*dynamic_cast<const PDRectangle*>(position.get()), group, ibegin, iend); return;
-    case PDSphere_e: Exec(*dynamic_cast<const PDSphere*>(position.get()), group, ibegin, iend); return;
-    case PDTriangle_e: Exec(*dynamic_cast<const PDTriangle*>(position.get()), group, ibegin, iend); return;
-    default: throw PErrNotImplemented(std::string("Bounce not implemented for domain ") + std::string(typeid(position.get()).name()));
-    }
+    std::visit([&](const auto& dom) { Exec(dom, group, ibegin, iend); }, position);
+}
+
+bool PABounce::Fuse(std::vector<pFusedStep_t>* steps)
+{
+    return std::visit(
+        [&](const auto& dom) {
+            typedef std::decay_t<decltype(dom)> D;
+            if constexpr (std::is_constructible_v<pFusedStep_t, PABounce_Prep<D>>) {
+                if (steps) steps->push_back(PABounce_Prep<D>(dt, dom, friction, resilience, fric_min_vel));
+                return true;
+            } else
+                return false; // Bounce() rejects these domains.
+        },
+        position);
 }
 
 // Set the secondary position and velocity from current.
 void PACopyVertexB::Execute(ParticleGroup& group, ParticleList::iterator ibegin, ParticleList::iterator iend)
 {
-    std::for_each(P_EXPOL, ibegin, iend, [&](Particle_t& m) { PACopyVertexB_Impl(m, dt, copy_pos, copy_vel); });
+    ForEachParticle(*this, group, ibegin, iend, [&](Particle_t& m) { PACopyVertexB_Impl(m, dt, copy_pos, copy_vel); });
+}
+
+bool PACopyVertexB::ExecuteBlocks(ParticleGroup& pg, ParticleBlock_t* bbegin, ParticleBlock_t* bend)
+{
+    ForEachBlock(*this, pg, bbegin, bend, [&](ParticleBlock_t& b) { PACopyVertexB_Block(b, dt, copy_pos, copy_vel); });
+    return true;
+}
+
+bool PACopyVertexB::Fuse(std::vector<pFusedStep_t>* steps)
+{
+    if (steps) steps->push_back(PACopyVertexB_Prep(dt, copy_pos, copy_vel));
+    return true;
 }
 
 // Dampen velocities
 void PADamping::Execute(ParticleGroup& group, ParticleList::iterator ibegin, ParticleList::iterator iend)
 {
-    std::for_each(P_EXPOL, ibegin, iend, [&](Particle_t& m) { PADamping_Impl(m, dt, damping, min_vel, max_vel); });
+    const PADamping_Prep prep(dt, damping, min_vel, max_vel);
+    ForEachParticle(*this, group, ibegin, iend, [&](Particle_t& m) { prep.Apply(m); });
+}
+
+bool PADamping::ExecuteBlocks(ParticleGroup& pg, ParticleBlock_t* bbegin, ParticleBlock_t* bend)
+{
+    ForEachBlock(*this, pg, bbegin, bend, [&](ParticleBlock_t& b) { PADamping_Block(b, dt, damping, min_vel, max_vel); });
+    return true;
+}
+
+bool PADamping::Fuse(std::vector<pFusedStep_t>* steps)
+{
+    if (steps) steps->push_back(PADamping_Prep(dt, damping, min_vel, max_vel));
+    return true;
 }
 
 // Dampen rotational velocities
 void PARotDamping::Execute(ParticleGroup& group, ParticleList::iterator ibegin, ParticleList::iterator iend)
 {
-    std::for_each(P_EXPOL, ibegin, iend, [&](Particle_t& m) { PARotDamping_Impl(m, dt, damping, min_vel, max_vel); });
+    const PARotDamping_Prep prep(dt, damping, min_vel, max_vel);
+    ForEachParticle(*this, group, ibegin, iend, [&](Particle_t& m) { prep.Apply(m); });
+}
+
+bool PARotDamping::ExecuteBlocks(ParticleGroup& pg, ParticleBlock_t* bbegin, ParticleBlock_t* bend)
+{
+    ForEachBlock(*this, pg, bbegin, bend, [&](ParticleBlock_t& b) { PARotDamping_Block(b, dt, damping, min_vel, max_vel); });
+    return true;
+}
+
+bool PARotDamping::Fuse(std::vector<pFusedStep_t>* steps)
+{
+    if (steps) steps->push_back(PARotDamping_Prep(dt, damping, min_vel, max_vel));
+    return true;
 }
 
 // Exert force on each particle away from explosion center
 void PAExplosion::Execute(ParticleGroup& group, ParticleList::iterator ibegin, ParticleList::iterator iend)
 {
-    std::for_each(P_EXPOL, ibegin, iend, [&](Particle_t& m) { PAExplosion_Impl(m, dt, center, radius, magnitude, stdev, epsilon); });
+    const PAExplosion_Prep prep(dt, center, radius, magnitude, stdev, epsilon);
+    ForEachParticle(*this, group, ibegin, iend, [&](Particle_t& m) { prep.Apply(m); });
+}
+
+bool PAExplosion::ExecuteBlocks(ParticleGroup& pg, ParticleBlock_t* bbegin, ParticleBlock_t* bend)
+{
+    ForEachBlock(*this, pg, bbegin, bend, [&](ParticleBlock_t& b) { PAExplosion_Block(b, dt, center, radius, magnitude, stdev, epsilon); });
+    return true;
+}
+
+bool PAExplosion::Fuse(std::vector<pFusedStep_t>* steps)
+{
+    if (steps) steps->push_back(PAExplosion_Prep(dt, center, radius, magnitude, stdev, epsilon));
+    return true;
+}
+
+// The instructions' parameters are prepared for dt here, so adjacent instructions can be folded into one for this dt.
+void PAFused::Lower()
+{
+    std::vector<pFusedStep_t> steps;
+    steps.reserve(actions.size());
+    for (auto& A : actions) A->Fuse(&steps);
+
+    program.clear();
+    for (const pFusedStep_t& step : steps)
+        if (program.empty() || !MergeFusedSteps(program.back(), step)) program.push_back(step);
+    program_dt = actions.front()->dt;
+}
+
+// The instructions' parameters depend on dt
+void PAFused::Prepare()
+{
+    if (program.empty() || actions.front()->dt != program_dt) Lower();
+}
+
+// Interpret the program on each tile of P_FUSED_TILE particles in turn. The tile stays in L1 cache from one instruction to the next, and
+// the switch on each instruction's type is made once per tile, so the compiler can vectorize each instruction's loop over the tile.
+void PAFused::Apply(ParticleList::iterator ibegin, ParticleList::iterator iend, const size_t first, KillBitmap_t* kills)
+{
+    const size_t n = iend - ibegin;
+    for (size_t k = 0; k < n; k += P_FUSED_TILE) {
+        Particle_t* m = &ibegin[k];
+        const size_t count = std::min(P_FUSED_TILE, n - k);
+        for (const pFusedStep_t& step : program) {
+            std::visit(
+                [&](const auto& S) {
+                    if constexpr (std::is_same_v<std::decay_t<decltype(S)>, PAKillOld_Prep>) {
+                        for (size_t i = 0; i < count; i++)
+                            if (S.Kills(m[i])) kills->Set(first + k + i);
+                    } else {
+                        for (size_t i = 0; i < count; i++) S.Apply(m[i]);
+                    }
+                },
+                step);
+        }
+    }
+}
+
+void PAFused::Execute(ParticleGroup& group, ParticleList::iterator ibegin, ParticleList::iterator iend)
+{
+    if (ibegin == iend) return;
+
+    if (GetKillsParticles()) {
+        LIB_ASSERT(ibegin == group.begin() && iend == group.end(), "Can only be done on whole list");
+
+        TagKills(group, ibegin, iend, 0);
+        group.CommitKills();
+    } else
+        ApplyTiles(group, ibegin, iend, group.IndexOf(*ibegin), NULL);
+}
+
+void PAFused::TagKills(ParticleGroup& group, ParticleList::iterator ibegin, ParticleList::iterator iend, const size_t first)
+{
+    ApplyTiles(group, ibegin, iend, first, &group.GetKills());
+}
+
+// Apply the program to the tiles of [ibegin, iend), serially or in parallel as the cost of fused actions says. A list that fuses into one
+// PAFused runs it on the whole group, so this is where its particles are split among the scheduler's threads.
+void PAFused::ApplyTiles(ParticleGroup& group, ParticleList::iterator ibegin, ParticleList::iterator iend, const size_t first, KillBitmap_t* kills)
+{
+    const size_t n = iend - ibegin;
+    ForEachAdaptive(*this, group, (n + P_FUSED_TILE - 1) / P_FUSED_TILE, P_FUSED_TILE, [&](const size_t t) {
+        const size_t k = t * P_FUSED_TILE;
+        Apply(ibegin + k, ibegin + std::min(n, k + P_FUSED_TILE), first + k, kills);
+    });
 }
 
 // Acceleration in a constant direction
 void PAGravity::Execute(ParticleGroup& group, ParticleList::iterator ibegin, ParticleList::iterator iend)
 {
-    std::for_each(P_EXPOL, ibegin, iend, [&](Particle_t& m) { PAGravity_Impl(m, dt, direction); });
+    const PAGravity_Prep prep(dt, direction);
+    ForEachParticle(*this, group, ibegin, iend, [&](Particle_t& m) { prep.Apply(m); });
+}
+
+bool PAGravity::ExecuteBlocks(ParticleGroup& pg, ParticleBlock_t* bbegin, ParticleBlock_t* bend)
+{
+    ForEachBlock(*this, pg, bbegin, bend, [&](ParticleBlock_t& b) { PAGravity_Block(b, dt, direction); });
+    return true;
+}
+
+bool PAGravity::Fuse(std::vector<pFusedStep_t>* steps)
+{
+    if (steps) steps->push_back(PAGravity_Prep(dt, direction));
+    return true;
 }
 
 // For particles in the domain of influence, accelerate them with a domain.
 void PAJet::Execute(ParticleGroup& group, ParticleList::iterator ibegin, ParticleList::iterator iend)
 {
-    std::for_each(P_EXPOL, ibegin, iend, [&](Particle_t& m) { PAJet_Impl(m, dt, *dom, *acc); });
+    ForEachBatch(*this, group, ibegin, iend, [&](Particle_t* m, const size_t first, const size_t count) {
+        pVec pos[P_DOMAIN_BATCH], accel[P_DOMAIN_BATCH];
+        bool within[P_DOMAIN_BATCH];
+        for (size_t i = 0; i < count; i++) pos[i] = m[i].pos;
+        WithinN(dom, pos, count, within, Batch(first).Sub(1));
+        GenerateN(acc, accel, count, Batch(first));
+        for (size_t i = 0; i < count; i++)
+            if (within[i]) m[i].vel += accel[i] * dt;
+    });
 }
 
 // Apply the particles' velocities to their positions, and age the particles
 void PAMove::Execute(ParticleGroup& group, ParticleList::iterator ibegin, ParticleList::iterator iend)
 {
-    std::for_each(P_EXPOL, ibegin, iend, [&](Particle_t& m) { PAMove_Impl(m, dt, move_velocity, move_rotational_velocity); });
+    ForEachParticle(*this, group, ibegin, iend, [&](Particle_t& m) { PAMove_Impl(m, dt, move_velocity, move_rotational_velocity); });
+}
+
+bool PAMove::ExecuteBlocks(ParticleGroup& pg, ParticleBlock_t* bbegin, ParticleBlock_t* bend)
+{
+    ForEachBlock(*this, pg, bbegin, bend, [&](ParticleBlock_t& b) { PAMove_Block(b, dt, move_velocity, move_rotational_velocity); });
+    return true;
+}
+
+bool PAMove::Fuse(std::vector<pFusedStep_t>* steps)
+{
+    if (steps) steps->push_back(PAMove_Prep(dt, move_velocity, move_rotational_velocity));
+    return true;
 }
 
 // Accelerate particles towards a line
 void PAOrbitLine::Execute(ParticleGroup& group, ParticleList::iterator ibegin, ParticleList::iterator iend)
 {
-    std::for_each(P_EXPOL, ibegin, iend, [&](Particle_t& m) { PAOrbitLine_Impl(m, dt, p, axis, magnitude, epsilon, max_radius); });
+    const PAOrbitLine_Prep prep(dt, p, axis, magnitude, epsilon, max_radius);
+    ForEachParticle(*this, group, ibegin, iend, [&](Particle_t& m) { prep.Apply(m); });
+}
+
+bool PAOrbitLine::ExecuteBlocks(ParticleGroup& pg, ParticleBlock_t* bbegin, ParticleBlock_t* bend)
+{
+    ForEachBlock(*this, pg, bbegin, bend, [&](ParticleBlock_t& b) { PAOrbitLine_Block(b, dt, p, axis, magnitude, epsilon, max_radius); });
+    return true;
+}
+
+bool PAOrbitLine::Fuse(std::vector<pFusedStep_t>* steps)
+{
+    if (steps) steps->push_back(PAOrbitLine_Prep(dt, p, axis, magnitude, epsilon, max_radius));
+    return true;
 }
 
 // Accelerate particles towards a point
 void PAOrbitPoint::Execute(ParticleGroup& group, ParticleList::iterator ibegin, ParticleList::iterator iend)
 {
-    std::for_each(P_EXPOL, ibegin, iend, [&](Particle_t& m) { PAOrbitPoint_Impl(m, dt, center, magnitude, epsilon, max_radius); });
+    const PAOrbitPoint_Prep prep(dt, center, magnitude, epsilon, max_radius);
+    ForEachParticle(*this, group, ibegin, iend, [&](Particle_t& m) { prep.Apply(m); });
+}
+
+bool PAOrbitPoint::ExecuteBlocks(ParticleGroup& pg, ParticleBlock_t* bbegin, ParticleBlock_t* bend)
+{
+    ForEachBlock(*this, pg, bbegin, bend, [&](ParticleBlock_t& b) { PAOrbitPoint_Block(b, dt, center, magnitude, epsilon, max_radius); });
+    return true;
+}
+
+bool PAOrbitPoint::Fuse(std::vector<pFusedStep_t>* steps)
+{
+    if (steps) steps->push_back(PAOrbitPoint_Prep(dt, center, magnitude, epsilon, max_radius));
+    return true;
 }
 
 // Accelerate in random direction each time step
 void PARandomAccel::Execute(ParticleGroup& group, ParticleList::iterator ibegin, ParticleList::iterator iend)
 {
-    std::for_each(P_EXPOL, ibegin, iend, [&](Particle_t& m) { PARandomAccel_Impl(m, dt, *gen_acc); });
+    ForEachBatch(*this, group, ibegin, iend, [&](Particle_t* m, const size_t first, const size_t count) {
+        pVec v[P_DOMAIN_BATCH];
+        GenerateN(gen_acc, v, count, Batch(first));
+        for (size_t i = 0; i < count; i++) m[i].vel += v[i] * dt;
+    });
 }
 
 // Immediately displace position randomly
 void PARandomDisplace::Execute(ParticleGroup& group, ParticleList::iterator ibegin, ParticleList::iterator iend)
 {
-    std::for_each(P_EXPOL, ibegin, iend, [&](Particle_t& m) { PARandomDisplace_Impl(m, dt, *gen_disp); });
+    ForEachBatch(*this, group, ibegin, iend, [&](Particle_t* m, const size_t first, const size_t count) {
+        pVec v[P_DOMAIN_BATCH];
+        GenerateN(gen_disp, v, count, Batch(first));
+        for (size_t i = 0; i < count; i++) m[i].pos += v[i] * dt;
+    });
 }
 
 // Immediately assign a random velocity
 void PARandomVelocity::Execute(ParticleGroup& group, ParticleList::iterator ibegin, ParticleList::iterator iend)
 {
-    std::for_each(P_EXPOL, ibegin, iend, [&](Particle_t& m) { PARandomVelocity_Impl(m, dt, *gen_vel); });
+    ForEachBatch(*this, group, ibegin, iend, [&](Particle_t* m, const size_t first, const size_t count) {
+        pVec v[P_DOMAIN_BATCH];
+        GenerateN(gen_vel, v, count, Batch(first));
+        for (size_t i = 0; i < count; i++) m[i].vel = v[i];
+    });
 }
 
 // Immediately assign a random rotational velocity
 void PARandomRotVelocity::Execute(ParticleGroup& group, ParticleList::iterator ibegin, ParticleList::iterator iend)
 {
-    std::for_each(P_EXPOL, ibegin, iend, [&](Particle_t& m) { PARandomRotVelocity_Impl(m, dt, *gen_vel); });
+    ForEachBatch(*this, group, ibegin, iend, [&](Particle_t* m, const size_t first, const size_t count) {
+        pVec v[P_DOMAIN_BATCH];
+        GenerateN(gen_vel, v, count, Batch(first));
+        for (size_t i = 0; i < count; i++) m[i].rvel = v[i];
+    });
 }
 
 // Over time, restore particles to initial positions
 void PARestore::Execute(ParticleGroup& group, ParticleList::iterator ibegin, ParticleList::iterator iend)
 {
-    std::for_each(P_EXPOL, ibegin, iend, [&](Particle_t& m) { PARestore_Impl(m, dt, time_left, restore_velocity, restore_rvelocity); });
+    ForEachParticle(*this, group, ibegin, iend, [&](Particle_t& m) { PARestore_Impl(m, dt, time_left, restore_velocity, restore_rvelocity); });
+}
+
+bool PARestore::ExecuteBlocks(ParticleGroup& pg, ParticleBlock_t* bbegin, ParticleBlock_t* bend)
+{
+    ForEachBlock(*this, pg, bbegin, bend, [&](ParticleBlock_t& b) { PARestore_Block(b, dt, time_left, restore_velocity, restore_rvelocity); });
+    return true;
+}
+
+bool PARestore::Fuse(std::vector<pFusedStep_t>* steps)
+{
+    if (steps) steps->push_back(PARestore_Prep(dt, time_left, restore_velocity, restore_rvelocity));
+    return true;
 }
 
 // Clamp particle velocities to the given range
 void PASpeedClamp::Execute(ParticleGroup& group, ParticleList::iterator ibegin, ParticleList::iterator iend)
 {
-    std::for_each(P_EXPOL, ibegin, iend, [&](Particle_t& m) { PASpeedClamp_Impl(m, dt, min_speed, max_speed); });
+    const PASpeedClamp_Prep prep(dt, min_speed, max_speed);
+    ForEachParticle(*this, group, ibegin, iend, [&](Particle_t& m) { prep.Apply(m); });
+}
+
+bool PASpeedClamp::ExecuteBlocks(ParticleGroup& pg, ParticleBlock_t* bbegin, ParticleBlock_t* bend)
+{
+    ForEachBlock(*this, pg, bbegin, bend, [&](ParticleBlock_t& b) { PASpeedClamp_Block(b, dt, min_speed, max_speed); });
+    return true;
+}
+
+bool PASpeedClamp::Fuse(std::vector<pFusedStep_t>* steps)
+{
+    if (steps) steps->push_back(PASpeedClamp_Prep(dt, min_speed, max_speed));
+    return true;
 }
 
 // Change color of all particles toward the specified color
 void PATargetColor::Execute(ParticleGroup& group, ParticleList::iterator ibegin, ParticleList::iterator iend)
 {
-    std::for_each(P_EXPOL, ibegin, iend, [&](Particle_t& m) { PATargetColor_Impl(m, dt, color, alpha, scale); });
+    const PATargetColor_Prep prep(dt, color, alpha, scale);
+    ForEachParticle(*this, group, ibegin, iend, [&](Particle_t& m) { prep.Apply(m); });
+}
+
+bool PATargetColor::ExecuteBlocks(ParticleGroup& pg, ParticleBlock_t* bbegin, ParticleBlock_t* bend)
+{
+    ForEachBlock(*this, pg, bbegin, bend, [&](ParticleBlock_t& b) { PATargetColor_Block(b, dt, color, alpha, scale); });
+    return true;
+}
+
+bool PATargetColor::Fuse(std::vector<pFusedStep_t>* steps)
+{
+    if (steps) steps->push_back(PATargetColor_Prep(dt, color, alpha, scale));
+    return true;
 }
 
 // Change sizes of all particles toward the specified size
 void PATargetSize::Execute(ParticleGroup& group, ParticleList::iterator ibegin, ParticleList::iterator iend)
 {
-    std::for_each(P_EXPOL, ibegin, iend, [&](Particle_t& m) { PATargetSize_Impl(m, dt, size, scale); });
+    const PATargetSize_Prep prep(dt, size, scale);
+    ForEachParticle(*this, group, ibegin, iend, [&](Particle_t& m) { prep.Apply(m); });
+}
+
+bool PATargetSize::ExecuteBlocks(ParticleGroup& pg, ParticleBlock_t* bbegin, ParticleBlock_t* bend)
+{
+    ForEachBlock(*this, pg, bbegin, bend, [&](ParticleBlock_t& b) { PATargetSize_Block(b, dt, size, scale); });
+    return true;
+}
+
+bool PATargetSize::Fuse(std::vector<pFusedStep_t>* steps)
+{
+    if (steps) steps->push_back(PATargetSize_Prep(dt, size, scale));
+    return true;
 }
 
 // Change velocity of all particles toward the specified velocity
 void PATargetVelocity::Execute(ParticleGroup& group, ParticleList::iterator ibegin, ParticleList::iterator iend)
 {
-    std::for_each(P_EXPOL, ibegin, iend, [&](Particle_t& m) { PATargetVelocity_Impl(m, dt, velocity, scale); });
+    const PATargetVelocity_Prep prep(dt, velocity, scale);
+    ForEachParticle(*this, group, ibegin, iend, [&](Particle_t& m) { prep.Apply(m); });
+}
+
+bool PATargetVelocity::ExecuteBlocks(ParticleGroup& pg, ParticleBlock_t* bbegin, ParticleBlock_t* bend)
+{
+    ForEachBlock(*this, pg, bbegin, bend, [&](ParticleBlock_t& b) { PATargetVelocity_Block(b, dt, velocity, scale); });
+    return true;
+}
+
+bool PATargetVelocity::Fuse(std::vector<pFusedStep_t>* steps)
+{
+    if (steps) steps->push_back(PATargetVelocity_Prep(dt, velocity, scale));
+    return true;
 }
 
 // Change velocity of all particles toward the specified velocity
 void PATargetRotVelocity::Execute(ParticleGroup& group, ParticleList::iterator ibegin, ParticleList::iterator iend)
 {
-    std::for_each(P_EXPOL, ibegin, iend, [&](Particle_t& m) { PATargetRotVelocity_Impl(m, dt, velocity, scale); });
+    const PATargetRotVelocity_Prep prep(dt, velocity, scale);
+    ForEachParticle(*this, group, ibegin, iend, [&](Particle_t& m) { prep.Apply(m); });
+}
+
+bool PATargetRotVelocity::ExecuteBlocks(ParticleGroup& pg, ParticleBlock_t* bbegin, ParticleBlock_t* bend)
+{
+    ForEachBlock(*this, pg, bbegin, bend, [&](ParticleBlock_t& b) { PATargetRotVelocity_Block(b, dt, velocity, scale); });
+    return true;
+}
+
+bool PATargetRotVelocity::Fuse(std::vector<pFusedStep_t>* steps)
+{
+    if (steps) steps->push_back(PATargetRotVelocity_Prep(dt, velocity, scale));
+    return true;
 }
 
 void PAVortex::Execute(ParticleGroup& group, ParticleList::iterator ibegin, ParticleList::iterator iend)
 {
-    std::for_each(P_EXPOL, ibegin, iend, [&](Particle_t& m) { PAVortex_Impl(m, dt, tip, axis, tightnessExponent, max_radius, inSpeed, upSpeed, aroundSpeed); });
+    const PAVortex_Prep prep(dt, tip, axis, tightnessExponent, max_radius, inSpeed, upSpeed, aroundSpeed);
+    ForEachParticle(*this, group, ibegin, iend, [&](Particle_t& m) { prep.Apply(m); });
+}
+
+bool PAVortex::ExecuteBlocks(ParticleGroup& pg, ParticleBlock_t* bbegin, ParticleBlock_t* bend)
+{
+    ForEachBlock(*this, pg, bbegin, bend, [&](ParticleBlock_t& b) { PAVortex_Block(b, dt, tip, axis, tightnessExponent, max_radius, inSpeed, upSpeed, aroundSpeed); });
+    return true;
+}
+
+bool PAVortex::Fuse(std::vector<pFusedStep_t>* steps)
+{
+    if (steps) steps->push_back(PAVortex_Prep(dt, tip, axis, tightnessExponent, max_radius, inSpeed, upSpeed, aroundSpeed));
+    return true;
 }
 
 //////////////////////////////////////////////////////////////////
@@ -330,7 +775,7 @@ void PAFollow::Execute(ParticleGroup& group, ParticleList::iterator ibegin, Part
     LIB_ASSERT(ibegin == group.begin() && iend == group.end(), "Can only be done on whole list");
     if (group.size() < 2) return;
     const Particle_t* endp = &*ibegin + (iend - ibegin);
-    std::for_each(P_EXPOL, ibegin, iend, [&](Particle_t& m) { PAFollow_Impl(m, dt, magnitude, epsilon, max_radius, &*ibegin, endp); });
+    ForEachParticle(*this, group, ibegin, iend, [&](Particle_t& m) { PAFollow_Impl(m, dt, magnitude, epsilon, max_radius, &*ibegin, endp); });
 }
 
 // Inter-particle gravitation
@@ -339,10 +784,10 @@ void PAGravitate::Execute(ParticleGroup& group, ParticleList::iterator ibegin, P
     LIB_ASSERT(ibegin == group.begin() && iend == group.end(), "Can only be done on whole list");
     if (group.size() < 2) return;
     const Particle_t* endp = &*ibegin + (iend - ibegin);
-    std::for_each(P_EXPOL, ibegin, iend, [&](Particle_t& m) { PAGravitate_Impl(m, dt, magnitude, epsilon, max_radius, &*ibegin, endp); });
+    ForEachParticle(*this, group, ibegin, iend, [&](Particle_t& m) { PAGravitate_Impl(m, dt, magnitude, epsilon, max_radius, &*ibegin, endp); });
 }
 
-// Match velocity to near neighbors
+// Match velocity to near neighbors. Serial, since each particle reads the velocities that the particles before it just wrote.
 void PAMatchVelocity::Execute(ParticleGroup& group, ParticleList::iterator ibegin, ParticleList::iterator iend)
 {
     LIB_ASSERT(ibegin == group.begin() && iend == group.end(), "Can only be done on whole list");
@@ -351,7 +796,7 @@ void PAMatchVelocity::Execute(ParticleGroup& group, ParticleList::iterator ibegi
     std::for_each(P_EXPOL, ibegin, iend, [&](Particle_t& m) { PAMatchVelocity_Impl(m, dt, magnitude, epsilon, max_radius, &*ibegin, endp); });
 }
 
-// Match rotational velocity to near neighbors
+// Match rotational velocity to near neighbors. Serial, like PAMatchVelocity.
 void PAMatchRotVelocity::Execute(ParticleGroup& group, ParticleList::iterator ibegin, ParticleList::iterator iend)
 {
     LIB_ASSERT(ibegin == group.begin() && iend == group.end(), "Can only be done on whole list");
@@ -388,39 +833,47 @@ void PACommitKills::Execute(ParticleGroup& group, ParticleList::iterator ibegin,
 {
     LIB_ASSERT(ibegin == group.begin() && iend == group.end(), "Can only be done on whole list");
 
-#if 0
-    // Slower on Fountain and Waterfall and maybe all
-    ParticleList::iterator first_goner = std::partition(P_EXPOLP, ibegin, iend, [](Particle_t& m) { return m.tmp0 != P_MAXFLOAT; });
-    group.RemoveRange(first_goner, iend);
-#else
-    // Must traverse list carefully so Remove will work
-    for (ParticleList::iterator it = ibegin; it != iend;) {
-        Particle_t& m = (*it);
-        if (m.tmp0 == P_MAXFLOAT) {
-            it = group.Remove(it);
-            iend = group.end();
-        } else
-            ++it;
-    }
-
-#endif
+    group.CommitKills();
 }
 
+// The particles were already tagged by inline actions
+void PACommitKills::TagKills(ParticleGroup& group, ParticleList::iterator ibegin, ParticleList::iterator iend, const size_t first) {}
+
 // Get rid of older particles
 void PAKillOld::Execute(ParticleGroup& group, ParticleList::iterator ibegin, ParticleList::iterator iend)
 {
     LIB_ASSERT(ibegin == group.begin() && iend == group.end(), "Can only be done on whole list");
 
-    // Must traverse list carefully so Remove will work
-    for (ParticleList::iterator it = ibegin; it != iend;) {
-        Particle_t& m = (*it);
-        PAKillOld_Impl(m, dt, age_limit, kill_less_than);
-        if (m.tmp0 == P_MAXFLOAT) {
-            it = group.Remove(it);
-            iend = group.end();
-        } else
-            ++it;
-    }
+    TagKills(group, ibegin, iend, 0);
+    group.CommitKills();
+}
+
+void PAKillOld::TagKills(ParticleGroup& group, ParticleList::iterator ibegin, ParticleList::iterator iend, const size_t first)
+{
+    KillBitmap_t& kills = group.GetKills();
+    ForEachParticle(*this, group, ibegin, iend, [&](Particle_t& m) {
+        if (PAKillOld_Impl(m, dt, age_limit, kill_less_than)) kills.Set(first + (&m - &*ibegin));
+    });
+}
+
+bool PAKillOld::ExecuteBlocks(ParticleGroup& group, ParticleBlock_t* bbegin, ParticleBlock_t* bend)
+{
+    KillBitmap_t& kills = group.GetKills();
+    const ParticleBlock_t* blocks = group.GetBlocks();
+    const size_t n = group.size();
+    ForEachBlock(*this, group, bbegin, bend, [&](ParticleBlock_t& b) {
+        size_t first = (&b - blocks) * P_BLOCK_WIDTH;
+        uint64_t mask = PAKillOld_Block(b, dt, age_limit, kill_less_than);
+        if (n - first < P_BLOCK_WIDTH) mask &= (uint64_t(1) << (n - first)) - 1; // Lanes past the end of the group
+        kills.SetBits(first, mask);
+    });
+    return true;
+}
+
+bool PAKillOld::Fuse(std::vector<pFusedStep_t>* steps)
+{
+    if (steps) steps->push_back(PAKillOld_Prep(dt, age_limit, kill_less_than));
+    return true;
 }
 
 // Kill particles with positions on wrong side of the specified domain
@@ -428,17 +881,22 @@ void PASink::Execute(ParticleGroup& group, ParticleList::iterator ibegin, Partic
 {
     LIB_ASSERT(ibegin == group.begin() && iend == group.end(), "Can only be done on whole list");
 
-    // Must traverse list carefully so Remove will work
-    // TODO: Would it be faster to parallelize the loop over the predicate and then do a partition?
-    for (ParticleList::iterator it = ibegin; it != iend;) {
-        Particle_t& m = (*it);
-        PASink_Impl(m, dt, kill_inside, *kill_pos_dom);
-        if (m.tmp0 == P_MAXFLOAT) {
-            it = group.Remove(it);
-            iend = group.end();
-        } else
-            ++it;
-    }
+    TagKills(group, ibegin, iend, 0);
+    group.CommitKills();
+}
+
+void PASink::TagKills(ParticleGroup& group, ParticleList::iterator ibegin, ParticleList::iterator iend, const size_t first)
+{
+    KillBitmap_t& kills = group.GetKills();
+    ForEachBatch(*this, group, ibegin, iend, [&](Particle_t* m, const size_t, const size_t count) {
+        const size_t k = first + (m - &*ibegin); // The tag and random stream index of m[0]
+        pVec v[P_DOMAIN_BATCH];
+        bool within[P_DOMAIN_BATCH];
+        for (size_t i = 0; i < count; i++) v[i] = m[i].pos;
+        WithinN(kill_pos_dom, v, count, within, Batch(k));
+        for (size_t i = 0; i < count; i++)
+            if (within[i] == kill_inside) kills.Set(k + i);
+    });
 }
 
 // Kill particles with velocities on wrong side of the specified domain
@@ -446,16 +904,22 @@ void PASinkVelocity::Execute(ParticleGroup& group, ParticleList::iterator ibegin
 {
     LIB_ASSERT(ibegin == group.begin() && iend == group.end(), "Can only be done on whole list");
 
-    // Must traverse list carefully so Remove will work
-    for (ParticleList::iterator it = ibegin; it != iend;) {
-        Particle_t& m = (*it);
-        PASinkVelocity_Impl(m, dt, kill_inside, *kill_vel_dom);
-        if (m.tmp0 == P_MAXFLOAT) {
-            it = group.Remove(it);
-            iend = group.end();
-        } else
-            ++it;
-    }
+    TagKills(group, ibegin, iend, 0);
+    group.CommitKills();
+}
+
+void PASinkVelocity::TagKills(ParticleGroup& group, ParticleList::iterator ibegin, ParticleList::iterator iend, const size_t first)
+{
+    KillBitmap_t& kills = group.GetKills();
+    ForEachBatch(*this, group, ibegin, iend, [&](Particle_t* m, const size_t, const size_t count) {
+        const size_t k = first + (m - &*ibegin); // The tag and random stream index of m[0]
+        pVec v[P_DOMAIN_BATCH];
+        bool within[P_DOMAIN_BATCH];
+        for (size_t i = 0; i < count; i++) v[i] = m[i].vel;
+        WithinN(kill_vel_dom, v, count, within, Batch(k));
+        for (size_t i = 0; i < count; i++)
+            if (within[i] == kill_inside) kills.Set(k + i);
+    });
 }
 
 // Sort the particles by their projection onto the Look vector
@@ -463,7 +927,12 @@ void PASort::Execute(ParticleGroup& group, ParticleList::iterator ibegin, Partic
 {
     LIB_ASSERT(ibegin == group.begin() && iend == group.end(), "Can only be done on whole list");
 
-    std::for_each(P_EXPOL, ibegin, iend, [&](Particle_t& m) { PASort_Impl(m, dt, Eye, Look, front_to_back, clamp_negative); });
+    // The kill tags are by position, so kill the tagged particles before reordering.
+    group.CommitKills();
+    ibegin = group.begin();
+    iend = group.end();
+
+    ForEachParticle(*this, group, ibegin, iend, [&](Particle_t& m) { PASort_Impl(m, dt, Eye, Look, front_to_back, clamp_negative); });
 
     std::sort(P_EXPOL, ibegin, iend);
 }
@@ -473,12 +942,45 @@ void PASource::Execute(ParticleGroup& group, ParticleList::iterator ibegin, Part
 {
     LIB_ASSERT(ibegin == group.begin() && iend == group.end(), "Can only be done on whole list");
 
-    size_t rate = SourceQuantity(particle_rate, dt, group.size(), group.GetMaxParticles());
-
-    for (size_t i = 0; i < rate; i++) {
-        Particle_t m;
-        PASource_Impl(m, dt, *gen_pos, SrcSt);
-        group.Add(m);
-    }
+    Emit(group);
+    group.MergeEmitted();
+}
+
+// Allocate all the new particles at once and fill them in parallel batches, one GenerateN per attribute per batch. Each particle draws
+// from its own random streams, keyed by the index it will have in the group, so the particles don't depend on how the threads are
+// scheduled. The birth callbacks are then called in order.
+void PASource::Emit(ParticleGroup& group)
+{
+    size_t rate = SourceQuantity(particle_rate, dt, group.size() + group.GetEmitted().size(), group.GetMaxParticles());
+    if (rate == 0) return;
+
+    ParticleList::iterator ibegin = group.EmitN(rate);
+    ForEachBatch(*this, group, ibegin, ibegin + rate, [&](Particle_t* m, const size_t first, const size_t count) {
+        const pRandBatch_t R = Batch(first);
+        std::visit([&](const auto& D) { GenerateAttr(m, count, D, R.Sub(0), &Particle_t::pos); }, gen_pos);
+        if (SrcSt.vertexB_tracks_)
+            for (size_t i = 0; i < count; i++) m[i].posB = m[i].pos;
+        else
+            GenerateAttr(m, count, *SrcSt.VertexB_, R.Sub(1), &Particle_t::posB);
+        GenerateAttr(m, count, *SrcSt.Up_, R.Sub(2), &Particle_t::up);
+        GenerateAttr(m, count, *SrcSt.Vel_, R.Sub(3), &Particle_t::vel);
+        GenerateAttr(m, count, *SrcSt.RotVel_, R.Sub(4), &Particle_t::rvel);
+        GenerateAttr(m, count, *SrcSt.Size_, R.Sub(5), &Particle_t::size);
+        GenerateAttr(m, count, *SrcSt.Color_, R.Sub(6), &Particle_t::color);
+
+        pVec alpha[P_DOMAIN_BATCH];
+        float age[P_DOMAIN_BATCH];
+        SrcSt.Alpha_->GenerateN(alpha, count, R.Sub(7));
+        pNRandN(age, count, R.Sub(8), SrcSt.AgeSigma_);
+        for (size_t i = 0; i < count; i++) {
+            m[i].alpha = alpha[i].x();
+            m[i].age = SrcSt.Age_ + age[i];
+            m[i].mass = SrcSt.Mass_;
+            m[i].tmp0 = 0;
+            m[i].data = SrcSt.Data_;
+        }
+    });
+
+    group.BirthEmitted(ibegin);
 }
 }; // namespace PAPI
@@ -7,13 +7,31 @@
 #ifndef _ActionStructs_h
 #define _ActionStructs_h
 
+#include "Particle/pActionImpls.h"
 #include "Particle/pSourceState.h"
 #include "ParticleGroup.h"
 
 #include <string>
+#include <typeinfo>
+#include <variant>
 
 namespace PAPI {
 
+// A domain stored by value as its concrete type. The actions std::visit it, so each of their particle loops is compiled once per type
+// of domain, with that domain's Within, Generate, WithinN, and GenerateN inlined and no virtual calls. In the order of pDomainType_E.
+typedef std::variant<PDUnion, PDPoint, PDLine, PDTriangle, PDRectangle, PDDisc, PDPlane, PDBox, PDCylinder, PDCone, PDSphere, PDBlob> pDomainVariant_t;
+
+// Copy the concrete domain that dom refers to into a pDomainVariant_t
+pDomainVariant_t MakeDomainVariant(const pDomain& dom);
+
+// The per-particle kernel of an action that only touches its own particle and draws no random numbers, prepared for one execution of the
+// action. It is an instruction of a PAFused, which applies each of its instructions to a small tile of particles before going on to the next tile.
+typedef std::variant<PABounce_Prep<PDTriangle>, PABounce_Prep<PDRectangle>, PABounce_Prep<PDBox>, PABounce_Prep<PDPlane>, PABounce_Prep<PDSphere>,
+                     PABounce_Prep<PDDisc>, PACopyVertexB_Prep, PADamping_Prep, PARotDamping_Prep, PAExplosion_Prep, PAGravity_Prep, PAKillOld_Prep,
+                     PAMove_Prep, PAOrbitLine_Prep, PAOrbitPoint_Prep, PARestore_Prep, PASpeedClamp_Prep, PATargetColor_Prep, PATargetSize_Prep,
+                     PATargetVelocity_Prep, PATargetRotVelocity_Prep, PAVortex_Prep>
+    pFusedStep_t;
+
 #define ACTION_DECLS                                    \
     static std::string name, abrv;                      \
     inline std::string GetName() const { return name; } \
@@ -21,22 +39,71 @@ namespace PAPI {
     void Execute(ParticleGroup& pg, ParticleList::iterator ibegin, ParticleList::iterator iend);
 
 class PInternalState_t;
+struct ActionCost_t;
+struct ActionProfile_t;
 
 struct PActionBase {
     static std::string name, abrv;
 
-    float dt; // This is copied to here from PInternalState_t.
+    float dt;       // This is copied to here from PInternalState_t.
+    uint32_t seed;  // The random number streams of this execution of the action are keyed by seed, frame, and particle index.
+    uint64_t frame; // These are copied to here from PInternalState_t, which gives each execution of an action a new frame.
+
+    ActionCost_t* cost = NULL; // The measured cost of this type of action, kept by PInternalState_t. NULL to run its loops serially.
+    std::shared_ptr<ActionProfile_t> profile; // Its profiling counters. Shared by the actions of a PAFused, and by immediate actions of one name.
+
+    // The random number stream of particle i of the group for this execution of the action
+    inline pRandStream_t Stream(const size_t i) const { return pRandStream_t(seed, frame, i); }
+
+    // The random number streams of particles first, first + 1, ... of the group for this execution of the action
+    inline pRandBatch_t Batch(const size_t first) const { return pRandBatch_t(seed, frame, first); }
 
     bool GetKillsParticles() { return bKillsParticles; }
+    bool GetEmitsParticles() { return bEmitsParticles; }
     bool GetDoNotSegment() { return bDoNotSegment; }
+    bool GetSerialChunks() { return bSerialChunks; }
+    bool GetSeesKills() { return bSeesKills || bEmitsParticles; }
+    unsigned int GetReads() { return attribReads; }
+    unsigned int GetWrites() { return attribWrites; }
 
     void SetKillsParticles(const bool v) { bKillsParticles = v; }
+    void SetEmitsParticles(const bool v) { bEmitsParticles = v; }
     void SetDoNotSegment(const bool v) { bDoNotSegment = v; }
+    void SetSerialChunks(const bool v) { bSerialChunks = v; }
+    void SetSeesKills(const bool v) { bSeesKills = v; }
+    void SetAttribs(const unsigned int reads, const unsigned int writes)
+    {
+        attribReads = reads;
+        attribWrites = writes;
+    }
 
     void SetPInternalState(PInternalState_t* P) { PS = P; }
 
     virtual void Execute(ParticleGroup& pg, ParticleList::iterator ibegin, ParticleList::iterator iend) = 0;
 
+    // Actions that kill particles tag the particles of [ibegin, iend) that should die in the group's kill bitmap. first is the index in the
+    // group of *ibegin, which may be in a staged chunk. The group commits the kills afterward.
+    virtual void TagKills(ParticleGroup& pg, ParticleList::iterator ibegin, ParticleList::iterator iend, const size_t first) {}
+
+    // Actions that create particles add them to ParticleGroup::GetEmitted() here when run in a segment. They are added to the group after it.
+    virtual void Emit(ParticleGroup& pg) {}
+
+    // Actions with block kernels run these in place on the ParticleBlock_t of a P_LAYOUT_AOSOA group and return true.
+    // Other actions return false and are run on a staged chunk instead. Actions that kill particles only tag them here.
+    virtual bool ExecuteBlocks(ParticleGroup& pg, ParticleBlock_t* bbegin, ParticleBlock_t* bend) { return false; }
+
+    // Actions that can be fused into a PAFused return true. If steps isn't NULL they also append their kernel for their current dt to it.
+    virtual bool Fuse(std::vector<pFusedStep_t>* steps) { return false; }
+
+    // Actions whose parameters make them change no particle return true, and are dropped from action lists by the optimizer
+    virtual bool IsNoOp() { return false; }
+
+    // Called after the action is started for an execution and before it runs on any chunk. The chunks may then run in parallel.
+    virtual void Prepare() {}
+
+    // A PAFused returns the actions it fuses, which are started in its place
+    virtual std::vector<std::shared_ptr<PActionBase>>* GetFusedActions() { return NULL; }
+
     virtual std::string GetName() const { return name; }
     virtual std::string GetAbrv() const { return abrv; }
 
@@ -44,9 +111,17 @@ private:
     // For doing optimizations where we perform all actions to a working set of particles,
     // then to the next working set, etc. to improve cache coherency.
     // This doesn't work if the application of an action to a particle is a function of other particles in the group.
-    bool bDoNotSegment; // True if this action cannot be done in segments
+    bool bDoNotSegment;         // True if this action cannot be done in segments
+    bool bSerialChunks = false; // True if the chunks of a segment with this action can't be run in parallel, such as for app callbacks
+
+    bool bKillsParticles;         // True if this action kills particles, so it only tags them when part of a segment
+    bool bEmitsParticles = false; // True if this action creates particles, so it emits them when part of a segment
+    bool bSeesKills = false;      // True if this action must not see the particles tagged by an earlier kill action, so it starts a new segment
 
-    bool bKillsParticles; // True if this action cannot be part of a normal combined kernel
+    // The pAttrib_E masks of the particle attributes this action reads and writes.
+    // Groups that aren't P_LAYOUT_AOS only copy these attributes in and out of their store.
+    unsigned int attribReads;
+    unsigned int attribWrites;
 
 protected:
     PInternalState_t* PS;
@@ -56,7 +131,7 @@ protected:
 // Data types derived from PActionBase.
 
 struct PAAvoid : public PActionBase {
-    std::shared_ptr<pDomain> position;
+    pDomainVariant_t position;
     float look_ahead;
     float magnitude;
     float epsilon;
@@ -68,10 +143,20 @@ struct PAAvoid : public PActionBase {
     void Exec(const PDPlane& dom, ParticleGroup& group, ParticleList::iterator ibegin, ParticleList::iterator iend);
     void Exec(const PDSphere& dom, ParticleGroup& group, ParticleList::iterator ibegin, ParticleList::iterator iend);
     void Exec(const PDDisc& dom, ParticleGroup& group, ParticleList::iterator ibegin, ParticleList::iterator iend);
+    template <class D> void Exec(const D& dom, ParticleGroup& group, ParticleList::iterator ibegin, ParticleList::iterator iend)
+    {
+        throw PErrNotImplemented(GetName() + " not implemented for domain " + typeid(D).name());
+    }
+
+    // True if there is an Exec() for this type of domain. Avoid() checks this, so the error is thrown when the action is made.
+    static bool Implemented(const pDomainType_E which)
+    {
+        return which == PDTriangle_e || which == PDRectangle_e || which == PDPlane_e || which == PDSphere_e || which == PDDisc_e;
+    }
 };
 
 struct PABounce : public PActionBase {
-    std::shared_ptr<pDomain> position;
+    pDomainVariant_t position;
     float friction;
     float resilience;
     float fric_min_vel;
@@ -84,6 +169,18 @@ struct PABounce : public PActionBase {
     void Exec(const PDPlane& dom, ParticleGroup& group, ParticleList::iterator ibegin, ParticleList::iterator iend);
     void Exec(const PDSphere& dom, ParticleGroup& group, ParticleList::iterator ibegin, ParticleList::iterator iend);
     void Exec(const PDDisc& dom, ParticleGroup& group, ParticleList::iterator ibegin, ParticleList::iterator iend);
+    template <class D> void Exec(const D& dom, ParticleGroup& group, ParticleList::iterator ibegin, ParticleList::iterator iend)
+    {
+        throw PErrNotImplemented(GetName() + " not implemented for domain " + typeid(D).name());
+    }
+
+    // True if there is an Exec() for this type of domain. Bounce() checks this, so the error is thrown when the action is made.
+    static bool Implemented(const pDomainType_E which)
+    {
+        return which == PDTriangle_e || which == PDRectangle_e || which == PDBox_e || which == PDPlane_e || which == PDSphere_e || which == PDDisc_e;
+    }
+
+    bool Fuse(std::vector<pFusedStep_t>* steps);
 };
 
 struct PACallback : public PActionBase {
@@ -91,6 +188,7 @@ struct PACallback : public PActionBase {
     pdata_t call_data;
 
     ACTION_DECLS;
+    bool IsNoOp() { return callbackFunc == NULL; }
 };
 
 struct PACallActionList : public PActionBase {
@@ -101,6 +199,8 @@ struct PACallActionList : public PActionBase {
 
 struct PACommitKills : public PActionBase {
     ACTION_DECLS;
+
+    void TagKills(ParticleGroup& pg, ParticleList::iterator ibegin, ParticleList::iterator iend, const size_t first);
 };
 
 struct PACopyVertexB : public PActionBase {
@@ -108,6 +208,8 @@ struct PACopyVertexB : public PActionBase {
     bool copy_vel;
 
     ACTION_DECLS;
+    bool ExecuteBlocks(ParticleGroup& pg, ParticleBlock_t* bbegin, ParticleBlock_t* bend);
+    bool Fuse(std::vector<pFusedStep_t>* steps);
 };
 
 struct PADamping : public PActionBase {
@@ -116,6 +218,9 @@ struct PADamping : public PActionBase {
     float max_vel;
 
     ACTION_DECLS;
+    bool IsNoOp() { return damping == pVec(1.f); }
+    bool ExecuteBlocks(ParticleGroup& pg, ParticleBlock_t* bbegin, ParticleBlock_t* bend);
+    bool Fuse(std::vector<pFusedStep_t>* steps);
 };
 
 struct PARotDamping : public PActionBase {
@@ -124,6 +229,9 @@ struct PARotDamping : public PActionBase {
     float max_vel;
 
     ACTION_DECLS;
+    bool IsNoOp() { return damping == pVec(1.f); }
+    bool ExecuteBlocks(ParticleGroup& pg, ParticleBlock_t* bbegin, ParticleBlock_t* bend);
+    bool Fuse(std::vector<pFusedStep_t>* steps);
 };
 
 struct PAExplosion : public PActionBase {
@@ -134,6 +242,34 @@ struct PAExplosion : public PActionBase {
     float epsilon;
 
     ACTION_DECLS;
+    bool ExecuteBlocks(ParticleGroup& pg, ParticleBlock_t* bbegin, ParticleBlock_t* bend);
+    bool Fuse(std::vector<pFusedStep_t>* steps);
+};
+
+// A run of consecutive actions of an action list that EndActionList() fused. Each particle goes through all of their kernels in turn
+// before the next particle, instead of each action making its own pass over the particles.
+struct PAFused : public PActionBase {
+    std::vector<std::shared_ptr<PActionBase>> actions;
+
+    // The actions lowered to one contiguous stream of instructions, each a kernel with its parameters and domain inline, so running it
+    // chases no pointers and makes no virtual calls. The parameters are prepared for program_dt, and the actions are lowered again if dt changes.
+    std::vector<pFusedStep_t> program;
+    float program_dt;
+
+    void Lower(); // Lower the actions to program for their current dt
+    void Prepare();
+
+    ACTION_DECLS;
+    std::vector<std::shared_ptr<PActionBase>>* GetFusedActions() { return &actions; }
+
+    void TagKills(ParticleGroup& pg, ParticleList::iterator ibegin, ParticleList::iterator iend, const size_t first);
+
+private:
+    // Apply the kernels to [ibegin, iend), tagging the particles that a kernel kills in kills if it isn't NULL
+    void Apply(ParticleList::iterator ibegin, ParticleList::iterator iend, const size_t first, KillBitmap_t* kills);
+
+    // Apply the kernels to the tiles of [ibegin, iend), in parallel if that's predicted to be faster
+    void ApplyTiles(ParticleGroup& pg, ParticleList::iterator ibegin, ParticleList::iterator iend, const size_t first, KillBitmap_t* kills);
 };
 
 struct PAFollow : public PActionBase {
@@ -156,11 +292,14 @@ struct PAGravity : public PActionBase {
     pVec direction;
 
     ACTION_DECLS;
+    bool IsNoOp() { return direction == pVec(0.f); }
+    bool ExecuteBlocks(ParticleGroup& pg, ParticleBlock_t* bbegin, ParticleBlock_t* bend);
+    bool Fuse(std::vector<pFusedStep_t>* steps);
 };
 
 struct PAJet : public PActionBase {
-    std::shared_ptr<pDomain> dom;
-    std::shared_ptr<pDomain> acc;
+    pDomainVariant_t dom;
+    pDomainVariant_t acc;
 
     ACTION_DECLS;
 };
@@ -170,6 +309,10 @@ struct PAKillOld : public PActionBase {
     bool kill_less_than;
 
     ACTION_DECLS;
+    bool ExecuteBlocks(ParticleGroup& pg, ParticleBlock_t* bbegin, ParticleBlock_t* bend);
+    bool Fuse(std::vector<pFusedStep_t>* steps);
+
+    void TagKills(ParticleGroup& pg, ParticleList::iterator ibegin, ParticleList::iterator iend, const size_t first);
 };
 
 struct PAMatchVelocity : public PActionBase {
@@ -193,6 +336,8 @@ struct PAMove : public PActionBase {
     bool move_rotational_velocity;
 
     ACTION_DECLS;
+    bool ExecuteBlocks(ParticleGroup& pg, ParticleBlock_t* bbegin, ParticleBlock_t* bend);
+    bool Fuse(std::vector<pFusedStep_t>* steps);
 };
 
 struct PAOrbitLine : public PActionBase {
@@ -202,6 +347,8 @@ struct PAOrbitLine : public PActionBase {
     float max_radius;
 
     ACTION_DECLS;
+    bool ExecuteBlocks(ParticleGroup& pg, ParticleBlock_t* bbegin, ParticleBlock_t* bend);
+    bool Fuse(std::vector<pFusedStep_t>* steps);
 };
 
 struct PAOrbitPoint : public PActionBase {
@@ -211,28 +358,30 @@ struct PAOrbitPoint : public PActionBase {
     float max_radius;
 
     ACTION_DECLS;
+    bool ExecuteBlocks(ParticleGroup& pg, ParticleBlock_t* bbegin, ParticleBlock_t* bend);
+    bool Fuse(std::vector<pFusedStep_t>* steps);
 };
 
 struct PARandomAccel : public PActionBase {
-    std::shared_ptr<pDomain> gen_acc;
+    pDomainVariant_t gen_acc;
 
     ACTION_DECLS;
 };
 
 struct PARandomDisplace : public PActionBase {
-    std::shared_ptr<pDomain> gen_disp;
+    pDomainVariant_t gen_disp;
 
     ACTION_DECLS;
 };
 
 struct PARandomVelocity : public PActionBase {
-    std::shared_ptr<pDomain> gen_vel;
+    pDomainVariant_t gen_vel;
 
     ACTION_DECLS;
 };
 
 struct PARandomRotVelocity : public PActionBase {
-    std::shared_ptr<pDomain> gen_vel;
+    pDomainVariant_t gen_vel;
 
     ACTION_DECLS;
 };
@@ -243,20 +392,26 @@ struct PARestore : public PActionBase {
     bool restore_rvelocity;
 
     ACTION_DECLS;
+    bool ExecuteBlocks(ParticleGroup& pg, ParticleBlock_t* bbegin, ParticleBlock_t* bend);
+    bool Fuse(std::vector<pFusedStep_t>* steps);
 };
 
 struct PASink : public PActionBase {
     bool kill_inside;
-    std::shared_ptr<pDomain> kill_pos_dom;
+    pDomainVariant_t kill_pos_dom;
 
     ACTION_DECLS;
+
+    void TagKills(ParticleGroup& pg, ParticleList::iterator ibegin, ParticleList::iterator iend, const size_t first);
 };
 
 struct PASinkVelocity : public PActionBase {
     bool kill_inside;
-    std::shared_ptr<pDomain> kill_vel_dom;
+    pDomainVariant_t kill_vel_dom;
 
     ACTION_DECLS;
+
+    void TagKills(ParticleGroup& pg, ParticleList::iterator ibegin, ParticleList::iterator iend, const size_t first);
 };
 
 struct PASort : public PActionBase {
@@ -269,11 +424,13 @@ struct PASort : public PActionBase {
 };
 
 struct PASource : public PActionBase {
-    std::shared_ptr<pDomain> gen_pos;
+    pDomainVariant_t gen_pos;
     float particle_rate;
     pSourceState SrcSt;
 
     ACTION_DECLS;
+
+    void Emit(ParticleGroup& pg);
 };
 
 struct PASpeedClamp : public PActionBase {
@@ -281,6 +438,8 @@ struct PASpeedClamp : public PActionBase {
     float max_speed;
 
     ACTION_DECLS;
+    bool ExecuteBlocks(ParticleGroup& pg, ParticleBlock_t* bbegin, ParticleBlock_t* bend);
+    bool Fuse(std::vector<pFusedStep_t>* steps);
 };
 
 struct PATargetColor : public PActionBase {
@@ -289,6 +448,9 @@ struct PATargetColor : public PActionBase {
     float scale;
 
     ACTION_DECLS;
+    bool IsNoOp() { return scale == 0.f; }
+    bool ExecuteBlocks(ParticleGroup& pg, ParticleBlock_t* bbegin, ParticleBlock_t* bend);
+    bool Fuse(std::vector<pFusedStep_t>* steps);
 };
 
 struct PATargetSize : public PActionBase {
@@ -296,6 +458,9 @@ struct PATargetSize : public PActionBase {
     pVec scale;
 
     ACTION_DECLS;
+    bool IsNoOp() { return scale == pVec(0.f); }
+    bool ExecuteBlocks(ParticleGroup& pg, ParticleBlock_t* bbegin, ParticleBlock_t* bend);
+    bool Fuse(std::vector<pFusedStep_t>* steps);
 };
 
 struct PATargetVelocity : public PActionBase {
@@ -303,6 +468,9 @@ struct PATargetVelocity : public PActionBase {
     float scale;
 
     ACTION_DECLS;
+    bool IsNoOp() { return scale == 0.f; }
+    bool ExecuteBlocks(ParticleGroup& pg, ParticleBlock_t* bbegin, ParticleBlock_t* bend);
+    bool Fuse(std::vector<pFusedStep_t>* steps);
 };
 
 struct PATargetRotVelocity : public PActionBase {
@@ -310,6 +478,9 @@ struct PATargetRotVelocity : public PActionBase {
     float scale;
 
     ACTION_DECLS;
+    bool IsNoOp() { return scale == 0.f; }
+    bool ExecuteBlocks(ParticleGroup& pg, ParticleBlock_t* bbegin, ParticleBlock_t* bend);
+    bool Fuse(std::vector<pFusedStep_t>* steps);
 };
 
 struct PAVortex : public PActionBase {
@@ -322,6 +493,8 @@ struct PAVortex : public PActionBase {
     float aroundSpeed;
 
     ACTION_DECLS;
+    bool ExecuteBlocks(ParticleGroup& pg, ParticleBlock_t* bbegin, ParticleBlock_t* bend);
+    bool Fuse(std::vector<pFusedStep_t>* steps);
 };
 }; // namespace PAPI
 
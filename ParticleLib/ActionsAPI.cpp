@@ -16,18 +16,39 @@ namespace PAPI {
 #define P_CHECK_ERR
 #endif
 
+pDomainVariant_t MakeDomainVariant(const pDomain& dom)
+{
+    switch (dom.Which) {
+    case PDUnion_e: return static_cast<const PDUnion&>(dom);
+    case PDPoint_e: return static_cast<const PDPoint&>(dom);
+    case PDLine_e: return static_cast<const PDLine&>(dom);
+    case PDTriangle_e: return static_cast<const PDTriangle&>(dom);
+    case PDRectangle_e: return static_cast<const PDRectangle&>(dom);
+    case PDDisc_e: return static_cast<const PDDisc&>(dom);
+    case PDPlane_e: return static_cast<const PDPlane&>(dom);
+    case PDBox_e: return static_cast<const PDBox&>(dom);
+    case PDCylinder_e: return static_cast<const PDCylinder&>(dom);
+    case PDCone_e: return static_cast<const PDCone&>(dom);
+    case PDSphere_e: return static_cast<const PDSphere&>(dom);
+    case PDBlob_e: return static_cast<const PDBlob&>(dom);
+    }
+    throw PErrInternalError("Unknown domain type.");
+}
+
 void PContextActions_t::Avoid(const float magnitude, const float epsilon, const float look_ahead, const pDomain& dom)
 {
     P_CHECK_ERR;
+    if (!PAAvoid::Implemented(dom.Which)) throw PErrNotImplemented("Avoid() is not implemented for this type of domain.");
     PAAvoid* A = new PAAvoid;
 
-    A->position = dom.copy();
+    A->position = MakeDomainVariant(dom);
     A->magnitude = magnitude;
     A->epsilon = epsilon;
     A->look_ahead = look_ahead;
 
     A->SetKillsParticles(false);
     A->SetDoNotSegment(false);
+    A->SetAttribs(PA_POS | PA_VEL, PA_VEL);
 
     PS->SendAction(std::shared_ptr<PActionBase>(A));
 }
@@ -35,15 +56,17 @@ void PContextActions_t::Avoid(const float magnitude, const float epsilon, const
 void PContextActions_t::Bounce(const float friction, const float resilience, const float fric_min_vel, const pDomain& dom)
 {
     P_CHECK_ERR;
+    if (!PABounce::Implemented(dom.Which)) throw PErrNotImplemented("Bounce() is not implemented for this type of domain.");
     PABounce* A = new PABounce;
 
-    A->position = dom.copy();
+    A->position = MakeDomainVariant(dom);
     A->friction = friction;
     A->resilience = resilience;
     A->fric_min_vel = fric_min_vel;
 
     A->SetKillsParticles(false);
     A->SetDoNotSegment(false);
+    A->SetAttribs(PA_POS | PA_VEL, PA_VEL);
 
     if (dom.Which == PDSphere_e) { LIB_ASSERT(dynamic_cast<const PDSphere*>(&dom)->radIn == 0.0f, "Bouncing doesn't work on thick shells. radIn must be 0."); }
 
@@ -59,6 +82,9 @@ void PContextActions_t::Callback(P_PARTICLE_CALLBACK_ACTION callbackFunc, const
 
     A->SetKillsParticles(false);
     A->SetDoNotSegment(false);
+    A->SetSerialChunks(true); // The callback needn't be thread safe.
+    A->SetSeesKills(true);    // The callback shouldn't get particles that were killed before it.
+    A->SetAttribs(PA_ALL, PA_ALL);
 
     PS->SendAction(std::shared_ptr<PActionBase>(A));
 }
@@ -70,6 +96,7 @@ void PContextActions_t::CommitKills()
 
     A->SetKillsParticles(true);
     A->SetDoNotSegment(false);
+    A->SetAttribs(0, 0);
 
     PS->SendAction(std::shared_ptr<PActionBase>(A));
 }
@@ -84,6 +111,7 @@ void PContextActions_t::CopyVertexB(const bool copy_pos, const bool copy_vel)
 
     A->SetKillsParticles(false);
     A->SetDoNotSegment(false);
+    A->SetAttribs((copy_pos ? PA_POS | PA_UP : 0) | (copy_vel ? PA_VEL : 0), (copy_pos ? PA_POSB | PA_UPB : 0) | (copy_vel ? PA_VELB : 0));
 
     PS->SendAction(std::shared_ptr<PActionBase>(A));
 }
@@ -99,6 +127,7 @@ void PContextActions_t::Damping(const pVec& damping, const float min_vel, const
 
     A->SetKillsParticles(false);
     A->SetDoNotSegment(false);
+    A->SetAttribs(PA_VEL, PA_VEL);
 
     PS->SendAction(std::shared_ptr<PActionBase>(A));
 }
@@ -114,6 +143,7 @@ void PContextActions_t::RotDamping(const pVec& damping, const float min_vel, con
 
     A->SetKillsParticles(false);
     A->SetDoNotSegment(false);
+    A->SetAttribs(PA_RVEL, PA_RVEL);
 
     PS->SendAction(std::shared_ptr<PActionBase>(A));
 }
@@ -131,6 +161,7 @@ void PContextActions_t::Explosion(const pVec& center, const float radius, const
 
     A->SetKillsParticles(false);
     A->SetDoNotSegment(false);
+    A->SetAttribs(PA_POS | PA_VEL, PA_VEL);
 
     PS->SendAction(std::shared_ptr<PActionBase>(A));
 }
@@ -146,6 +177,7 @@ void PContextActions_t::Follow(const float magnitude, const float epsilon, const
 
     A->SetKillsParticles(false);
     A->SetDoNotSegment(true); // Depends on other particles' state being in sync with this one's.
+    A->SetAttribs(PA_POS | PA_VEL, PA_VEL);
 
     PS->SendAction(std::shared_ptr<PActionBase>(A));
 }
@@ -161,6 +193,7 @@ void PContextActions_t::Gravitate(const float magnitude, const float epsilon, co
 
     A->SetKillsParticles(false);
     A->SetDoNotSegment(true); // N^2
+    A->SetAttribs(PA_POS | PA_VEL, PA_VEL);
 
     PS->SendAction(std::shared_ptr<PActionBase>(A));
 }
@@ -174,6 +207,7 @@ void PContextActions_t::Gravity(const pVec& dir)
 
     A->SetKillsParticles(false);
     A->SetDoNotSegment(false);
+    A->SetAttribs(PA_VEL, PA_VEL);
 
     PS->SendAction(std::shared_ptr<PActionBase>(A));
 }
@@ -183,11 +217,12 @@ void PContextActions_t::Jet(const pDomain& dom, const pDomain& accel)
     P_CHECK_ERR;
     PAJet* A = new PAJet;
 
-    A->dom = dom.copy();
-    A->acc = accel.copy();
+    A->dom = MakeDomainVariant(dom);
+    A->acc = MakeDomainVariant(accel);
 
     A->SetKillsParticles(false);
     A->SetDoNotSegment(false);
+    A->SetAttribs(PA_POS | PA_VEL, PA_VEL);
 
     PS->SendAction(std::shared_ptr<PActionBase>(A));
 }
@@ -202,6 +237,7 @@ void PContextActions_t::KillOld(const float age_limit, const bool kill_less_than
 
     A->SetKillsParticles(true);
     A->SetDoNotSegment(false);
+    A->SetAttribs(PA_AGE, 0);
 
     PS->SendAction(std::shared_ptr<PActionBase>(A));
 }
@@ -217,6 +253,7 @@ void PContextActions_t::MatchVelocity(const float magnitude, const float epsilon
 
     A->SetKillsParticles(false);
     A->SetDoNotSegment(true); // N^2
+    A->SetAttribs(PA_POS | PA_VEL, PA_VEL);
 
     PS->SendAction(std::shared_ptr<PActionBase>(A));
 }
@@ -232,6 +269,7 @@ void PContextActions_t::MatchRotVelocity(const float magnitude, const float epsi
 
     A->SetKillsParticles(false);
     A->SetDoNotSegment(true); // N^2
+    A->SetAttribs(PA_POS | PA_RVEL, PA_RVEL);
 
     PS->SendAction(std::shared_ptr<PActionBase>(A));
 }
@@ -246,6 +284,8 @@ void PContextActions_t::Move(const bool move_velocity, const bool move_rotationa
 
     A->SetKillsParticles(false);
     A->SetDoNotSegment(false);
+    A->SetAttribs(PA_AGE | (move_velocity ? PA_POS | PA_VEL : 0) | (move_rotational_velocity ? PA_UP | PA_RVEL : 0),
+                  PA_AGE | (move_velocity ? PA_POS : 0) | (move_rotational_velocity ? PA_UP : 0));
 
     PS->SendAction(std::shared_ptr<PActionBase>(A));
 }
@@ -263,6 +303,7 @@ void PContextActions_t::OrbitLine(const pVec& p, const pVec& axis, const float m
 
     A->SetKillsParticles(false);
     A->SetDoNotSegment(false);
+    A->SetAttribs(PA_POS | PA_VEL, PA_VEL);
 
     PS->SendAction(std::shared_ptr<PActionBase>(A));
 }
@@ -279,6 +320,7 @@ void PContextActions_t::OrbitPoint(const pVec& center, const float magnitude, co
 
     A->SetKillsParticles(false);
     A->SetDoNotSegment(false);
+    A->SetAttribs(PA_POS | PA_VEL, PA_VEL);
 
     PS->SendAction(std::shared_ptr<PActionBase>(A));
 }
@@ -288,9 +330,10 @@ void PContextActions_t::RandomAccel(const pDomain& dom)
     P_CHECK_ERR;
     PARandomAccel* A = new PARandomAccel;
 
-    A->gen_acc = dom.copy();
+    A->gen_acc = MakeDomainVariant(dom);
     A->SetKillsParticles(false);
     A->SetDoNotSegment(false);
+    A->SetAttribs(PA_VEL, PA_VEL);
 
     PS->SendAction(std::shared_ptr<PActionBase>(A));
 }
@@ -300,9 +343,10 @@ void PContextActions_t::RandomDisplace(const pDomain& dom)
     P_CHECK_ERR;
     PARandomDisplace* A = new PARandomDisplace;
 
-    A->gen_disp = dom.copy();
+    A->gen_disp = MakeDomainVariant(dom);
     A->SetKillsParticles(false);
     A->SetDoNotSegment(false);
+    A->SetAttribs(PA_POS, PA_POS);
 
     PS->SendAction(std::shared_ptr<PActionBase>(A));
 }
@@ -312,9 +356,10 @@ void PContextActions_t::RandomVelocity(const pDomain& dom)
     P_CHECK_ERR;
     PARandomVelocity* A = new PARandomVelocity;
 
-    A->gen_vel = dom.copy();
+    A->gen_vel = MakeDomainVariant(dom);
     A->SetKillsParticles(false);
     A->SetDoNotSegment(false);
+    A->SetAttribs(0, PA_VEL);
 
     PS->SendAction(std::shared_ptr<PActionBase>(A));
 }
@@ -324,9 +369,10 @@ void PContextActions_t::RandomRotVelocity(const pDomain& dom)
     P_CHECK_ERR;
     PARandomRotVelocity* A = new PARandomRotVelocity;
 
-    A->gen_vel = dom.copy();
+    A->gen_vel = MakeDomainVariant(dom);
     A->SetKillsParticles(false);
     A->SetDoNotSegment(false);
+    A->SetAttribs(0, PA_RVEL);
 
     PS->SendAction(std::shared_ptr<PActionBase>(A));
 }
@@ -342,6 +388,8 @@ void PContextActions_t::Restore(const float time_left, const bool vel, const boo
 
     A->SetKillsParticles(false);
     A->SetDoNotSegment(false);
+    A->SetAttribs((vel ? PA_POS | PA_POSB | PA_VEL : 0) | (rvel ? PA_UP | PA_UPB | PA_RVEL : 0),
+                  (vel ? PA_POS | PA_VEL : 0) | (rvel ? PA_UP | PA_RVEL : 0));
 
     PS->SendAction(std::shared_ptr<PActionBase>(A));
 }
@@ -351,11 +399,12 @@ void PContextActions_t::Sink(const bool kill_inside, const pDomain& kill_pos_dom
     P_CHECK_ERR;
     PASink* A = new PASink;
 
-    A->kill_pos_dom = kill_pos_dom.copy();
+    A->kill_pos_dom = MakeDomainVariant(kill_pos_dom);
     A->kill_inside = kill_inside;
 
     A->SetKillsParticles(true); // Kills.
     A->SetDoNotSegment(false);
+    A->SetAttribs(PA_POS, 0);
 
     PS->SendAction(std::shared_ptr<PActionBase>(A));
 }
@@ -365,11 +414,12 @@ void PContextActions_t::SinkVelocity(const bool kill_inside, const pDomain& kill
     P_CHECK_ERR;
     PASinkVelocity* A = new PASinkVelocity;
 
-    A->kill_vel_dom = kill_vel_dom.copy();
+    A->kill_vel_dom = MakeDomainVariant(kill_vel_dom);
     A->kill_inside = kill_inside;
 
     A->SetKillsParticles(true); // Kills.
     A->SetDoNotSegment(false);
+    A->SetAttribs(PA_VEL, 0);
 
     PS->SendAction(std::shared_ptr<PActionBase>(A));
 }
@@ -386,6 +436,7 @@ void PContextActions_t::Sort(const pVec& eye, const pVec& look, const bool front
 
     A->SetKillsParticles(false);
     A->SetDoNotSegment(true); // Particles aren't a function of other particles, but since it can screw up the working set thing, I'm setting it true.
+    A->SetAttribs(PA_ALL, PA_ALL);
 
     PS->SendAction(std::shared_ptr<PActionBase>(A));
 }
@@ -395,12 +446,14 @@ void PContextActions_t::Source(const float particle_rate, const pDomain& dom, co
     P_CHECK_ERR;
     PASource* A = new PASource;
 
-    A->gen_pos = dom.copy();
+    A->gen_pos = MakeDomainVariant(dom);
     A->particle_rate = particle_rate;
     A->SrcSt = SrcSt;
 
     A->SetKillsParticles(false);
-    A->SetDoNotSegment(true); // Particles aren't a function of other particles, but does affect the working sets optimizations
+    A->SetEmitsParticles(true); // In a segment the new particles are added after it.
+    A->SetDoNotSegment(false);
+    A->SetAttribs(0, 0);
 
     PS->SendAction(std::shared_ptr<PActionBase>(A));
 }
@@ -415,6 +468,7 @@ void PContextActions_t::SpeedClamp(const float min_speed, const float max_speed)
 
     A->SetKillsParticles(false);
     A->SetDoNotSegment(false);
+    A->SetAttribs(PA_VEL, PA_VEL);
 
     PS->SendAction(std::shared_ptr<PActionBase>(A));
 }
@@ -430,6 +484,7 @@ void PContextActions_t::TargetColor(const pVec& color, const float alpha, const
 
     A->SetKillsParticles(false);
     A->SetDoNotSegment(false);
+    A->SetAttribs(PA_COLOR | PA_ALPHA, PA_COLOR | PA_ALPHA);
 
     PS->SendAction(std::shared_ptr<PActionBase>(A));
 }
@@ -444,6 +499,7 @@ void PContextActions_t::TargetSize(const pVec& size, const pVec& scale)
 
     A->SetKillsParticles(false);
     A->SetDoNotSegment(false);
+    A->SetAttribs(PA_SIZE, PA_SIZE);
 
     PS->SendAction(std::shared_ptr<PActionBase>(A));
 }
@@ -458,6 +514,7 @@ void PContextActions_t::TargetVelocity(const pVec& vel, const float scale)
 
     A->SetKillsParticles(false);
     A->SetDoNotSegment(false);
+    A->SetAttribs(PA_VEL, PA_VEL);
 
     PS->SendAction(std::shared_ptr<PActionBase>(A));
 }
@@ -472,6 +529,7 @@ void PContextActions_t::TargetRotVelocity(const pVec& vel, const float scale)
 
     A->SetKillsParticles(false);
     A->SetDoNotSegment(false);
+    A->SetAttribs(PA_RVEL, PA_RVEL);
 
     PS->SendAction(std::shared_ptr<PActionBase>(A));
 }
@@ -490,6 +548,7 @@ void PContextActions_t::Vertex(const pVec& pos, const pSourceState& SrcSt, const
 
     // Immediate mode. Quickly add the vertex.
     Particle_t P;
+    pRandStreamScope scope(PS->get_rng());
 
     P.pos = pos;
     P.posB = SrcSt.vertexB_tracks_ ? pos : SrcSt.VertexB_->Generate();
@@ -524,6 +583,7 @@ void PContextActions_t::Vortex(const pVec& center, const pVec& axis, const float
 
     A->SetKillsParticles(false);
     A->SetDoNotSegment(false);
+    A->SetAttribs(PA_POS | PA_VEL | PA_MASS, PA_VEL);
 
     PS->SendAction(std::shared_ptr<PActionBase>(A));
 }
@@ -33,6 +33,7 @@ void PContextActionList_t::NewActionList(const int action_list_num)
 
     PS->set_in_new_list(true);
     PS->getALists()[PS->get_alist_id()].resize(0); // Remove any old actions
+    PS->getALists()[PS->get_alist_id()].tuner = WorkingSetTuner_t(); // The new actions need their own working set size
 }
 
 void PContextActionList_t::EndActionList()
@@ -41,6 +42,8 @@ void PContextActionList_t::EndActionList()
 
     PS->set_in_new_list(false);
 
+    PS->OptimizeActionList(PS->getALists()[PS->get_alist_id()]);
+    PS->FuseActionList(PS->getALists()[PS->get_alist_id()]);
     PS->set_alist_id(-1);
 }
 
@@ -52,7 +55,10 @@ void PContextActionList_t::DeleteActionLists(const int action_list_num, const in
 
     if (action_list_num + action_list_count > (int)PS->getALists().size()) throw PErrActionList("Invalid action list number.");
 
-    for (int i = action_list_num; i < action_list_num + action_list_count; i++) { PS->getALists()[i].resize(0); }
+    for (int i = action_list_num; i < action_list_num + action_list_count; i++) {
+        PS->getALists()[i].resize(0);
+        PS->getALists()[i].tuner = WorkingSetTuner_t();
+    }
 }
 
 void PContextActionList_t::CallActionList(const int action_list_num)
@@ -64,6 +70,10 @@ void PContextActionList_t::CallActionList(const int action_list_num)
         PACallActionList* S = new PACallActionList;
         S->action_list_num = action_list_num;
 
+        S->SetKillsParticles(false);
+        S->SetDoNotSegment(true); // The called list does its own segmenting.
+        S->SetAttribs(0, 0);
+
         PS->SendAction(std::shared_ptr<PActionBase>(S));
     } else {
         // Execute the specified action list.
@@ -75,14 +85,91 @@ void PContextActionList_t::TimeStep(const float newDT) { PS->set_dt(newDT); }
 
 float PContextActionList_t::GetTimeStep() const { return PS->get_dt(); }
 
-// Sets the random seed. Unfortunately, it currently sets it for all contexts in this thread.
-void PContextActionList_t::Seed(const unsigned int seed) { pSRandf(seed); }
+// Sets the random seed of this context
+void PContextActionList_t::Seed(const unsigned int seed) { PS->set_seed(seed); }
+
+void PContextActionList_t::SetAdaptiveExecution(const bool adaptive) { PS->set_adaptive_execution(adaptive); }
+
+std::vector<pActionPolicy_t> PContextActionList_t::GetActionPolicies() const
+{
+    std::vector<pActionPolicy_t> policies;
+    for (auto& [name, C] : PS->get_action_costs()) {
+        if (!C.calls) continue; // Started, but hasn't looped over particles, like the actions that a PAFused runs
+
+        pActionPolicy_t P;
+        P.name = name;
+        P.ns_per_particle = C.ns_per_particle;
+        P.calls = C.calls;
+        P.parallel_calls = C.parallel_calls;
+        P.particles = C.particles;
+        P.grain = C.parallel_calls ? C.grain.load() : 0;
+        P.min_parallel_particles = C.MinParallelParticles();
+        policies.push_back(P);
+    }
+
+    return policies;
+}
+
+void PContextActionList_t::SetActionProfiling(const bool profiling) { PS->set_profiling(profiling); }
+
+namespace {
+pActionProfile_t MakeProfile(const std::string& name, const std::string& abrv, const ActionProfile_t& P)
+{
+    pActionProfile_t R;
+    R.name = name;
+    R.abrv = abrv;
+    R.ns = P.ns;
+    R.particles = P.particles;
+    R.chunks = P.chunks;
+    R.segments = P.segments;
+    R.killed = P.killed;
+    R.emitted = P.emitted;
+    return R;
+}
+
+void ResetProfile(ActionProfile_t& P)
+{
+    P.ns = P.particles = P.chunks = P.segments = P.killed = P.emitted = 0;
+}
+}; // namespace
+
+std::vector<pActionProfile_t> PContextActionList_t::GetActionProfile(const int action_list_num) const
+{
+    if (action_list_num >= (int)PS->getALists().size()) throw PErrActionList("Invalid action list number.");
+
+    std::vector<pActionProfile_t> profiles;
+    if (action_list_num < 0) {
+        for (auto& [key, P] : PS->get_immediate_profiles()) profiles.push_back(MakeProfile(key.first, key.second, *P));
+    } else {
+        for (std::shared_ptr<PActionBase>& A : PS->getALists()[action_list_num]) {
+            if (!A->profile) continue;
+            profiles.push_back(MakeProfile(A->GetName(), A->GetAbrv(), *A->profile));
+            if (std::vector<std::shared_ptr<PActionBase>>* fused = A->GetFusedActions())
+                for (auto& F : *fused) profiles.back().fused.push_back(F->GetName());
+        }
+    }
+
+    return profiles;
+}
+
+void PContextActionList_t::ResetActionProfile(const int action_list_num)
+{
+    if (action_list_num >= (int)PS->getALists().size()) throw PErrActionList("Invalid action list number.");
+
+    if (action_list_num < 0) {
+        for (auto& [key, P] : PS->get_immediate_profiles()) ResetProfile(*P);
+    } else {
+        for (std::shared_ptr<PActionBase>& A : PS->getALists()[action_list_num])
+            if (A->profile) ResetProfile(*A->profile);
+    }
+}
 
 ////////////////////////////////////////////////////////
 // Particle Group Calls
 
 // Create p_group_count particle groups, each with max_particles allocated.
-int PContextParticleGroup_t::GenParticleGroups(const int p_group_count, const size_t max_particles)
+int PContextParticleGroup_t::GenParticleGroups(const int p_group_count, const size_t max_particles, const pGroupLayout_E layout, const unsigned int attribs,
+                                               const unsigned int memory)
 {
     if (PS->get_in_new_list()) throw PErrInNewActionList("Can't call GenParticleGroups while in NewActionList.");
     if (p_group_count < 0) throw PErrParticleGroup("Invalid particle group number 0");
@@ -90,7 +177,11 @@ int PContextParticleGroup_t::GenParticleGroups(const int p_group_count, const si
 
     int ind = PS->GeneratePGroups(p_group_count);
 
-    for (int i = ind; i < ind + p_group_count; i++) { PS->getPGroups()[i].SetMaxParticles(max_particles); }
+    for (int i = ind; i < ind + p_group_count; i++) {
+        PS->getPGroups()[i].SetMemory(memory);
+        PS->getPGroups()[i].SetMaxParticles(max_particles);
+        PS->getPGroups()[i].SetLayout(layout, attribs);
+    }
 
     return ind;
 }
@@ -128,6 +219,23 @@ void PContextParticleGroup_t::SetMaxParticles(const size_t max_count)
     PS->getPGroups()[PS->get_pgroup_id()].SetMaxParticles(max_count);
 }
 
+void PContextParticleGroup_t::SetPreserveOrder(const bool preserve_order)
+{
+    if (PS->get_in_new_list()) throw PErrInNewActionList("Can't call SetPreserveOrder while in NewActionList.");
+    if (PS->get_pgroup_id() < 0 || PS->get_pgroup_id() >= (int)PS->getPGroups().size()) throw PErrParticleGroup("Invalid particle group number 11");
+
+    PS->getPGroups()[PS->get_pgroup_id()].SetPreserveOrder(preserve_order);
+}
+
+void PContextParticleGroup_t::MapGroupToFile(const std::string& file_name)
+{
+    if (PS->get_in_new_list()) throw PErrInNewActionList("Can't call MapGroupToFile while in NewActionList.");
+    if (PS->get_pgroup_id() < 0 || PS->get_pgroup_id() >= (int)PS->getPGroups().size()) throw PErrParticleGroup("Invalid particle group number 10");
+    if (file_name.empty()) throw PErrParticleGroup("MapGroupToFile: Empty file name.");
+
+    PS->getPGroups()[PS->get_pgroup_id()].SetLayout(P_LAYOUT_MAPPED, PA_ALL, file_name);
+}
+
 // Copy from the specified group to the current group.
 void PContextParticleGroup_t::CopyGroup(const int p_src_group_num, const size_t index, const size_t copy_count)
 {
@@ -139,14 +247,14 @@ void PContextParticleGroup_t::CopyGroup(const int p_src_group_num, const size_t
 
     ParticleGroup& destgrp = PS->getPGroups()[PS->get_pgroup_id()];
 
-    // Find out exactly how many to copy.
+    // Find out exactly how many to copy. The counts are unsigned, so check before subtracting.
     size_t ccount = copy_count;
+    if (index >= srcgrp.size() || destgrp.size() >= destgrp.GetMaxParticles()) return;
     if (ccount > srcgrp.size() - index) ccount = srcgrp.size() - index;
     if (ccount > destgrp.GetMaxParticles() - destgrp.size()) ccount = destgrp.GetMaxParticles() - destgrp.size();
-    if (ccount < 0) ccount = 0;
 
     // Directly copy the particles to the current list.
-    for (size_t i = 0; i < ccount; i++) { destgrp.Add(srcgrp.GetList()[index + i]); }
+    for (size_t i = 0; i < ccount; i++) { destgrp.Add(srcgrp.Get(index + i)); }
 }
 
 // Copy from the current group to application memory.
@@ -155,22 +263,28 @@ size_t PContextParticleGroup_t::GetParticles(const size_t index, const size_t cn
 {
     if (PS->get_in_new_list()) throw PErrInNewActionList("Can't call GetParticles while in NewActionList.");
     if (PS->get_pgroup_id() < 0 || PS->get_pgroup_id() >= (int)PS->getPGroups().size()) throw PErrParticleGroup("GetParticles: Invalid pgroup_id");
-    if (index < 0 || cnt < 0) throw PErrParticleGroup("GetParticles: Invalid index or count.");
 
     ParticleGroup& pg = PS->getPGroups()[PS->get_pgroup_id()];
 
+    // The counts are unsigned, so check before subtracting.
+    if (index > pg.size()) throw PErrParticleGroup("GetParticles: index out of bounds.");
     size_t count = cnt;
+    if (count > pg.size() - index) count = pg.size() - index;
 
-    if (index + count > pg.size()) {
-        count = pg.size() - index;
-        if (count < 0) throw PErrParticleGroup("GetParticles: index out of bounds.");
-    }
+    size_t vi = 0, ci = 0, li = 0, si = 0, ai = 0;
 
-    int vi = 0, ci = 0, li = 0, si = 0, ai = 0;
+    // Groups that aren't P_LAYOUT_AOS copy the requested attributes out of their store a chunk at a time.
+    const unsigned int attribs = (verts ? PA_POS : 0) | (color ? PA_COLOR | PA_ALPHA : 0) | (vel ? PA_VEL : 0) | (size ? PA_SIZE : 0) | (age ? PA_AGE : 0);
+    ParticleList& plist = pg.IsStaged() ? pg.Stage(index, 0, 0) : pg.GetList();
+    size_t first = pg.IsStaged() ? index : 0; // The group index of plist[0]
 
     // This should be optimized.
     for (size_t i = index; i < index + count; i++) {
-        const Particle_t& m = pg.GetList()[i];
+        if (i - first >= plist.size()) {
+            pg.Stage(i, std::min((size_t)PS->get_working_set_size(), index + count - i), attribs);
+            first = i;
+        }
+        const Particle_t& m = plist[i - first];
 
         if (verts) {
             verts[vi++] = m.pos.x();
@@ -218,6 +332,7 @@ size_t PContextParticleGroup_t::GetParticlePointer(const float*& ptr, size_t& st
     ParticleGroup& pg = PS->getPGroups()[PS->get_pgroup_id()];
 
     if (pg.size() < 1) throw PErrParticleGroup("GetParticlePointer called on empty particle group.");
+    if (pg.IsStaged()) throw PErrParticleGroup("GetParticlePointer requires a P_LAYOUT_AOS particle group. Call GetParticles() instead.");
     if (PS->get_in_new_list()) throw PErrInNewActionList("Can't call GetParticlePointer while in NewActionList.");
 
     ParticleList::iterator it = pg.begin();
@@ -282,4 +397,20 @@ void PContextParticleGroup_t::DeathCallback(P_PARTICLE_CALLBACK callback, pdata_
 
 // Set the size in bytes of the CPU's cache to imply the number of particles that fit in it
 void PContextParticleGroup_t::SetWorkingSetSize(const int set_size_bytes) { PS->set_working_set_size(set_size_bytes / sizeof(Particle_t)); }
+
+void PContextParticleGroup_t::SetWorkingSetAutoTune(const bool auto_tune) { PS->set_working_set_auto_tune(auto_tune); }
+
+int PContextParticleGroup_t::GetWorkingSetSize(const int action_list_num) const
+{
+    if (action_list_num >= (int)PS->getALists().size()) throw PErrActionList("Invalid action list number.");
+
+    if (action_list_num >= 0 && PS->get_working_set_auto_tune() && PS->getALists()[action_list_num].tuner.bytes)
+        return (int)PS->getALists()[action_list_num].tuner.bytes;
+
+    return PS->get_working_set_size() * sizeof(Particle_t);
+}
+
+void PContextParticleGroup_t::SetScheduler(std::shared_ptr<pScheduler_t> scheduler) { PS->set_scheduler(scheduler); }
+
+std::shared_ptr<pScheduler_t> PContextParticleGroup_t::GetScheduler() { return PS->get_scheduler(); }
 }; // namespace PAPI
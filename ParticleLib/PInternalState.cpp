@@ -9,8 +9,17 @@
 #include "ActionStructs.h"
 #include "Particle/pAPIContext.h"
 
+#include <algorithm>
 #include <typeinfo>
 
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
 namespace PAPI {
 
 // Constructor for the app-owned context
@@ -24,27 +33,65 @@ ParticleContext_t::ParticleContext_t()
 
 void PContextActionList_t::InternalSetup(std::shared_ptr<PInternalState_t> St) { PS = St; }
 
-void PContextActions_t::InternalSetup(std::shared_ptr<PInternalState_t> St) { PS = St; }
+void PContextActions_t::InternalSetup(std::shared_ptr<PInternalState_t> St)
+{
+    PS = St;
+    Prep.InternalSetup(St);
+}
+
+void PContextPrep_t::InternalSetup(std::shared_ptr<PInternalState_t> St) { PS = St; }
+
+float PContextPrep_t::get_dt() const { return PS->get_dt(); }
 
 void PContextParticleGroup_t::InternalSetup(std::shared_ptr<PInternalState_t> St) { PS = St; }
 
 ///////////////////////////////////////////////////////////////////////
 // Internal state implementation
 
-void StartParticleLoop(std::shared_ptr<PInternalState_t> PS, PInternalShadow_t& PSh)
+void StartParticleLoop(std::shared_ptr<PInternalState_t> PS, PInternalShadow_t& PSh, const unsigned int attribs)
 {
     PASSERT(!PS->get_in_new_list() && !PS->get_in_call_list(), "Can't call ParticleLoop in an action list");
 
     PS->set_in_particle_loop(true);
 
-    ParticleGroup& pg = PS->getPGroups()[PS->get_pgroup_id()];
     PSh.dt = PS->get_dt();
-    PSh.ibegin = &*pg.begin();
-    PSh.iend = &*pg.begin() + (pg.end() - pg.begin());
+    PSh.ibegin = NULL;
+    PSh.iend = NULL;
+    PSh.attribs = attribs;
+    PSh.kills = &PS->getPGroups()[PS->get_pgroup_id()].GetKills(); // Inline actions tag kills here.
+    PSh.chunk_first = 0;
+    PSh.seed = PS->get_seed();
+    PSh.frame = PS->next_rng_frame();
+    PSh.scheduler = PS->get_scheduler().get();
     PSh.in_new_list = PS->get_in_new_list();
     PSh.in_particle_loop = true;
 }
 
+// Point PSh at the next chunk of particles. An AoS group is one chunk.
+// A staged group is copied through the stage list one working set at a time, or all at once if the loop touches all attributes.
+bool NextParticleChunk(std::shared_ptr<PInternalState_t> PS, PInternalShadow_t& PSh)
+{
+    ParticleGroup& pg = PS->getPGroups()[PS->get_pgroup_id()];
+    size_t count = PSh.iend - PSh.ibegin;
+
+    if (pg.IsStaged() && count) pg.Unstage(PSh.chunk_first, count, PSh.attribs); // Write back the chunk just visited
+    PSh.chunk_first += count;
+
+    if (PSh.chunk_first >= pg.size()) return false;
+
+    if (pg.IsStaged()) {
+        size_t chunk_size = (PSh.attribs == PA_ALL) ? pg.size() : PS->get_working_set_size();
+        count = std::min(chunk_size, pg.size() - PSh.chunk_first);
+        PSh.ibegin = pg.Stage(PSh.chunk_first, count, PSh.attribs).data();
+    } else {
+        count = pg.size() - PSh.chunk_first;
+        PSh.ibegin = pg.GetList().data() + PSh.chunk_first;
+    }
+    PSh.iend = PSh.ibegin + count;
+
+    return true;
+}
+
 void EndParticleLoop(std::shared_ptr<PInternalState_t> PS, PInternalShadow_t& PSh)
 {
     PS->set_in_particle_loop(false);
@@ -52,9 +99,115 @@ void EndParticleLoop(std::shared_ptr<PInternalState_t> PS, PInternalShadow_t& PS
     PSh.in_new_list = PS->get_in_new_list();
 }
 
-PInternalState_t::PInternalState_t() : in_call_list(false), in_new_list(false), in_particle_loop(false), dt(1.0f), pgroup_id(-1), alist_id(-1)
+PInternalState_t::PInternalState_t() :
+    in_call_list(false), in_new_list(false), in_particle_loop(false), dt(1.0f), pgroup_id(-1), alist_id(-1), working_set_auto_tune(false),
+    adaptive_execution(true), profiling(false)
 {
     working_set_size = (0x100000 / sizeof(Particle_t)); // Use 1 MB of cache
+    set_seed(0);
+    set_scheduler(std::make_shared<pThreadPool_t>());
+}
+
+void PInternalState_t::set_scheduler(std::shared_ptr<pScheduler_t> scheduler_)
+{
+    scheduler = scheduler_ ? scheduler_ : std::make_shared<pSerialScheduler_t>();
+    for (ParticleGroup& pg : PGroups) pg.SetScheduler(scheduler);
+}
+
+namespace {
+// The bounds of the working set sizes that the tuner tries, as in Benchmark -cache
+const size_t P_MIN_WORKING_SET = 16 * 1024;
+const size_t P_MAX_WORKING_SET = 8 * 1024 * 1024;
+
+// Return the size in bytes of the L2 cache of the CPU, or 1 MB if it can't be found
+size_t L2CacheBytes()
+{
+    size_t bytes = 0;
+#ifdef _WIN32
+    DWORD len = 0;
+    GetLogicalProcessorInformation(NULL, &len);
+    std::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> info(len / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+    if (!info.empty() && GetLogicalProcessorInformation(info.data(), &len))
+        for (SYSTEM_LOGICAL_PROCESSOR_INFORMATION& I : info)
+            if (I.Relationship == RelationCache && I.Cache.Level == 2) bytes = I.Cache.Size;
+#elif defined(_SC_LEVEL2_CACHE_SIZE)
+    long s = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    if (s > 0) bytes = s;
+#endif
+    return bytes ? bytes : 0x100000;
+}
+
+// The working set size that the tuner starts at: the largest power of two that fits in the L2 cache
+size_t StartingWorkingSet()
+{
+    static const size_t start = [] {
+        size_t l2 = L2CacheBytes(), b = P_MIN_WORKING_SET;
+        while (b * 2 <= l2 && b * 2 <= P_MAX_WORKING_SET) b *= 2;
+        return b;
+    }();
+    return start;
+}
+}; // namespace
+
+void WorkingSetTuner_t::Record(const double call_ns, const size_t n)
+{
+    // Calls on a group that is growing or shrinking fast are timed with a different mix of work, so wait for it to settle.
+    const size_t prev_n = last_n;
+    last_n = n;
+    if (n == 0 || n * 8 < prev_n * 7 || n * 8 > prev_n * 9) return;
+
+    const double t = call_ns / n;
+    ns = samples ? std::min(ns, t) : t;
+    if (++samples < 2) return;
+    samples = 0;
+
+    if (!best_bytes || ns < best_ns) {
+        moved = best_bytes != 0;
+        best_bytes = bytes;
+        best_ns = ns;
+    } else if (moved || dir < 0) {
+        converged = true; // The size on the other side of the best one was already slower
+    }
+
+    // Try the next larger size, or smaller ones once a larger one is slower. Sizes larger than the group all make the same single chunk.
+    size_t next = dir > 0 ? best_bytes * 2 : best_bytes / 2;
+    if (!converged && dir > 0 && (bytes != best_bytes || next > P_MAX_WORKING_SET || next / sizeof(Particle_t) >= n)) {
+        if (moved)
+            converged = true;
+        else {
+            dir = -1;
+            next = best_bytes / 2;
+        }
+    }
+    if (next < P_MIN_WORKING_SET) converged = true;
+
+    bytes = converged ? best_bytes : next;
+}
+
+void PInternalState_t::set_seed(const uint32_t seed_)
+{
+    seed = seed_;
+    rng_frame = 0;
+    rng.Reset(seed, ~uint64_t(0), 0); // A frame that the actions' streams won't reach
+}
+
+void PInternalState_t::StartAction(PActionBase& A)
+{
+    // A fused action starts each of its actions instead, so that the actions after it get the same random number streams as if it weren't fused.
+    if (std::vector<std::shared_ptr<PActionBase>>* fused = A.GetFusedActions()) {
+        for (auto& F : *fused) StartAction(*F);
+    } else {
+        A.dt = get_dt();
+        A.seed = seed;
+        A.frame = next_rng_frame();
+    }
+
+    if (!adaptive_execution)
+        A.cost = NULL; // Its loops run serially
+    else if (!A.cost)
+        A.cost = &get_action_cost(A.GetName());
+
+    A.Prepare();
 }
 
 // Return an index into the list of particle groups where p_group_count groups can be added
@@ -62,6 +215,7 @@ int PInternalState_t::GeneratePGroups(int pgroups_requested)
 {
     int old_size = (int)getPGroups().size();
     getPGroups().resize(old_size + pgroups_requested);
+    for (int i = old_size; i < (int)getPGroups().size(); i++) getPGroups()[i].SetScheduler(scheduler);
 
     return old_size;
 }
@@ -75,6 +229,70 @@ int PInternalState_t::GenerateALists(int alists_requested)
     return old_size;
 }
 
+// Drop the actions that change no particle. Then move each action that kills particles up to the kill action before it, if the actions in
+// between are in the same segment and don't write what it reads. The kills are tagged and committed at the end of the segment either way.
+void PInternalState_t::OptimizeActionList(ActionList& AList)
+{
+    AList.erase(std::remove_if(AList.begin(), AList.end(), [](std::shared_ptr<PActionBase>& A) { return A->IsNoOp(); }), AList.end());
+
+    ActionList::iterator last_kill = AList.end();
+    for (ActionList::iterator it = AList.begin(); it != AList.end(); it++) {
+        PActionBase& A = **it;
+        if (!A.GetKillsParticles()) continue;
+
+        if (last_kill != AList.end() && A.GetReads() && !A.GetDoNotSegment() &&
+            std::all_of(last_kill + 1, it, [&](std::shared_ptr<PActionBase>& B) {
+                return !B->GetDoNotSegment() && !B->GetSeesKills() && !(B->GetWrites() & A.GetReads());
+            })) {
+            std::rotate(last_kill + 1, it, it + 1);
+            last_kill++;
+        } else
+            last_kill = it;
+    }
+}
+
+// Replace each run of two or more consecutive actions that can be fused with a PAFused of them.
+// The run is segmentable, since each of its actions is. It reads, writes, and kills whatever any of them do.
+// It is lowered to its instruction stream now, for the current dt.
+void PInternalState_t::FuseActionList(ActionList& AList)
+{
+    ActionList fused;
+    ActionList::iterator it = AList.begin();
+    while (it != AList.end()) {
+        ActionList::iterator rend = it;
+        while (rend != AList.end() && (*rend)->Fuse(NULL)) rend++;
+
+        if (rend - it < 2) {
+            fused.push_back(*it++);
+            continue;
+        }
+
+        PAFused* F = new PAFused;
+        unsigned int reads = 0, writes = 0;
+        bool kills = false;
+        for (; it != rend; it++) {
+            F->actions.push_back(*it);
+            reads |= (*it)->GetReads();
+            writes |= (*it)->GetWrites();
+            kills = kills || (*it)->GetKillsParticles();
+        }
+
+        F->SetKillsParticles(kills);
+        F->SetDoNotSegment(false);
+        F->SetAttribs(reads, writes);
+        F->SetPInternalState(this);
+        F->profile = std::make_shared<ActionProfile_t>();
+        for (auto& A : F->actions) {
+            A->dt = get_dt();
+            A->profile = F->profile; // They are counted together, even when a staged group runs them one at a time.
+        }
+        F->Lower();
+        fused.push_back(std::shared_ptr<PActionBase>(F));
+    }
+
+    AList.swap(fused);
+}
+
 // Action API entry points call this to either store the action in a list or execute it
 void PInternalState_t::SendAction(std::shared_ptr<PActionBase> S)
 {
@@ -83,23 +301,99 @@ void PInternalState_t::SendAction(std::shared_ptr<PActionBase> S)
     if (get_in_new_list()) {
         // Add action S to the end of the current action list.
         ActionList& AList = getALists()[get_alist_id()];
+        S->profile = std::make_shared<ActionProfile_t>();
         AList.push_back(S);
     } else {
         // Immediate mode. Execute it.
-        S->dt = get_dt(); // Provide the action with access to the current dt.
+        if (profiling) {
+            std::shared_ptr<ActionProfile_t>& P = immediate_profiles[std::make_pair(S->GetName(), S->GetAbrv())];
+            if (!P) P = std::make_shared<ActionProfile_t>();
+            S->profile = P;
+        }
+
+        pRandStreamScope scope(rng);
         ParticleGroup& pg = getPGroups()[get_pgroup_id()];
-        S->Execute(pg, pg.begin(), pg.end());
+        try {
+            if (pg.IsStaged()) {
+                ActionList AList;
+                AList.push_back(S);
+                ExecuteStaged(pg, AList.begin(), AList.end());
+            } else {
+                StartAction(*S);
+                ExecuteWhole(pg, *S);
+            }
+        } catch (...) {
+            pg.AbortSegment();
+            throw;
+        }
     }
 }
 
+ActionProfile_t* PInternalState_t::get_profile(PActionBase& A) { return profiling ? A.profile.get() : NULL; }
+
+// Do one action on the whole group as its own segment
+void PInternalState_t::ExecuteWhole(ParticleGroup& pg, PActionBase& A)
+{
+    ActionProfile_t* P = get_profile(A);
+    if (!P) {
+        A.Execute(pg, pg.begin(), pg.end());
+        return;
+    }
+
+    const size_t n = pg.size();
+    const int64_t t0 = NowNs();
+    A.Execute(pg, pg.begin(), pg.end());
+    P->Add(t0, A.GetEmitsParticles() ? 0 : n, 1); // Actions that create particles aren't applied to the existing ones
+    P->segments.fetch_add(1, std::memory_order_relaxed);
+    if (pg.size() < n)
+        P->killed.fetch_add(n - pg.size(), std::memory_order_relaxed);
+    else
+        P->emitted.fetch_add(pg.size() - n, std::memory_order_relaxed);
+}
+
 // Execute an action list
-// To optimize action list memory accesses, at execute time check whether the first action can be combined with
-// the next action. If so, combine them. Then try again. When the current one can't be combined
-// with the next one anymore, execute it.
+// With auto-tuning, the list runs with its own working set size, and its tuner times the calls until it settles on one.
 void PInternalState_t::ExecuteActionList(ActionList& AList)
+{
+    WorkingSetTuner_t& T = AList.tuner;
+    const bool tune = working_set_auto_tune && !T.converged;
+    const int ws = working_set_size;
+    const size_t n = getPGroups()[get_pgroup_id()].size();
+    if (working_set_auto_tune) {
+        if (!T.bytes) T.bytes = StartingWorkingSet();
+        working_set_size = std::max(1, int(T.bytes / sizeof(Particle_t)));
+    }
+
+    int64_t t0 = tune ? NowNs() : 0;
+    try {
+        RunActionList(AList);
+    } catch (...) {
+        // An action threw, perhaps in a task of the scheduler, which passed it on to here. Let the context and group run lists again.
+        getPGroups()[get_pgroup_id()].AbortSegment();
+        working_set_size = ws;
+        set_in_call_list(false);
+        throw;
+    }
+    if (tune) T.Record(double(NowNs() - t0), n);
+
+    working_set_size = ws;
+}
+
+// Run an action list with the current working set size
+// To optimize action list memory accesses, all the actions between those that can't be segmented are done together as a segment,
+// one working set of particles at a time. Actions that kill particles only tag them, and the kills are committed after the segment.
+// Actions that create particles emit them before the segment, and they are run through the rest of the segment and added after it.
+void PInternalState_t::RunActionList(ActionList& AList)
 {
     ParticleGroup& pg = getPGroups()[get_pgroup_id()];
     set_in_call_list(true);
+    pRandStreamScope scope(rng);
+
+    if (pg.IsStaged()) {
+        ExecuteStaged(pg, AList.begin(), AList.end());
+        set_in_call_list(false);
+        return;
+    }
 
     ActionList::iterator it = AList.begin();
     while (it != AList.end()) {
@@ -108,36 +402,229 @@ void PInternalState_t::ExecuteActionList(ActionList& AList)
         ActionList::iterator aend = it + 1;
 
         // If the first one is connectable, try to connect some more.
-        if (!(*abeg)->GetKillsParticles() && !(*abeg)->GetDoNotSegment())
-            while (aend != AList.end() && !(*aend)->GetKillsParticles() && !(*aend)->GetDoNotSegment()) aend++;
+        if (!(*abeg)->GetDoNotSegment()) aend = SegmentEnd(abeg, AList.end());
 
-        // Found a sub-list that can be done together. Now do them.
-        ParticleList::iterator pbeg = pg.begin();
-        ParticleList::iterator pend = ((pg.end() - pbeg) <= get_working_set_size()) ? pg.end() : (pbeg + get_working_set_size());
-        bool one_pass = false;
         if (aend - abeg == 1) {
-            pend = pg.end(); // If a single action, do the whole thing in one whack.
-            one_pass = true;
+            // If a single action, do the whole thing in one whack.
+            StartAction(**abeg);
+            ExecuteWhole(pg, **abeg);
+            it = aend;
+            continue;
         }
 
-        ActionList::iterator ait = abeg;
-        do {
-            // For each chunk of particles, do all the actions in this sub-list
-            ait = abeg;
-            while (ait < aend) {
-                (*ait)->dt = get_dt(); // Provide the action with access to the current dt.
-                (*ait)->Execute(pg, pbeg, pend);
+        // Found a sub-list that can be done together. Now do them.
+        for (ActionList::iterator ait = abeg; ait != aend; ait++) StartAction(**ait);
+        if (ActionProfile_t* P = get_profile(**abeg)) P->segments.fetch_add(1, std::memory_order_relaxed);
+        std::vector<size_t> emitted_counts = EmitSegment(pg, abeg, aend);
 
-                ait++;
-            }
-            if (!one_pass) { // If we're not one_pass then we know we didn't do any actions that mangle our iterators.
-                pbeg = pend;
-                pend = ((pg.end() - pbeg) <= get_working_set_size()) ? pg.end() : (pbeg + get_working_set_size());
+        // Each chunk of particles is a working set that fits in cache. The chunks are independent, so each is a task of the context's scheduler
+        // that runs the whole segment on it, unless an action of the segment must see one chunk at a time.
+        const size_t n = pg.size(), ws = get_working_set_size(), nchunks = (n + ws - 1) / ws;
+        if (std::any_of(abeg, aend, [](std::shared_ptr<PActionBase>& A) { return A->GetKillsParticles(); })) pg.GetKills(); // Size the tags first
+
+        auto DoChunk = [&](const size_t c) {
+            ParticleList::iterator pbeg = pg.begin() + c * ws, pend = pg.begin() + std::min(n, c * ws + ws);
+
+            for (ActionList::iterator ait = abeg; ait != aend; ait++) {
+                PActionBase& A = **ait;
+                if (A.GetEmitsParticles()) continue;
+
+                ActionProfile_t* P = get_profile(A);
+                const size_t first = pbeg - pg.begin(), k0 = P ? KillCount(pg, A, first, pend - pbeg) : 0;
+                const int64_t t0 = P ? NowNs() : 0;
+                if (A.GetKillsParticles())
+                    A.TagKills(pg, pbeg, pend, first);
+                else
+                    A.Execute(pg, pbeg, pend);
+                if (P) ProfileChunk(pg, A, *P, t0, k0, first, pend - pbeg, false);
             }
-        } while ((!one_pass) && pbeg != pg.end());
-        it = ait;
+        };
+
+        if (std::any_of(abeg, aend, [](std::shared_ptr<PActionBase>& A) { return A->GetSerialChunks(); }))
+            for (size_t c = 0; c < nchunks; c++) DoChunk(c);
+        else
+            pg.GetScheduler().ForEach(nchunks, 1, DoChunk);
+
+        FinishSegment(pg, abeg, aend, emitted_counts);
+        it = aend;
     }
 
     set_in_call_list(false);
 }
+
+// The segment that starts at abeg runs up to the next action that can't be segmented. The kills of a segment are only committed at its end,
+// so it also ends before an action that must not see killed particles and comes after a kill action. Otherwise a Source() would count the
+// killed particles against the group's max particles, and a Callback() would be given them.
+ActionList::iterator PInternalState_t::SegmentEnd(ActionList::iterator abeg, ActionList::iterator aend)
+{
+    bool kills = false;
+    ActionList::iterator it = abeg;
+    for (; it != aend && !(*it)->GetDoNotSegment(); it++) {
+        if (kills && (*it)->GetSeesKills()) break;
+        kills = kills || (*it)->GetKillsParticles();
+    }
+
+    return it;
+}
+
+// Run the actions of a segment that create particles, which add them to the group's emitted list before the rest of the segment runs.
+// Returns how many particles had been emitted after each action of the segment, or nothing if no action of the segment emits.
+std::vector<size_t> PInternalState_t::EmitSegment(ParticleGroup& pg, ActionList::iterator abeg, ActionList::iterator aend)
+{
+    std::vector<size_t> emitted_counts;
+    if (std::none_of(abeg, aend, [](std::shared_ptr<PActionBase>& A) { return A->GetEmitsParticles(); })) return emitted_counts;
+
+    for (ActionList::iterator ait = abeg; ait != aend; ait++) {
+        if ((*ait)->GetEmitsParticles()) {
+            ActionProfile_t* P = get_profile(**ait);
+            const size_t n = pg.GetEmitted().size();
+            const int64_t t0 = P ? NowNs() : 0;
+            (*ait)->Emit(pg);
+            if (P) {
+                P->Add(t0, 0, 1);
+                P->emitted.fetch_add(pg.GetEmitted().size() - n, std::memory_order_relaxed);
+            }
+        }
+        emitted_counts.push_back(pg.GetEmitted().size());
+    }
+
+    return emitted_counts;
+}
+
+// Apply each action of a segment to the particles emitted by the actions before it, then add the emitted particles to the group
+// and remove the particles that were killed during the segment.
+void PInternalState_t::FinishSegment(ParticleGroup& pg, ActionList::iterator abeg, ActionList::iterator aend, const std::vector<size_t>& emitted_counts)
+{
+    ParticleList& emitted = pg.GetEmitted();
+    const size_t first = pg.size(); // The emitted particles' index in the group once they are added
+    ActionProfile_t* prev_P = NULL;
+
+    for (size_t a = 1; a < emitted_counts.size(); a++) {
+        PActionBase& A = *abeg[a];
+        ParticleList::iterator ebeg = emitted.begin(), eend = emitted.begin() + emitted_counts[a - 1]; // Those emitted before this action
+        if (A.GetEmitsParticles() || ebeg == eend) continue;
+        if (A.GetWrites() && !(A.GetWrites() & pg.GetAttribs())) continue; // It only writes attributes the group doesn't store.
+
+        ActionProfile_t* P = get_profile(A);
+        const size_t k0 = P ? KillCount(pg, A, first, eend - ebeg) : 0;
+        const int64_t t0 = P ? NowNs() : 0;
+        const bool again = P && P == prev_P;
+        prev_P = P;
+        if (A.GetKillsParticles())
+            A.TagKills(pg, ebeg, eend, first);
+        else
+            A.Execute(pg, ebeg, eend);
+        if (P) ProfileChunk(pg, A, *P, t0, k0, first, eend - ebeg, again);
+    }
+
+    pg.MergeEmitted();
+    pg.CommitKills();
+}
+
+// Return how many of the count particles starting at index first of the group are tagged to be killed, if A kills particles
+size_t PInternalState_t::KillCount(ParticleGroup& pg, PActionBase& A, const size_t first, const size_t count)
+{
+    return A.GetKillsParticles() ? pg.GetKills().Count(first, first + count) : 0;
+}
+
+// Count an application of A to the count particles starting at index first of the group. It started at time t0, with k0 of them tagged.
+// If again, P already counted these particles for another action of the same PAFused, so only the time and kills are added.
+void PInternalState_t::ProfileChunk(ParticleGroup& pg, PActionBase& A, ActionProfile_t& P, const int64_t t0, const size_t k0, const size_t first,
+                                    const size_t count, const bool again)
+{
+    P.Add(t0, again ? 0 : count, again ? 0 : 1);
+    if (A.GetKillsParticles()) P.killed.fetch_add(KillCount(pg, A, first, count) - k0, std::memory_order_relaxed);
+}
+
+// Execute actions on a group that isn't P_LAYOUT_AOS
+// Each segment of actions is applied to one working set of particles at a time, copying only the attributes that the segment touches
+// out of the store and back. Killing and emitting actions are handled as in ExecuteActionList().
+void PInternalState_t::ExecuteStaged(ParticleGroup& pg, ActionList::iterator abeg, ActionList::iterator aend)
+{
+    // Fused actions only pay on P_LAYOUT_AOS. The staged chunks are already in cache, and block kernels vectorize one action at a time.
+    if (std::any_of(abeg, aend, [](std::shared_ptr<PActionBase>& A) { return A->GetFusedActions() != NULL; })) {
+        ActionList unfused;
+        for (ActionList::iterator ait = abeg; ait != aend; ait++) {
+            if (std::vector<std::shared_ptr<PActionBase>>* fused = (*ait)->GetFusedActions())
+                unfused.insert(unfused.end(), fused->begin(), fused->end());
+            else
+                unfused.push_back(*ait);
+        }
+        ExecuteStaged(pg, unfused.begin(), unfused.end());
+        return;
+    }
+
+    ActionList::iterator it = abeg;
+    while (it != aend) {
+        if ((*it)->GetDoNotSegment()) {
+            // Do this action on the whole group.
+            PActionBase& A = **it;
+            StartAction(A);
+            pg.Unpack(A.GetReads() | A.GetWrites());
+            ExecuteWhole(pg, A);
+            pg.Pack(A.GetWrites());
+            it++;
+            continue;
+        }
+
+        // Make an action segment
+        ActionList::iterator send = SegmentEnd(it, aend);
+        unsigned int reads = 0, writes = 0;
+        for (ActionList::iterator ait = it; ait != send; ait++) {
+            reads |= (*ait)->GetReads() | (*ait)->GetWrites();
+            writes |= (*ait)->GetWrites();
+        }
+
+        // Blocked stores run the actions that have block kernels in place, so their chunks are whole blocks and only the other actions are staged.
+        ParticleBlock_t* blocks = pg.GetBlocks();
+        size_t ws = get_working_set_size();
+        if (blocks) ws = std::max(ws - ws % P_BLOCK_WIDTH, (size_t)P_BLOCK_WIDTH);
+
+        for (ActionList::iterator ait = it; ait != send; ait++) StartAction(**ait);
+        if (ActionProfile_t* P = get_profile(**it)) P->segments.fetch_add(1, std::memory_order_relaxed);
+        std::vector<size_t> emitted_counts = EmitSegment(pg, it, send);
+
+        // For each chunk of particles, do all the actions in this segment
+        for (size_t first = 0; first < pg.size(); first += ws) {
+            size_t count = std::min(ws, pg.size() - first);
+            ParticleBlock_t* bbeg = blocks ? blocks + first / P_BLOCK_WIDTH : NULL;
+            ParticleBlock_t* bend = blocks ? blocks + (first + count + P_BLOCK_WIDTH - 1) / P_BLOCK_WIDTH : NULL;
+            ParticleList* chunk = blocks ? NULL : &pg.Stage(first, count, reads);
+            ActionProfile_t* prev_P = NULL; // The actions of a PAFused share one profile, which counts the chunk once.
+
+            for (ActionList::iterator ait = it; ait != send; ait++) {
+                PActionBase& A = **ait;
+                if (A.GetEmitsParticles()) continue;
+                if (A.GetWrites() && !(A.GetWrites() & pg.GetAttribs())) continue; // It only writes attributes the group doesn't store.
+
+                ActionProfile_t* P = get_profile(A);
+                const size_t k0 = P ? KillCount(pg, A, first, count) : 0;
+                const int64_t t0 = P ? NowNs() : 0;
+                const bool again = P && P == prev_P;
+                prev_P = P;
+
+                if (blocks) {
+                    if (A.ExecuteBlocks(pg, bbeg, bend)) {
+                        if (P) ProfileChunk(pg, A, *P, t0, k0, first, count, again);
+                        continue;
+                    }
+                    chunk = &pg.Stage(first, count, A.GetReads() | A.GetWrites());
+                }
+
+                if (A.GetKillsParticles())
+                    A.TagKills(pg, chunk->begin(), chunk->end(), first);
+                else
+                    A.Execute(pg, chunk->begin(), chunk->end());
+
+                if (blocks) pg.Unstage(first, count, A.GetWrites());
+                if (P) ProfileChunk(pg, A, *P, t0, k0, first, count, again);
+            }
+
+            if (!blocks) pg.Unstage(first, count, writes);
+        }
+
+        FinishSegment(pg, it, send, emitted_counts);
+        it = send;
+    }
+}
 }; // namespace PAPI
@@ -11,17 +11,80 @@
 #include "Particle/pAPIContext.h"
 #include "ParticleGroup.h"
 
+#include <atomic>
+#include <chrono>
+#include <map>
 #include <string>
 #include <vector>
 
 namespace PAPI {
 struct PActionBase;
 
+// Tunes the working set size of one action list by timing its calls once the group size has settled. It starts at the size of the L2 cache
+// and steps up, then down, by factors of two while that makes the calls faster per particle, then keeps the fastest size. Each size counts
+// the faster of two calls.
+struct WorkingSetTuner_t {
+    size_t bytes = 0;       // The size being timed, or the tuned size once converged. 0 until the first call.
+    size_t best_bytes = 0;  // The fastest size timed so far
+    double best_ns = 0;     // Its time per particle
+    double ns = 0;          // The fastest time per particle of the calls timed at bytes
+    int samples = 0;        // How many calls have been timed at bytes
+    size_t last_n = 0;      // The group size of the previous call
+    int dir = 1;            // 1 while trying larger sizes, -1 while trying smaller ones
+    bool moved = false;     // True once a size other than the first one was faster
+    bool converged = false;
+
+    // Update the tuner with a call that took call_ns nanoseconds on a group of n particles
+    void Record(const double call_ns, const size_t n);
+};
+
 class ActionList : public std::vector<std::shared_ptr<PActionBase>> {
 public:
+    WorkingSetTuner_t tuner; // Only used when the working set size is auto-tuned
+
     ActionList() {}
 };
 
+// Nanoseconds on a steady clock. The action costs, the working set tuner, and the action profiles are all timed with this.
+inline int64_t NowNs() { return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count(); }
+
+// The profiling counters of an action in a list, or of the immediate mode actions with one name. Chunks of a list update them in parallel.
+struct ActionProfile_t {
+    std::atomic<uint64_t> ns{0};        // Time spent in the action, summed over the threads that ran its chunks
+    std::atomic<uint64_t> particles{0}; // Particles it was applied to
+    std::atomic<uint64_t> chunks{0};    // Working sets, whole groups, and batches of emitted particles it was applied to
+    std::atomic<uint64_t> segments{0};  // Segments of the list that started at it, each of which reloads the particles
+    std::atomic<uint64_t> killed{0};    // Particles it killed
+    std::atomic<uint64_t> emitted{0};   // Particles it created
+
+    // Count an application to count particles in n_chunks chunks that started at time t0
+    inline void Add(const int64_t t0, const size_t count, const size_t n_chunks)
+    {
+        ns.fetch_add(NowNs() - t0, std::memory_order_relaxed);
+        particles.fetch_add(count, std::memory_order_relaxed);
+        chunks.fetch_add(n_chunks, std::memory_order_relaxed);
+    }
+};
+
+// The measured cost of a type of action, shared by all the actions with that name. The actions use it to choose whether to run their loop
+// serially or as tasks of the scheduler. The chunks of action lists update it in parallel, so its fields are atomic and updates may be lost.
+struct ActionCost_t {
+    std::atomic<float> ns_per_particle{0.f}; // The time to run the action on one particle on one thread. 0 until measured.
+    std::atomic<uint64_t> calls{0};          // How many loops over particles of this type of action have run
+    std::atomic<uint64_t> parallel_calls{0}; // How many of them ran as tasks of the scheduler
+    std::atomic<uint64_t> particles{0};      // How many particles they ran on
+    std::atomic<size_t> grain{0};            // The particles per task of the most recent parallel loop
+
+    // Return how many particles per task to run a loop over n particles with on a scheduler of the given thread count, or 0 to run it serially
+    size_t Grain(const size_t n, const int threads) const;
+
+    // Update the cost with a loop over n particles that took ns nanoseconds of thread time in total
+    void Record(const size_t n, const double ns, const size_t grain);
+
+    // Return the fewest particles a loop must have to run in parallel, or 0 if not measured yet
+    size_t MinParallelParticles() const;
+};
+
 // This is the per-thread state of the API. All API calls get their data from here.
 // In the non-multithreaded case there is one global instance of this class.
 class PInternalState_t {
@@ -35,6 +98,10 @@ public:
     int get_alist_id() const { return alist_id; }
     int get_pgroup_id() const { return pgroup_id; }
     int get_working_set_size() const { return working_set_size; }
+    std::shared_ptr<pScheduler_t> get_scheduler() const { return scheduler; }
+    bool get_adaptive_execution() const { return adaptive_execution; }
+    bool get_working_set_auto_tune() const { return working_set_auto_tune; }
+    bool get_profiling() const { return profiling; }
 
     void set_alist_id(const int alist_id_) { alist_id = alist_id_; }
     void set_dt(const float dt_) { dt = dt_; }
@@ -43,11 +110,38 @@ public:
     void set_in_particle_loop(const int in_particle_loop_) { in_particle_loop = in_particle_loop_; }
     void set_pgroup_id(const int pgroup_id_) { pgroup_id = pgroup_id_; }
     void set_working_set_size(const int working_set_size_) { working_set_size = working_set_size_; }
+    void set_seed(const uint32_t seed_);
+    void set_scheduler(std::shared_ptr<pScheduler_t> scheduler_); // Also gives it to the particle groups
+    void set_adaptive_execution(const bool adaptive_execution_) { adaptive_execution = adaptive_execution_; }
+    void set_working_set_auto_tune(const bool working_set_auto_tune_) { working_set_auto_tune = working_set_auto_tune_; }
+    void set_profiling(const bool profiling_) { profiling = profiling_; }
+
+    ActionProfile_t* get_profile(PActionBase& A); // The counters to update for an execution of A, or NULL if not profiling
+    std::map<std::pair<std::string, std::string>, std::shared_ptr<ActionProfile_t>>& get_immediate_profiles() { return immediate_profiles; }
+
+    ActionCost_t& get_action_cost(const std::string& name) { return action_costs[name]; } // Not thread safe if name is new
+    std::map<std::string, ActionCost_t>& get_action_costs() { return action_costs; }
+
+    uint32_t get_seed() const { return seed; }
+    uint64_t next_rng_frame() { return rng_frame++; } // Each execution of an action gets its own random number streams
+    pRandStream_t& get_rng() { return rng; }
 
     int GenerateALists(int alists_requested);
     int GeneratePGroups(int pgroups_requested);
     void ExecuteActionList(ActionList& AList);       // Execute an action list
+    void RunActionList(ActionList& AList);           // Execute an action list with the current working set size
+    void OptimizeActionList(ActionList& AList);      // Drop no-op actions and gather kill actions together
+    void FuseActionList(ActionList& AList);          // Replace runs of actions that only touch their own particle with a PAFused of them
     void SendAction(std::shared_ptr<PActionBase> S); // Action API entry points call this to either store the action in a list or execute and delete it.
+    void ExecuteStaged(ParticleGroup& pg, ActionList::iterator abeg, ActionList::iterator aend); // Execute actions on a group that isn't P_LAYOUT_AOS
+    ActionList::iterator SegmentEnd(ActionList::iterator abeg, ActionList::iterator aend); // The end of the segment that starts at abeg
+    std::vector<size_t> EmitSegment(ParticleGroup& pg, ActionList::iterator abeg, ActionList::iterator aend); // Run the segment's emitting actions
+    void FinishSegment(ParticleGroup& pg, ActionList::iterator abeg, ActionList::iterator aend, const std::vector<size_t>& emitted_counts);
+    void StartAction(PActionBase& A); // Provide the action with the current dt and the key of its random number streams
+    void ExecuteWhole(ParticleGroup& pg, PActionBase& A); // Do one action on the whole group as its own segment
+    size_t KillCount(ParticleGroup& pg, PActionBase& A, const size_t first, const size_t count); // For the profile of A
+    void ProfileChunk(ParticleGroup& pg, PActionBase& A, ActionProfile_t& P, const int64_t t0, const size_t k0, const size_t first, const size_t count,
+                      const bool again);
 
     std::vector<ActionList>& getALists() { return ALists; }
     std::vector<ParticleGroup>& getPGroups() { return PGroups; }
@@ -59,7 +153,18 @@ private:
     float dt;
     int alist_id;
     int pgroup_id;
-    int working_set_size; // How many particles will fit in cache
+    int working_set_size;       // How many particles will fit in cache
+    bool working_set_auto_tune; // True if each action list tunes its own working set size instead
+    uint32_t seed;              // The random number seed of this context
+    uint64_t rng_frame;         // How many actions have been given random number streams
+    pRandStream_t rng;          // The stream for random numbers that aren't per particle, such as how many particles Source() makes
+
+    std::shared_ptr<pScheduler_t> scheduler;          // Runs the parallel loops of the context's actions and particle groups
+    bool adaptive_execution;                          // True if actions choose serial or parallel loops from their measured cost
+    std::map<std::string, ActionCost_t> action_costs; // By action name
+
+    bool profiling; // True if the actions' profiling counters are updated
+    std::map<std::pair<std::string, std::string>, std::shared_ptr<ActionProfile_t>> immediate_profiles; // Of the immediate mode actions, by name and abrv
 
     std::vector<ActionList> ALists;
     std::vector<ParticleGroup> PGroups;
@@ -0,0 +1,67 @@
+/// ParticleAllocator.cpp
+///
+/// Copyright 1997-2007, 2022 by David K. McAllister
+///
+/// This file implements the memory allocation of particle groups.
+
+#include "ParticleAllocator.h"
+
+#include <new>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+namespace PAPI {
+
+namespace {
+const size_t P_PAGE_SIZE = 4096;
+const size_t P_HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+// Allocations at least this big with huge page flags are mapped directly so they can be backed by huge pages
+inline bool UseMap(const size_t bytes, const unsigned int flags) { return (flags & (P_MEM_HUGE_PAGES | P_MEM_HUGETLB)) && bytes >= P_HUGE_PAGE_SIZE; }
+
+inline size_t RoundUp(const size_t bytes, const size_t align) { return (bytes + align - 1) / align * align; }
+}; // namespace
+
+void* pAllocParticleMemory(const size_t bytes, const unsigned int flags)
+{
+    if (bytes == 0) return NULL;
+
+    void* p = NULL;
+#ifdef __linux__
+    if (UseMap(bytes, flags)) {
+        size_t mbytes = RoundUp(bytes, P_HUGE_PAGE_SIZE);
+        if (flags & P_MEM_HUGETLB) p = mmap(NULL, mbytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p == MAP_FAILED || p == NULL) {
+            // The reserved huge page pool is empty or wasn't asked for. Ask for transparent huge pages instead.
+            p = mmap(NULL, mbytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (p == MAP_FAILED) throw std::bad_alloc();
+            madvise(p, mbytes, MADV_HUGEPAGE);
+        }
+    }
+#endif
+    if (!p) p = ::operator new(bytes, std::align_val_t(P_CACHE_LINE_SIZE));
+
+    if (flags & P_MEM_PREFAULT) {
+        // Touch every page now so that the first sweeps over the group don't take page faults
+        volatile char* c = static_cast<char*>(p);
+        for (size_t i = 0; i < bytes; i += P_PAGE_SIZE) c[i] = 0;
+    }
+
+    return p;
+}
+
+void pFreeParticleMemory(void* p, const size_t bytes, const unsigned int flags)
+{
+    if (!p) return;
+
+#ifdef __linux__
+    if (UseMap(bytes, flags)) {
+        munmap(p, RoundUp(bytes, P_HUGE_PAGE_SIZE));
+        return;
+    }
+#endif
+    ::operator delete(p, std::align_val_t(P_CACHE_LINE_SIZE));
+}
+}; // namespace PAPI
@@ -0,0 +1,48 @@
+/// ParticleAllocator.h
+///
+/// Copyright 1997-2007, 2022 by David K. McAllister
+///
+/// An allocator for arrays of particles that aligns them to cache lines and can back them with huge pages
+///
+/// Defines these classes: ParticleAllocator
+
+#ifndef ParticleAllocator_h
+#define ParticleAllocator_h
+
+#include "Particle/pDeclarations.h"
+
+#include <cstddef>
+#include <type_traits>
+
+namespace PAPI {
+
+const size_t P_CACHE_LINE_SIZE = 64;
+
+// Allocate bytes of memory aligned to P_CACHE_LINE_SIZE as requested by the pGroupMemory_E flags. Throws std::bad_alloc on failure.
+void* pAllocParticleMemory(const size_t bytes, const unsigned int flags);
+
+// Free memory from pAllocParticleMemory() with the same bytes and flags
+void pFreeParticleMemory(void* p, const size_t bytes, const unsigned int flags);
+
+// The flags are part of the allocator, so they follow the particles when a group is copied or swapped.
+template <class T> class ParticleAllocator {
+public:
+    typedef T value_type;
+    typedef std::true_type propagate_on_container_copy_assignment;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    unsigned int flags; // pGroupMemory_E flags
+
+    ParticleAllocator(const unsigned int flags_ = P_MEM_DEFAULT) noexcept : flags(flags_) {}
+    template <class U> ParticleAllocator(const ParticleAllocator<U>& rhs) noexcept : flags(rhs.flags) {}
+
+    T* allocate(const size_t n) { return static_cast<T*>(pAllocParticleMemory(n * sizeof(T), flags)); }
+    void deallocate(T* p, const size_t n) { pFreeParticleMemory(p, n * sizeof(T), flags); }
+
+    template <class U> bool operator==(const ParticleAllocator<U>& rhs) const { return flags == rhs.flags; }
+    template <class U> bool operator!=(const ParticleAllocator<U>& rhs) const { return flags != rhs.flags; }
+};
+}; // namespace PAPI
+
+#endif
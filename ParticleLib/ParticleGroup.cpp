@@ -0,0 +1,103 @@
+/// ParticleGroup.cpp
+///
+/// Copyright 1997-2007, 2022 by David K. McAllister
+///
+/// This file implements the removal of killed particles from a ParticleGroup by parallel stream compaction.
+
+#include "ParticleGroup.h"
+
+#include <algorithm>
+#include <numeric>
+#include <vector>
+
+namespace PAPI {
+
+namespace {
+// Particles per chunk of the compaction. A multiple of 64 so that each chunk has its own words of the kill bitmap.
+const size_t P_KILL_CHUNK = 4096;
+} // namespace
+
+// Compact in three passes: count what each chunk of the group contributes, prefix sum the counts to find where each chunk's
+// particles go, then copy each chunk's particles there in parallel.
+void ParticleGroup::CommitKills()
+{
+    if (!kills.Any()) return;
+
+    const size_t n = size();
+    kills.Reserve(n);
+    const size_t m = n - kills.Count(n); // How many particles survive
+
+    if (cb_death) {
+        for (size_t i = kills.NextSet(0, n); i < n; i = kills.NextSet(i + 1, n)) {
+            if (IsStaged()) {
+                Particle_t p = Get(i);
+                (*cb_death)(p, group_death_data);
+            } else
+                (*cb_death)(list[i], group_death_data);
+        }
+    }
+
+    const size_t nchunks = (n + P_KILL_CHUNK - 1) / P_KILL_CHUNK;
+    std::vector<size_t> offsets(nchunks);
+
+    if (!preserve_order) {
+        // Each killed particle in [0, m) is a hole. Fill the holes, in order, with the survivors in [m, n), in order.
+        // There are as many of one as the other, and the two ranges don't overlap, so all chunks can move particles at once.
+        std::vector<size_t> fill_offsets(nchunks);
+        GetScheduler().ForEach(nchunks, 1, [&](const size_t c) {
+            size_t c0 = c * P_KILL_CHUNK, c1 = std::min(c0 + P_KILL_CHUNK, n);
+            size_t h1 = std::min(c1, m), f0 = std::max(c0, m);
+            offsets[c] = c0 < h1 ? kills.Count(c0, h1) : 0;
+            fill_offsets[c] = f0 < c1 ? (c1 - f0) - kills.Count(f0, c1) : 0;
+        });
+        std::exclusive_scan(offsets.begin(), offsets.end(), offsets.begin(), size_t(0));
+        std::exclusive_scan(fill_offsets.begin(), fill_offsets.end(), fill_offsets.begin(), size_t(0));
+
+        GetScheduler().ForEach(nchunks, 1, [&](const size_t c) {
+            size_t c0 = c * P_KILL_CHUNK, h1 = std::min(c0 + P_KILL_CHUNK, m);
+            size_t i = c0 < h1 ? kills.NextSet(c0, h1) : h1;
+            if (i >= h1) return;
+
+            // Find the survivor whose rank matches this chunk's first hole
+            size_t fc = std::upper_bound(fill_offsets.begin(), fill_offsets.end(), offsets[c]) - fill_offsets.begin() - 1;
+            size_t j = kills.NextClear(std::max(fc * P_KILL_CHUNK, m), n);
+            for (size_t skip = offsets[c] - fill_offsets[fc]; skip; skip--) j = kills.NextClear(j + 1, n);
+
+            for (; i < h1; i = kills.NextSet(i + 1, h1)) {
+                if (IsStaged())
+                    store->Move(i, j);
+                else
+                    list[i] = list[j];
+                j = kills.NextClear(j + 1, n);
+            }
+        });
+    } else if (IsStaged()) {
+        // The stores compact in place, so later particles would overwrite earlier ones that haven't moved yet if done in parallel.
+        size_t d = 0;
+        for (size_t i = kills.NextClear(0, n); i < n; i = kills.NextClear(i + 1, n), d++)
+            if (d != i) store->Move(d, i);
+    } else {
+        GetScheduler().ForEach(nchunks, 1, [&](const size_t c) {
+            size_t c0 = c * P_KILL_CHUNK, c1 = std::min(c0 + P_KILL_CHUNK, n);
+            offsets[c] = (c1 - c0) - kills.Count(c0, c1);
+        });
+        std::exclusive_scan(offsets.begin(), offsets.end(), offsets.begin(), size_t(0));
+
+        if (scratch.get_allocator() != list.get_allocator()) ParticleList(list.get_allocator()).swap(scratch);
+        scratch.reserve(list.capacity());
+        scratch.resize(m);
+        GetScheduler().ForEach(nchunks, 1, [&](const size_t c) {
+            size_t c0 = c * P_KILL_CHUNK, c1 = std::min(c0 + P_KILL_CHUNK, n);
+            size_t d = offsets[c];
+            for (size_t i = kills.NextClear(c0, c1); i < c1; i = kills.NextClear(i + 1, c1)) scratch[d++] = list[i];
+        });
+        list.swap(scratch);
+    }
+
+    if (IsStaged())
+        store->resize(m);
+    else
+        list.resize(m);
+    kills.Truncate(0);
+}
+}; // namespace PAPI
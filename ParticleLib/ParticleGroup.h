@@ -2,7 +2,7 @@
 ///
 /// Copyright 1997-2007, 2022 by David K. McAllister
 ///
-/// A group of particles - Info and an array of Particles
+/// A group of particles - Info and an array of Particles, or a ParticleStore for other layouts
 ///
 /// Defines these classes: ParticleGroup
 
@@ -10,9 +10,14 @@
 #define ParticleGroup_h
 
 #include "LibHelpers.h"
+#include "Particle/pInternalShadow.h"
 #include "Particle/pParticle.h"
+#include "Particle/pScheduler.h"
+#include "ParticleAllocator.h"
+#include "ParticleStore.h"
 
 #include <algorithm>
+#include <string>
 #include <vector>
 
 namespace PAPI {
@@ -24,8 +29,10 @@ typedef void (*P_PARTICLE_CALLBACK)(struct Particle_t& particle, pdata_t data);
 /// This is the type of the callback functions that you can register for the Callback() action.
 typedef void (*P_PARTICLE_CALLBACK_ACTION)(struct Particle_t& particle, pdata_t data, float dt);
 
-typedef std::vector<Particle_t> ParticleList;
+typedef std::vector<Particle_t, ParticleAllocator<Particle_t>> ParticleList;
 
+// The particles are stored in list when the layout is P_LAYOUT_AOS. For other layouts they live in store and are copied through
+// the small stage list a chunk at a time, or are unpacked into list for actions that need the whole group at once.
 class ParticleGroup {
     ParticleList list;
 
@@ -36,6 +43,33 @@ private:
     pdata_t group_birth_data;     // Pass this to the birth callback
     pdata_t group_death_data;     // Pass this to the death callback
 
+    pGroupLayout_E layout;                // How the particles are stored
+    std::shared_ptr<ParticleStore> store; // The particles, if layout is not P_LAYOUT_AOS
+    ParticleList stage;                   // The chunk of particles currently copied out of store
+    size_t stage_first;                   // The index in the group of the first particle of stage
+    bool unpacked;                        // True if the whole store has been copied to list
+    KillBitmap_t kills;                   // One bit per particle, set for the particles to remove at the next CommitKills()
+    bool preserve_order;                  // True if killing particles must keep the survivors in order
+    ParticleList scratch;                 // The survivors are compacted here, then swapped with list
+    ParticleList emitted;                 // Particles created while running a segment of actions, added to the group after it
+    std::shared_ptr<pScheduler_t> sched;  // The scheduler of the group's context, which runs its parallel loops
+
+    // Call the death callback on all particles. Used before discarding the whole group.
+    void KillAll()
+    {
+        if (!cb_death) return;
+
+        if (IsStaged()) {
+            for (size_t i = 0; i < store->size(); i++) {
+                Particle_t m = Get(i);
+                (*cb_death)(m, group_death_data);
+            }
+        } else {
+            ParticleList::iterator it;
+            for (it = list.begin(); it != list.end(); ++it) (*cb_death)((*it), group_death_data);
+        }
+    }
+
 public:
     ParticleGroup()
     {
@@ -44,6 +78,10 @@ public:
         cb_death = NULL;
         group_birth_data = 0;
         group_death_data = 0;
+        layout = P_LAYOUT_AOS;
+        unpacked = false;
+        preserve_order = false;
+        stage_first = 0;
     }
 
     ParticleGroup(size_t maxp) : max_particles(maxp)
@@ -53,6 +91,10 @@ public:
         cb_death = NULL;
         group_birth_data = NULL;
         group_death_data = NULL;
+        layout = P_LAYOUT_AOS;
+        unpacked = false;
+        preserve_order = false;
+        stage_first = 0;
     }
 
     ParticleGroup(const ParticleGroup& rhs) : list(rhs.list)
@@ -62,35 +104,195 @@ public:
         cb_death = rhs.cb_death;
         group_birth_data = rhs.group_birth_data;
         group_death_data = rhs.group_death_data;
+        layout = rhs.layout;
+        store = rhs.store ? rhs.store->copy() : NULL;
+        unpacked = rhs.unpacked;
+        kills = rhs.kills;
+        preserve_order = rhs.preserve_order;
+        sched = rhs.sched;
+        stage_first = 0;
     }
 
-    ~ParticleGroup()
+    // Moving a group moves its storage, so a group mapped to a file keeps the file when the vector of groups grows.
+    ParticleGroup(ParticleGroup&& rhs) noexcept : ParticleGroup() { *this = std::move(rhs); }
+
+    ~ParticleGroup() { KillAll(); }
+
+    ParticleGroup& operator=(const ParticleGroup& rhs)
     {
-        if (cb_death) {
-            ParticleList::iterator it;
-            for (it = list.begin(); it != list.end(); ++it) (*cb_death)((*it), group_death_data);
+        if (this != &rhs) {
+            KillAll();
+            list = rhs.list;
+            cb_birth = rhs.cb_birth;
+            cb_death = rhs.cb_death;
+            group_birth_data = rhs.group_birth_data;
+            group_death_data = rhs.group_death_data;
+            max_particles = rhs.max_particles;
+            layout = rhs.layout;
+            store = rhs.store ? rhs.store->copy() : NULL;
+            unpacked = rhs.unpacked;
+            kills = rhs.kills;
+            preserve_order = rhs.preserve_order;
+            sched = rhs.sched;
         }
+        return *this;
     }
 
-    ParticleGroup& operator=(const ParticleGroup& rhs)
+    ParticleGroup& operator=(ParticleGroup&& rhs) noexcept
     {
         if (this != &rhs) {
-            if (cb_death) {
-                ParticleList::iterator it;
-                for (it = list.begin(); it != list.end(); ++it) (*cb_death)((*it), group_death_data);
-            }
-            list = rhs.list;
+            KillAll();
+            list = std::move(rhs.list);
             cb_birth = rhs.cb_birth;
             cb_death = rhs.cb_death;
             group_birth_data = rhs.group_birth_data;
             group_death_data = rhs.group_death_data;
             max_particles = rhs.max_particles;
+            layout = rhs.layout;
+            store = std::move(rhs.store);
+            stage = std::move(rhs.stage);
+            stage_first = rhs.stage_first;
+            unpacked = rhs.unpacked;
+            kills = std::move(rhs.kills);
+            preserve_order = rhs.preserve_order;
+            scratch = std::move(rhs.scratch);
+            emitted = std::move(rhs.emitted);
+            sched = std::move(rhs.sched);
+
+            // rhs is left empty, so destroying it calls no death callbacks
+            rhs.list.clear();
+            rhs.unpacked = false;
         }
         return *this;
     }
 
     inline size_t GetMaxParticles() { return max_particles; }
     inline ParticleList& GetList() { return list; }
+    inline pGroupLayout_E GetLayout() const { return layout; }
+    inline bool GetPreserveOrder() const { return preserve_order; }
+    inline void SetPreserveOrder(const bool preserve_order_) { preserve_order = preserve_order_; }
+    inline pScheduler_t& GetScheduler() { return *sched; }
+    inline void SetScheduler(std::shared_ptr<pScheduler_t> sched_) { sched = sched_; }
+
+    // True if the particles currently live in the store rather than in list
+    inline bool IsStaged() const { return store && !unpacked; }
+
+    // The attributes the group stores. Only P_LAYOUT_PACKED groups omit any.
+    inline unsigned int GetAttribs() const { return store ? store->GetAttribs() : PA_ALL; }
+
+    // Change how the particles are stored, moving any existing particles to the new storage.
+    // attribs_ only applies to P_LAYOUT_PACKED. file_name only applies to P_LAYOUT_MAPPED, where empty means a temporary file.
+    void SetLayout(const pGroupLayout_E layout_, const unsigned int attribs_ = PA_ALL, const std::string& file_name = "")
+    {
+        LIB_ASSERT(!unpacked, "Can't change layout while unpacked");
+        if (layout_ == layout && file_name.empty() && GetAttribs() == (layout_ == P_LAYOUT_PACKED ? attribs_ : PA_ALL)) return;
+
+        std::shared_ptr<ParticleStore> new_store;
+        switch (layout_) {
+        case P_LAYOUT_AOS: break;
+        case P_LAYOUT_SOA: new_store = std::shared_ptr<ParticleStore>(new ParticleStoreSoA()); break;
+        case P_LAYOUT_AOSOA: new_store = std::shared_ptr<ParticleStore>(new ParticleStoreAoSoA()); break;
+        case P_LAYOUT_HOTCOLD: new_store = std::shared_ptr<ParticleStore>(new ParticleStoreHotCold()); break;
+        case P_LAYOUT_PACKED: new_store = std::shared_ptr<ParticleStore>(new ParticleStorePacked(attribs_)); break;
+        case P_LAYOUT_MAPPED: new_store = std::shared_ptr<ParticleStore>(new ParticleStoreMapped(file_name)); break;
+        default: LIB_ASSERT(0, "Unknown particle group layout");
+        }
+
+        if (store) {
+            list.resize(store->size());
+            store->Gather(list.data(), 0, list.size(), PA_ALL);
+        }
+        if (new_store) {
+            new_store->reserve(max_particles);
+            new_store->resize(list.size());
+            new_store->Scatter(list.data(), 0, list.size(), PA_ALL);
+            ParticleList(list.get_allocator()).swap(list);
+        } else
+            list.reserve(max_particles);
+
+        store = new_store;
+        layout = layout_;
+    }
+
+    // The blocks of a staged P_LAYOUT_AOSOA group, on which actions with block kernels operate in place. NULL for other groups.
+    inline ParticleBlock_t* GetBlocks() { return IsStaged() ? store->GetBlocks() : NULL; }
+
+    // Change how the memory of list is allocated, given pGroupMemory_E flags
+    void SetMemory(const unsigned int flags)
+    {
+        if (flags == list.get_allocator().flags) return;
+
+        ParticleList new_list{ParticleAllocator<Particle_t>(flags)};
+        new_list.reserve(std::max(max_particles, list.size()));
+        new_list.assign(list.begin(), list.end());
+        list.swap(new_list);
+    }
+
+    // The index in the group of m, which is in list, the stage list, or the emitted list. Emitted particles follow the group's particles.
+    inline size_t IndexOf(const Particle_t& m) const
+    {
+        if (&m >= list.data() && &m < list.data() + list.size()) return &m - list.data();
+        if (&m >= emitted.data() && &m < emitted.data() + emitted.size()) return size() + (&m - emitted.data());
+        return stage_first + (&m - stage.data());
+    }
+
+    // Return a copy of particle i
+    inline Particle_t Get(const size_t i) const
+    {
+        if (!IsStaged()) return list[i];
+
+        Particle_t m;
+        store->Gather(&m, i, 1, PA_ALL);
+        return m;
+    }
+
+    // Copy the given attributes of particles [first, first + count) out of the store into the stage list.
+    inline ParticleList& Stage(const size_t first, const size_t count, const unsigned int attribs)
+    {
+        stage.resize(count);
+        store->Gather(stage.data(), first, count, attribs);
+        stage_first = first;
+        return stage;
+    }
+
+    // Copy the given attributes of the stage list back to particles [first, first + count) of the store.
+    inline void Unstage(const size_t first, const size_t count, const unsigned int attribs) { store->Scatter(stage.data(), first, count, attribs); }
+
+    // Copy the given attributes of all particles from the store to list so actions can see the whole group.
+    // Only attribs == PA_ALL allows the action to add, remove, or reorder particles.
+    // Actions that touch no attributes of existing particles (attribs == 0) work directly on the store.
+    void Unpack(const unsigned int attribs)
+    {
+        if (!IsStaged() || attribs == 0) return;
+
+        list.resize(store->size());
+        store->Gather(list.data(), 0, list.size(), attribs);
+        unpacked = true;
+    }
+
+    // Copy the given attributes of list back to the store after Unpack().
+    void Pack(const unsigned int attribs)
+    {
+        if (!unpacked) return;
+
+        LIB_ASSERT(attribs == PA_ALL || list.size() == store->size(), "Particles were added or removed while partially unpacked");
+        store->resize(list.size());
+        store->Scatter(list.data(), 0, list.size(), attribs);
+        list.clear();
+        unpacked = false;
+    }
+
+    // The kill tags, with room for every particle of the group. Actions that kill particles tag them here, in parallel.
+    inline KillBitmap_t& GetKills()
+    {
+        kills.Reserve(size() + emitted.size());
+        return kills;
+    }
+
+    // Remove the particles that were tagged to be killed. Costs almost nothing if none were tagged.
+    // Unless preserve_order is set, each killed particle is replaced by a survivor from the end of the group.
+    // Otherwise the survivors are packed down in order. Both run in parallel, except an order-preserving compaction of a store.
+    void CommitKills();
 
     inline void SetBirthCallback(P_PARTICLE_CALLBACK callback, pdata_t group_data)
     {
@@ -107,6 +309,21 @@ public:
     inline void SetMaxParticles(size_t maxp)
     {
         max_particles = maxp;
+        kills.Truncate(maxp);
+        if (IsStaged()) {
+            if (store->size() > max_particles) {
+                if (cb_death) {
+                    for (size_t i = max_particles; i < store->size(); i++) {
+                        Particle_t m = Get(i);
+                        (*cb_death)(m, group_death_data);
+                    }
+                }
+                store->resize(max_particles);
+            }
+            store->reserve(max_particles);
+            return;
+        }
+
         if (list.size() > max_particles) {
             if (cb_death) {
                 for (ParticleList::iterator it = list.begin() + max_particles; it != list.end(); ++it) (*cb_death)((*it), group_death_data);
@@ -116,44 +333,65 @@ public:
         list.reserve(max_particles);
     }
 
-    inline size_t size() const { return list.size(); }
+    inline size_t size() const { return IsStaged() ? store->size() : list.size(); }
     inline ParticleList::iterator begin() { return list.begin(); }
     inline ParticleList::iterator end() { return list.end(); }
 
-    // Returns a valid iterator. If we deleted the end, it points to one past last.
-    inline ParticleList::iterator Remove(ParticleList::iterator it)
+    // The particles emitted during the current segment of actions. Their kill tags follow those of the group's particles.
+    inline ParticleList& GetEmitted() { return emitted; }
+
+    // Add count particles to the emitted list for the caller to fill in, all at once. The group doesn't change size until they are merged.
+    inline ParticleList::iterator EmitN(const size_t count)
     {
-        if (cb_death) (*cb_death)((*it), group_death_data);
+        LIB_ASSERT(size() + emitted.size() + count <= max_particles, "Can't emit more particles than the group holds");
 
-        // Copy the one from the end to here.
-        if (it != list.end() - 1) {
-            *it = *(list.end() - 1);
-            list.pop_back(); // Delete the one at the end
-        } else {
-            list.pop_back(); // Delete the one at the end
-            it = list.end();
-        }
+        size_t first = emitted.size();
+        emitted.resize(first + count);
+        return emitted.begin() + first;
+    }
 
-        return it;
+    // Call the birth callback on the emitted particles from ibegin on, once they have been filled in
+    inline void BirthEmitted(ParticleList::iterator ibegin)
+    {
+        if (cb_birth) std::for_each(ibegin, emitted.end(), [&](Particle_t& m) { (*cb_birth)(m, group_birth_data); });
     }
 
-    // Delete whole range of particles
-    inline void RemoveRange(ParticleList::iterator ibegin, ParticleList::iterator iend)
+    // Add the emitted particles to the group
+    void MergeEmitted()
     {
-        LIB_ASSERT(iend == list.end(), "For now, can only delete a range at the end of the list");
+        if (emitted.empty()) return;
 
-        if (cb_death) { // Call death callback, if any
-            std::for_each(/* Could parallelize */ ibegin, iend, [&](Particle_t& m) { (*cb_death)(m, group_death_data); });
-        }
+        if (IsStaged())
+            for (const Particle_t& p : emitted) store->push_back(p);
+        else
+            list.insert(list.end(), emitted.begin(), emitted.end());
+        emitted.clear();
+    }
 
-        list.resize(ibegin - list.begin()); // Delete particles by resizing down to only keep living ones
+    // Forget the state of a segment of actions that threw partway through, so that the group can be used again. Drops the particles the
+    // segment emitted and the kills it tagged, and drops an unpacked copy of the store without writing it back. The particles keep
+    // whatever the segment's actions already wrote to them.
+    void AbortSegment()
+    {
+        emitted.clear();
+        kills.Truncate(0);
+        stage.clear();
+        if (unpacked) {
+            list.clear();
+            unpacked = false;
+        }
     }
 
     inline bool Add(const Particle_t& P)
     {
-        if (list.size() >= max_particles)
+        if (size() >= max_particles)
             return false;
-        else {
+        else if (IsStaged()) {
+            Particle_t p = P;
+            if (cb_birth) (*cb_birth)(p, group_birth_data);
+            store->push_back(p);
+            return true;
+        } else {
             list.push_back(P);
             Particle_t& p = list.back();
             if (cb_birth) (*cb_birth)(p, group_birth_data);
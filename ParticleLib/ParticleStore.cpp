@@ -0,0 +1,114 @@
+/// ParticleStore.cpp
+///
+/// Copyright 1997-2007, 2022 by David K. McAllister
+///
+/// This file implements the particle stores that depend on the operating system.
+
+#include "ParticleStore.h"
+
+#include <filesystem>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace PAPI {
+
+ParticleStoreMapped::ParticleStoreMapped(const std::string& file_name_) : file_name(file_name_), parts(NULL), nparticles(0), capacity(0) { Open(); }
+
+ParticleStoreMapped::ParticleStoreMapped(const ParticleStoreMapped& rhs) : parts(NULL), nparticles(0), capacity(0)
+{
+    Open();
+    resize(rhs.size());
+    Scatter(rhs.parts, 0, rhs.size(), PA_ALL);
+}
+
+#ifdef _WIN32
+
+void ParticleStoreMapped::Open()
+{
+    HANDLE h;
+    if (file_name.empty()) {
+        char path[MAX_PATH];
+        if (!GetTempFileNameA(std::filesystem::temp_directory_path().string().c_str(), "pgr", 0, path))
+            throw PErrParticleGroup("Can't create temporary particle group file");
+        h = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+    } else
+        h = CreateFileA(file_name.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+
+    if (h == INVALID_HANDLE_VALUE) throw PErrParticleGroup("Can't open particle group file " + file_name);
+    file = (intptr_t)h;
+}
+
+void ParticleStoreMapped::Map(const size_t cap)
+{
+    if (parts) UnmapViewOfFile(parts);
+    parts = NULL;
+    capacity = 0;
+    if (cap == 0) return;
+
+    LARGE_INTEGER bytes;
+    bytes.QuadPart = cap * sizeof(Particle_t);
+    HANDLE m = CreateFileMappingA((HANDLE)file, NULL, PAGE_READWRITE, bytes.HighPart, bytes.LowPart, NULL); // Grows the file
+    if (m) {
+        parts = (Particle_t*)MapViewOfFile(m, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+        CloseHandle(m); // The view keeps the mapping open.
+    }
+    if (!parts) throw PErrParticleGroup("Can't map particle group file " + file_name);
+    capacity = cap;
+}
+
+ParticleStoreMapped::~ParticleStoreMapped()
+{
+    if (parts) UnmapViewOfFile(parts);
+    CloseHandle((HANDLE)file);
+}
+
+#else
+
+void ParticleStoreMapped::Open()
+{
+    int fd;
+    if (file_name.empty()) {
+        // Unlink the temporary file right away so that it goes away with the store, even after a crash.
+        std::string path = (std::filesystem::temp_directory_path() / "ParticleGroupXXXXXX").string();
+        fd = mkstemp(path.data());
+        if (fd >= 0) unlink(path.c_str());
+    } else
+        fd = open(file_name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+    if (fd < 0) throw PErrParticleGroup("Can't open particle group file " + file_name);
+    file = fd;
+}
+
+void ParticleStoreMapped::Map(const size_t cap)
+{
+    if (parts) munmap(parts, capacity * sizeof(Particle_t));
+    parts = NULL;
+    capacity = 0;
+
+    size_t bytes = cap * sizeof(Particle_t);
+    if (ftruncate((int)file, bytes)) throw PErrParticleGroup("Can't grow particle group file " + file_name);
+    if (bytes == 0) return;
+
+    void* p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, (int)file, 0);
+    if (p == MAP_FAILED) throw PErrParticleGroup("Can't map particle group file " + file_name);
+    madvise(p, bytes, MADV_SEQUENTIAL); // Action lists sweep the group in order, one working set at a time.
+
+    parts = (Particle_t*)p;
+    capacity = cap;
+}
+
+ParticleStoreMapped::~ParticleStoreMapped()
+{
+    if (parts) munmap(parts, capacity * sizeof(Particle_t));
+    close((int)file);
+}
+
+#endif
+}; // namespace PAPI
@@ -0,0 +1,468 @@
+/// ParticleStore.h
+///
+/// Copyright 1997-2007, 2022 by David K. McAllister
+///
+/// Storage for the particles of a group whose layout is not an array of Particle_t
+///
+/// Defines these classes: ParticleStore, ParticleStoreSoA, ParticleStoreAoSoA, ParticleStoreHotCold, ParticleStorePacked, ParticleStoreMapped
+
+#ifndef ParticleStore_h
+#define ParticleStore_h
+
+#include "LibHelpers.h"
+#include "Particle/pParticle.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace PAPI {
+
+// Abstract storage of the particles of a group that is not P_LAYOUT_AOS.
+// The action kernels all operate on Particle_t, so the group copies chunks of particles between the store and a small staging
+// array of Particle_t that stays in cache. Only the attributes named in attribs are copied, so an action streams only the memory
+// of the attributes it touches.
+class ParticleStore {
+public:
+    virtual ~ParticleStore() {}
+
+    virtual std::shared_ptr<ParticleStore> copy() const = 0; // Returns a pointer to a heap-allocated copy of the derived class
+
+    virtual size_t size() const = 0;
+    virtual void resize(const size_t n) = 0;
+    virtual void reserve(const size_t n) = 0;
+
+    // Copy the given attributes of particles [first, first + count) to dst.
+    virtual void Gather(Particle_t* dst, const size_t first, const size_t count, const unsigned int attribs) const = 0;
+
+    // Copy the given attributes of src to particles [first, first + count).
+    virtual void Scatter(const Particle_t* src, const size_t first, const size_t count, const unsigned int attribs) = 0;
+
+    // Copy all attributes of particle src to particle dst
+    virtual void Move(const size_t dst, const size_t src) = 0;
+
+    // The attributes that are stored. The others read as their defaults and writes to them are discarded.
+    virtual unsigned int GetAttribs() const { return PA_ALL; }
+
+    // The blocks of a store that holds ParticleBlock_t, on which actions with block kernels can operate in place. NULL for other stores.
+    virtual ParticleBlock_t* GetBlocks() { return NULL; }
+
+    inline void push_back(const Particle_t& P)
+    {
+        size_t i = size();
+        resize(i + 1);
+        Scatter(&P, i, 1, PA_ALL);
+    }
+};
+
+// A separate array for each attribute of the particles
+class ParticleStoreSoA : public ParticleStore {
+#define P_DECL_ARRAY(bit, name) std::vector<decltype(Particle_t::name)> name##_;
+    P_PARTICLE_ATTRIBS(P_DECL_ARRAY)
+#undef P_DECL_ARRAY
+
+public:
+    std::shared_ptr<ParticleStore> copy() const { return std::shared_ptr<ParticleStore>(new ParticleStoreSoA(*this)); }
+
+    size_t size() const { return pos_.size(); }
+
+    void resize(const size_t n)
+    {
+#define P_RESIZE(bit, name) name##_.resize(n);
+        P_PARTICLE_ATTRIBS(P_RESIZE)
+#undef P_RESIZE
+    }
+
+    void reserve(const size_t n)
+    {
+#define P_RESERVE(bit, name) name##_.reserve(n);
+        P_PARTICLE_ATTRIBS(P_RESERVE)
+#undef P_RESERVE
+    }
+
+    // One loop per attribute so that each array is streamed only once
+    void Gather(Particle_t* dst, const size_t first, const size_t count, const unsigned int attribs) const
+    {
+#define P_GATHER(bit, name) \
+    if (attribs & bit)      \
+        for (size_t i = 0; i < count; i++) dst[i].name = name##_[first + i];
+        P_PARTICLE_ATTRIBS(P_GATHER)
+#undef P_GATHER
+    }
+
+    void Scatter(const Particle_t* src, const size_t first, const size_t count, const unsigned int attribs)
+    {
+#define P_SCATTER(bit, name) \
+    if (attribs & bit)       \
+        for (size_t i = 0; i < count; i++) name##_[first + i] = src[i].name;
+        P_PARTICLE_ATTRIBS(P_SCATTER)
+#undef P_SCATTER
+    }
+
+    void Move(const size_t dst, const size_t src)
+    {
+#define P_MOVE(bit, name) name##_[dst] = name##_[src];
+        P_PARTICLE_ATTRIBS(P_MOVE)
+#undef P_MOVE
+    }
+
+};
+
+// Blocks of P_BLOCK_WIDTH particles. The lanes of the last block past size() are unused.
+class ParticleStoreAoSoA : public ParticleStore {
+    std::vector<ParticleBlock_t> blocks;
+    size_t nparticles;
+
+public:
+    ParticleStoreAoSoA() : nparticles(0) {}
+
+    std::shared_ptr<ParticleStore> copy() const { return std::shared_ptr<ParticleStore>(new ParticleStoreAoSoA(*this)); }
+
+    size_t size() const { return nparticles; }
+
+    void resize(const size_t n)
+    {
+        blocks.resize((n + P_BLOCK_WIDTH - 1) / P_BLOCK_WIDTH);
+        nparticles = n;
+    }
+
+    void reserve(const size_t n) { blocks.reserve((n + P_BLOCK_WIDTH - 1) / P_BLOCK_WIDTH); }
+
+    void Gather(Particle_t* dst, const size_t first, const size_t count, const unsigned int attribs) const
+    {
+#define P_GATHER(bit, name)                \
+    if (attribs & bit)                     \
+        for (size_t i = 0; i < count; i++) \
+            pGetLane(blocks[(first + i) / P_BLOCK_WIDTH].name, (first + i) % P_BLOCK_WIDTH, dst[i].name);
+        P_PARTICLE_ATTRIBS(P_GATHER)
+#undef P_GATHER
+    }
+
+    void Scatter(const Particle_t* src, const size_t first, const size_t count, const unsigned int attribs)
+    {
+#define P_SCATTER(bit, name)               \
+    if (attribs & bit)                     \
+        for (size_t i = 0; i < count; i++) \
+            pSetLane(blocks[(first + i) / P_BLOCK_WIDTH].name, (first + i) % P_BLOCK_WIDTH, src[i].name);
+        P_PARTICLE_ATTRIBS(P_SCATTER)
+#undef P_SCATTER
+    }
+
+    void Move(const size_t dst, const size_t src)
+    {
+        Particle_t m;
+        blocks[src / P_BLOCK_WIDTH].GetLane<PA_ALL>(src % P_BLOCK_WIDTH, m);
+        blocks[dst / P_BLOCK_WIDTH].SetLane<PA_ALL>(dst % P_BLOCK_WIDTH, m);
+    }
+
+    ParticleBlock_t* GetBlocks() { return blocks.data(); }
+};
+
+// The attributes that most actions touch, and the rest, for ParticleStoreHotCold
+#define P_HOT_ATTRIBS(X) \
+    X(PA_POS, pos) X(PA_VEL, vel) X(PA_SIZE, size) X(PA_COLOR, color) X(PA_ALPHA, alpha) X(PA_AGE, age) X(PA_MASS, mass) X(PA_TMP0, tmp0)
+#define P_COLD_ATTRIBS(X) X(PA_POSB, posB) X(PA_UP, up) X(PA_UPB, upB) X(PA_VELB, velB) X(PA_RVEL, rvel) X(PA_DATA, data)
+
+// Two parallel arrays: one of the hot attributes, which fill exactly one cache line per particle, and one of the cold attributes
+// (orientation, vertexB, and user data). A segment of actions that touches no cold attribute never streams the cold array.
+class ParticleStoreHotCold : public ParticleStore {
+#define P_DECL_MEMBER(bit, name) decltype(Particle_t::name) name;
+    struct alignas(64) HotParticle_t {
+        P_HOT_ATTRIBS(P_DECL_MEMBER)
+    };
+    struct ColdParticle_t {
+        P_COLD_ATTRIBS(P_DECL_MEMBER)
+    };
+#undef P_DECL_MEMBER
+    static_assert(sizeof(HotParticle_t) == 64, "Hot particle attributes should fill one cache line");
+
+    std::vector<HotParticle_t> hot;
+    std::vector<ColdParticle_t> cold;
+
+public:
+    std::shared_ptr<ParticleStore> copy() const { return std::shared_ptr<ParticleStore>(new ParticleStoreHotCold(*this)); }
+
+    size_t size() const { return hot.size(); }
+
+    void resize(const size_t n)
+    {
+        hot.resize(n);
+        cold.resize(n);
+    }
+
+    void reserve(const size_t n)
+    {
+        hot.reserve(n);
+        cold.reserve(n);
+    }
+
+    void Gather(Particle_t* dst, const size_t first, const size_t count, const unsigned int attribs) const
+    {
+#define P_GATHER(bit, name, arr) \
+    if (attribs & bit)           \
+        for (size_t i = 0; i < count; i++) dst[i].name = arr[first + i].name;
+#define P_GATHER_HOT(bit, name) P_GATHER(bit, name, hot)
+#define P_GATHER_COLD(bit, name) P_GATHER(bit, name, cold)
+        P_HOT_ATTRIBS(P_GATHER_HOT)
+        P_COLD_ATTRIBS(P_GATHER_COLD)
+#undef P_GATHER_COLD
+#undef P_GATHER_HOT
+#undef P_GATHER
+    }
+
+    void Scatter(const Particle_t* src, const size_t first, const size_t count, const unsigned int attribs)
+    {
+#define P_SCATTER(bit, name, arr) \
+    if (attribs & bit)            \
+        for (size_t i = 0; i < count; i++) arr[first + i].name = src[i].name;
+#define P_SCATTER_HOT(bit, name) P_SCATTER(bit, name, hot)
+#define P_SCATTER_COLD(bit, name) P_SCATTER(bit, name, cold)
+        P_HOT_ATTRIBS(P_SCATTER_HOT)
+        P_COLD_ATTRIBS(P_SCATTER_COLD)
+#undef P_SCATTER_COLD
+#undef P_SCATTER_HOT
+#undef P_SCATTER
+    }
+
+    void Move(const size_t dst, const size_t src)
+    {
+        hot[dst] = hot[src];
+        cold[dst] = cold[src];
+    }
+
+};
+
+// Convert between float and IEEE half float, rounding to nearest even. Overflow becomes infinity.
+inline uint16_t pFloatToHalf(const float f)
+{
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+    uint16_t sign = (x >> 16) & 0x8000;
+    int e = int((x >> 23) & 0xff) - 127 + 15;
+    uint32_t m = x & 0x7fffff;
+
+    if (((x >> 23) & 0xff) == 0xff) return sign | 0x7c00 | (m ? 0x200 : 0); // Infinity or NaN
+    if (e >= 31) return sign | 0x7c00;
+    if (e <= 0) {
+        if (e < -10) return sign;
+        m |= 0x800000; // Denormal half
+        uint32_t h = m >> (14 - e), rest = m & ((1u << (14 - e)) - 1), half = 1u << (13 - e);
+        if (rest > half || (rest == half && (h & 1))) h++;
+        return sign | h;
+    }
+
+    uint32_t h = (uint32_t(e) << 10) | (m >> 13), rest = m & 0x1fff;
+    if (rest > 0x1000 || (rest == 0x1000 && (h & 1))) h++; // A carry into the exponent is still correct.
+    return sign | uint16_t(h);
+}
+
+inline float pHalfToFloat(const uint16_t h)
+{
+    uint32_t sign = uint32_t(h & 0x8000) << 16, e = (h >> 10) & 0x1f, m = h & 0x3ff;
+    if (e == 0) {
+        float f = m * (1.f / 16777216.f); // Zero or denormal
+        return sign ? -f : f;
+    }
+
+    uint32_t x = sign | (e == 31 ? 0x7f800000 | (m << 13) : ((e - 15 + 127) << 23) | (m << 13));
+    float f;
+    memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+// An array of records that hold only the given attributes of each particle, for applications that never use the others.
+// A point sprite effect without orientation, vertexB, or user data needs 64 bytes per particle instead of 128.
+// Size, color, alpha, and mass default to one and the rest to zero.
+// The PA_COLOR_RGBA8, PA_COLOR_RGBA16F, and PA_SIZE_16F hints store color with alpha, and size, in fewer bits. They are converted
+// as the particles are staged, so the action kernels and GetParticles() always see floats.
+class ParticleStorePacked : public ParticleStore {
+    unsigned int attribs;       // The attributes that are stored and the storage hints
+    unsigned int quantized;     // The attributes that are stored in fewer bits
+    size_t stride;              // Bytes per particle record
+    std::vector<uint32_t> recs; // The particle records
+    Particle_t defaults;        // Values of the attributes that are not stored
+
+#define P_DECL_OFFSET(bit, name) size_t name##_off;
+    P_PARTICLE_ATTRIBS(P_DECL_OFFSET)
+#undef P_DECL_OFFSET
+
+    inline char* Rec(const size_t i) { return (char*)recs.data() + i * stride; }
+    inline const char* Rec(const size_t i) const { return (const char*)recs.data() + i * stride; }
+
+    // Bytes of the record used by the given attribute
+    size_t StoredBytes(const unsigned int bit, const size_t bytes) const
+    {
+        if (bit == PA_SIZE && (attribs & PA_SIZE_16F)) return 4 * sizeof(uint16_t); // Padded to keep the record 4-byte aligned
+        if (bit == PA_COLOR && (attribs & PA_COLOR_RGBA8)) return 4;
+        if (bit == PA_COLOR && (attribs & PA_COLOR_RGBA16F)) return 4 * sizeof(uint16_t);
+        if (bit == PA_ALPHA && (quantized & PA_ALPHA)) return 0; // Stored with color
+        return bytes;
+    }
+
+    void Dequantize(Particle_t& m, const char* r, const unsigned int which) const
+    {
+        uint16_t h[4];
+        if (which & quantized & PA_SIZE) {
+            memcpy(h, r + size_off, sizeof(h));
+            m.size = pVec(pHalfToFloat(h[0]), pHalfToFloat(h[1]), pHalfToFloat(h[2]));
+        }
+        if (attribs & PA_COLOR_RGBA8) {
+            const unsigned char* c = (const unsigned char*)r + color_off;
+            if (which & PA_COLOR) m.color = pVec(float(c[0]), float(c[1]), float(c[2])) * (1.f / 255.f);
+            if (which & PA_ALPHA) m.alpha = c[3] * (1.f / 255.f);
+        } else if (attribs & PA_COLOR_RGBA16F) {
+            memcpy(h, r + color_off, sizeof(h));
+            if (which & PA_COLOR) m.color = pVec(pHalfToFloat(h[0]), pHalfToFloat(h[1]), pHalfToFloat(h[2]));
+            if (which & PA_ALPHA) m.alpha = pHalfToFloat(h[3]);
+        }
+    }
+
+    void Quantize(char* r, const Particle_t& m, const unsigned int which) const
+    {
+        if (which & quantized & PA_SIZE) {
+            uint16_t h[4] = {pFloatToHalf(m.size.x()), pFloatToHalf(m.size.y()), pFloatToHalf(m.size.z()), 0};
+            memcpy(r + size_off, h, sizeof(h));
+        }
+        if (attribs & PA_COLOR_RGBA8) {
+            unsigned char* c = (unsigned char*)r + color_off;
+            auto unorm8 = [](const float v) { return (unsigned char)(std::min(std::max(v, 0.f), 1.f) * 255.f + 0.5f); };
+            if (which & PA_COLOR) {
+                c[0] = unorm8(m.color.x());
+                c[1] = unorm8(m.color.y());
+                c[2] = unorm8(m.color.z());
+            }
+            if (which & PA_ALPHA) c[3] = unorm8(m.alpha);
+        } else if (attribs & PA_COLOR_RGBA16F) {
+            uint16_t* c = (uint16_t*)(r + color_off);
+            if (which & PA_COLOR) {
+                c[0] = pFloatToHalf(m.color.x());
+                c[1] = pFloatToHalf(m.color.y());
+                c[2] = pFloatToHalf(m.color.z());
+            }
+            if (which & PA_ALPHA) c[3] = pFloatToHalf(m.alpha);
+        }
+    }
+
+public:
+    explicit ParticleStorePacked(const unsigned int attribs_) :
+        attribs(attribs_), quantized(0), stride(0),
+        defaults(pVec(0.f), pVec(0.f), pVec(0.f), pVec(0.f), pVec(0.f), pVec(0.f), pVec(0.f), pVec(0.f), pVec(1.f), pVec(1.f), 1.f, 0.f, 1.f, 0, 0.f)
+    {
+        if (attribs & PA_COLOR_RGBA8) attribs &= ~PA_COLOR_RGBA16F;
+        if (attribs & (PA_COLOR_RGBA8 | PA_COLOR_RGBA16F)) quantized |= PA_COLOR | PA_ALPHA;
+        if (attribs & PA_SIZE_16F) quantized |= PA_SIZE;
+        attribs |= quantized;
+        if (!(attribs & PA_ALL)) attribs |= PA_TMP0; // Records need a nonzero size.
+
+#define P_OFFSET(bit, name) \
+    name##_off = stride;    \
+    if (attribs & bit) stride += StoredBytes(bit, sizeof(Particle_t::name));
+        P_PARTICLE_ATTRIBS(P_OFFSET)
+#undef P_OFFSET
+        if (quantized & PA_ALPHA) alpha_off = color_off + ((attribs & PA_COLOR_RGBA8) ? 3 : 3 * sizeof(uint16_t));
+    }
+
+    std::shared_ptr<ParticleStore> copy() const { return std::shared_ptr<ParticleStore>(new ParticleStorePacked(*this)); }
+
+    size_t size() const { return recs.size() * sizeof(uint32_t) / stride; }
+    void resize(const size_t n) { recs.resize(n * stride / sizeof(uint32_t)); }
+    void reserve(const size_t n) { recs.reserve(n * stride / sizeof(uint32_t)); }
+
+    unsigned int GetAttribs() const { return attribs; }
+
+    void Gather(Particle_t* dst, const size_t first, const size_t count, const unsigned int attribs_) const
+    {
+#define P_GATHER(bit, name)                                                                                        \
+    if (attribs_ & attribs & ~quantized & bit)                                                                     \
+        for (size_t i = 0; i < count; i++) memcpy(&dst[i].name, Rec(first + i) + name##_off, sizeof(dst[i].name)); \
+    else if (attribs_ & ~attribs & bit)                                                                            \
+        for (size_t i = 0; i < count; i++) dst[i].name = defaults.name;
+        P_PARTICLE_ATTRIBS(P_GATHER)
+#undef P_GATHER
+
+        if (attribs_ & quantized)
+            for (size_t i = 0; i < count; i++) Dequantize(dst[i], Rec(first + i), attribs_);
+    }
+
+    void Scatter(const Particle_t* src, const size_t first, const size_t count, const unsigned int attribs_)
+    {
+#define P_SCATTER(bit, name)                   \
+    if (attribs_ & attribs & ~quantized & bit) \
+        for (size_t i = 0; i < count; i++) memcpy(Rec(first + i) + name##_off, &src[i].name, sizeof(src[i].name));
+        P_PARTICLE_ATTRIBS(P_SCATTER)
+#undef P_SCATTER
+
+        if (attribs_ & quantized)
+            for (size_t i = 0; i < count; i++) Quantize(Rec(first + i), src[i], attribs_);
+    }
+
+    void Move(const size_t dst, const size_t src) { memcpy(Rec(dst), Rec(src), stride); }
+};
+
+// An array of Particle_t in a memory-mapped file, for groups larger than RAM. Action lists stream it a working set at a time,
+// so the OS pages it in and out sequentially. The file is a temporary file that is deleted with the store unless a file name is given.
+class ParticleStoreMapped : public ParticleStore {
+    std::string file_name; // Empty for a temporary file
+    intptr_t file;         // The file descriptor or handle
+    Particle_t* parts;     // The mapped particles
+    size_t nparticles;     // Particles in the store
+    size_t capacity;       // Particles that fit in the file and mapping
+
+    void Open();
+    void Map(const size_t cap); // Grow the file and remap it to hold cap particles
+
+public:
+    explicit ParticleStoreMapped(const std::string& file_name_);
+    ParticleStoreMapped(const ParticleStoreMapped& rhs); // The copy is in a new temporary file.
+    ~ParticleStoreMapped();
+
+    std::shared_ptr<ParticleStore> copy() const { return std::shared_ptr<ParticleStore>(new ParticleStoreMapped(*this)); }
+
+    size_t size() const { return nparticles; }
+
+    void resize(const size_t n)
+    {
+        if (n > capacity) Map(std::max(n, capacity * 2));
+        nparticles = n;
+    }
+
+    void reserve(const size_t n)
+    {
+        if (n > capacity) Map(n);
+    }
+
+    void Gather(Particle_t* dst, const size_t first, const size_t count, const unsigned int attribs) const
+    {
+        if (attribs == PA_ALL) {
+            std::copy(parts + first, parts + first + count, dst);
+            return;
+        }
+#define P_GATHER(bit, name) \
+    if (attribs & bit)      \
+        for (size_t i = 0; i < count; i++) dst[i].name = parts[first + i].name;
+        P_PARTICLE_ATTRIBS(P_GATHER)
+#undef P_GATHER
+    }
+
+    void Scatter(const Particle_t* src, const size_t first, const size_t count, const unsigned int attribs)
+    {
+        if (attribs == PA_ALL) {
+            std::copy(src, src + count, parts + first);
+            return;
+        }
+#define P_SCATTER(bit, name) \
+    if (attribs & bit)       \
+        for (size_t i = 0; i < count; i++) parts[first + i].name = src[i].name;
+        P_PARTICLE_ATTRIBS(P_SCATTER)
+#undef P_SCATTER
+    }
+
+    void Move(const size_t dst, const size_t src) { parts[dst] = parts[src]; }
+
+};
+}; // namespace PAPI
+
+#endif
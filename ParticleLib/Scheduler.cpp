@@ -0,0 +1,211 @@
+/// Scheduler.cpp
+///
+/// Copyright 1997-2007, 2022 by David K. McAllister
+///
+/// This file implements the schedulers that run the parallel loops of a context.
+
+#include "Particle/pScheduler.h"
+
+#include <algorithm>
+#include <exception>
+#include <execution>
+#include <numeric>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace PAPI {
+
+namespace {
+// True while this thread is running a task of a pThreadPool_t, so the ParallelFor() calls that the task makes run on this thread
+thread_local bool tl_in_task = false;
+
+// Sets tl_in_task for as long as it exists, even if the task throws
+struct InTaskScope {
+    bool prev;
+    InTaskScope() : prev(tl_in_task) { tl_in_task = true; }
+    ~InTaskScope() { tl_in_task = prev; }
+};
+
+inline uint64_t PackRange(const size_t lo, const size_t hi) { return (uint64_t(lo) << 32) | uint64_t(hi); }
+
+// Bind the calling thread to hardware thread i
+void PinThread(const int i)
+{
+#ifdef _WIN32
+    SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << (i % (8 * sizeof(DWORD_PTR))));
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(i % CPU_SETSIZE, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+}
+}; // namespace
+
+void pStdParScheduler_t::ParallelFor(const size_t n, const size_t grain_, const std::function<void(size_t, size_t)>& f)
+{
+    const size_t grain = std::max(grain_, size_t(1));
+    std::vector<size_t> tasks((n + grain - 1) / grain);
+    std::iota(tasks.begin(), tasks.end(), size_t(0));
+
+    // An exception leaving a parallel algorithm calls std::terminate, so keep the first one and rethrow it here.
+    std::exception_ptr error;
+    std::atomic<bool> failed{false};
+    std::for_each(std::execution::par, tasks.begin(), tasks.end(), [&](const size_t t) {
+        if (failed.load(std::memory_order_relaxed)) return;
+        try {
+            f(t * grain, std::min(n, t * grain + grain));
+        } catch (...) {
+            if (!failed.exchange(true)) error = std::current_exception();
+        }
+    });
+    if (error) std::rethrow_exception(error);
+}
+
+int pStdParScheduler_t::ThreadCount() const { return std::max(1, (int)std::thread::hardware_concurrency()); }
+
+pThreadPool_t::pThreadPool_t(const int thread_count_, const bool pin_threads_) : pin_threads(pin_threads_)
+{
+    thread_count = thread_count_ > 0 ? thread_count_ : std::max(1, (int)std::thread::hardware_concurrency());
+    ranges.reset(new TaskRange_t[thread_count]);
+    for (int p = 0; p < thread_count; p++) ranges[p].lohi.store(0, std::memory_order_relaxed);
+}
+
+pThreadPool_t::~pThreadPool_t()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    wake.notify_all();
+    for (auto& T : threads) T.join();
+}
+
+void pThreadPool_t::Start()
+{
+    for (int p = 1; p < thread_count; p++) threads.emplace_back(&pThreadPool_t::WorkerMain, this, p, generation);
+}
+
+void pThreadPool_t::ParallelFor(const size_t n, const size_t grain_, const std::function<void(size_t, size_t)>& f)
+{
+    if (n == 0) return;
+
+    const size_t grain = std::max(grain_, n / 0x7fffffff + 1); // Keep the task numbers within 32 bits
+    const size_t tasks = (n + grain - 1) / grain;
+
+    std::unique_lock<std::mutex> job_lock(job_mutex, std::try_to_lock);
+    if (thread_count == 1 || tasks == 1 || tl_in_task || !job_lock.owns_lock()) {
+        f(0, n);
+        return;
+    }
+
+    if (threads.empty()) Start();
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job_f = &f;
+        job_n = n;
+        job_grain = grain;
+        job_error = NULL;
+        job_failed.store(false);
+        pending.store(tasks);
+        for (int p = 0; p < thread_count; p++)
+            ranges[p].lohi.store(PackRange(tasks * p / thread_count, tasks * (p + 1) / thread_count), std::memory_order_relaxed);
+        generation++;
+    }
+    wake.notify_all();
+
+    Work(0);
+
+    // After a task throws, the tasks that weren't started never finish, so wait only for the threads still running tasks.
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [&] { return (pending.load() == 0 || job_failed.load()) && active == 0; });
+    job_f = NULL;
+    std::exception_ptr error = job_error;
+    job_error = NULL;
+    lock.unlock();
+    job_lock.unlock();
+
+    if (error) std::rethrow_exception(error);
+}
+
+void pThreadPool_t::WorkerMain(const int p, uint64_t seen)
+{
+    if (pin_threads) PinThread(p);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        wake.wait(lock, [&] { return stop || generation != seen; });
+        if (stop) return;
+
+        seen = generation;
+        active++;
+        lock.unlock();
+        Work(p);
+        lock.lock();
+        if (--active == 0 && (pending.load() == 0 || job_failed.load())) done.notify_all();
+    }
+}
+
+// Once a task throws, the first exception is kept for ParallelFor() to rethrow, and no more tasks are started. A thread that wakes for the
+// job after that finds job_failed set, so it never looks at job_f, which ParallelFor() may have already cleared.
+void pThreadPool_t::Work(const int p)
+{
+    InTaskScope in_task;
+
+    size_t t;
+    while (!job_failed.load() && (Pop(p, t) || Steal(p, t))) {
+        if (job_failed.load()) break;
+
+        const size_t b = t * job_grain;
+        try {
+            (*job_f)(b, std::min(job_n, b + job_grain));
+        } catch (...) {
+            if (!job_failed.exchange(true)) job_error = std::current_exception();
+        }
+        pending.fetch_sub(1);
+    }
+}
+
+// Take the first of participant p's tasks
+bool pThreadPool_t::Pop(const int p, size_t& t)
+{
+    uint64_t v = ranges[p].lohi.load(std::memory_order_acquire);
+    for (;;) {
+        const size_t lo = v >> 32, hi = v & 0xffffffff;
+        if (lo >= hi) return false;
+        if (ranges[p].lohi.compare_exchange_weak(v, PackRange(lo + 1, hi))) {
+            t = lo;
+            return true;
+        }
+    }
+}
+
+// Take the second half of another participant's tasks. Participant p runs the first of them and keeps the rest as its own.
+bool pThreadPool_t::Steal(const int p, size_t& t)
+{
+    for (int k = 1; k < thread_count; k++) {
+        TaskRange_t& victim = ranges[(p + k) % thread_count];
+        uint64_t v = victim.lohi.load(std::memory_order_acquire);
+        for (;;) {
+            const size_t lo = v >> 32, hi = v & 0xffffffff;
+            if (lo >= hi) break;
+
+            const size_t mid = lo + (hi - lo) / 2;
+            if (victim.lohi.compare_exchange_weak(v, PackRange(lo, mid))) {
+                t = mid;
+                ranges[p].lohi.store(PackRange(mid + 1, hi));
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+}; // namespace PAPI
@@ -0,0 +1,782 @@
+/// ParticleTests.cpp
+///
+/// Copyright 1997-2007, 2022 by David K. McAllister
+///
+/// Tests of the Particle System API. Run with the name of a test to run that test, or with no arguments to run all of them.
+/// The tests of the parallel code make their own multi-threaded schedulers, so that they cover it on machines with one core, too.
+
+#include "Particle/pAPI.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace PAPI;
+
+namespace {
+int Failures = 0;
+
+void Check(const bool ok, const char* what, const char* file, const int line)
+{
+    if (ok) return;
+    printf("%s(%d): CHECK failed: %s\n", file, line, what);
+    Failures++;
+}
+
+#define CHECK(x) Check((x), #x, __FILE__, __LINE__)
+
+// One of each scheduler, with several thread counts of the pool
+std::vector<std::shared_ptr<pScheduler_t>> Schedulers()
+{
+    std::vector<std::shared_ptr<pScheduler_t>> S;
+    S.push_back(std::make_shared<pSerialScheduler_t>());
+    for (int threads : {1, 2, 4, 8}) S.push_back(std::make_shared<pThreadPool_t>(threads));
+    S.push_back(std::make_shared<pStdParScheduler_t>());
+#ifdef _OPENMP
+    S.push_back(std::make_shared<pOpenMPScheduler_t>());
+#endif
+    return S;
+}
+
+// Return how many threads ran the tasks of a ParallelFor() of slow tasks on S
+size_t ThreadsUsed(pScheduler_t& S)
+{
+    std::mutex mutex;
+    std::set<std::thread::id> ids;
+    S.ParallelFor(64, 1, [&](size_t, size_t) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        std::lock_guard<std::mutex> lock(mutex);
+        ids.insert(std::this_thread::get_id());
+    });
+    return ids.size();
+}
+
+// How RunEffect() runs an effect
+struct Run_t {
+    pGroupLayout_E layout = P_LAYOUT_AOS;
+    int threads = 0;         // Threads of a pThreadPool_t, or 0 for a pSerialScheduler_t
+    int working_set = 0;     // Bytes, or 0 for the default
+    bool preserve = false;   // SetPreserveOrder()
+    bool immediate = false;  // Run the effect's actions immediately instead of in an action list
+    bool adaptive = true;    // SetAdaptiveExecution()
+    bool auto_tune = false;  // SetWorkingSetAutoTune()
+
+    std::function<void(ParticleContext_t&, int)> inspect; // If set, called with the context and the action list after the last frame
+};
+
+typedef std::vector<std::vector<float>> State_t; // Position, color, alpha, velocity, size, and age of each particle
+
+// Run effect for some frames on a group of up to max_particles particles with the same seed each time, and return the particles' state.
+// The particles are sorted, unless the run preserves their order.
+State_t RunEffect(const std::function<void(ParticleContext_t&)>& effect, const Run_t& R, const size_t max_particles = 20000, const int frames = 30)
+{
+    ParticleContext_t P;
+    P.Seed(1);
+    if (R.threads)
+        P.SetScheduler(std::make_shared<pThreadPool_t>(R.threads));
+    else
+        P.SetScheduler(std::make_shared<pSerialScheduler_t>());
+    if (R.working_set) P.SetWorkingSetSize(R.working_set);
+    const unsigned int attribs = PA_POS | PA_COLOR | PA_ALPHA | PA_VEL | PA_SIZE | PA_AGE; // What the state has, for P_LAYOUT_PACKED
+    int g = P.GenParticleGroups(1, max_particles, R.layout, attribs);
+    P.CurrentGroup(g);
+    P.SetPreserveOrder(R.preserve);
+    P.SetAdaptiveExecution(R.adaptive);
+    P.SetWorkingSetAutoTune(R.auto_tune);
+
+    int list = P.GenActionLists(1);
+    if (!R.immediate) {
+        P.NewActionList(list);
+        effect(P);
+        P.EndActionList();
+    }
+
+    for (int f = 0; f < frames; f++) {
+        if (R.immediate)
+            effect(P);
+        else
+            P.CallActionList(list);
+    }
+    if (R.inspect) R.inspect(P, list);
+
+    size_t n = P.GetGroupCount();
+    std::vector<float> pos(n * 3), color(n * 4), vel(n * 3), size(n * 3), age(n);
+    P.GetParticles(0, n, pos.data(), true, color.data(), vel.data(), size.data(), age.data());
+
+    State_t S(n);
+    for (size_t i = 0; i < n; i++) {
+        S[i].insert(S[i].end(), &pos[i * 3], &pos[i * 3 + 3]);
+        S[i].insert(S[i].end(), &color[i * 4], &color[i * 4 + 4]);
+        S[i].insert(S[i].end(), &vel[i * 3], &vel[i * 3 + 3]);
+        S[i].insert(S[i].end(), &size[i * 3], &size[i * 3 + 3]);
+        S[i].push_back(age[i]);
+    }
+    if (!R.preserve) std::sort(S.begin(), S.end());
+
+    return S;
+}
+
+const pGroupLayout_E Layouts[] = {P_LAYOUT_AOS, P_LAYOUT_SOA, P_LAYOUT_AOSOA, P_LAYOUT_HOTCOLD, P_LAYOUT_PACKED, P_LAYOUT_MAPPED};
+
+////////////////////////////////////////////////////////
+// Random numbers
+
+// pRandf() outside of the API draws different numbers on each thread
+void DefaultRandStreamsDiffer()
+{
+    const int threads = 4;
+    std::vector<std::vector<float>> draws(threads);
+    std::vector<std::thread> T;
+    for (int t = 0; t < threads; t++)
+        T.emplace_back([&draws, t] {
+            for (int i = 0; i < 8; i++) draws[t].push_back(pRandf());
+        });
+    for (auto& t : T) t.join();
+
+    for (int a = 0; a < threads; a++)
+        for (int b = a + 1; b < threads; b++) CHECK(draws[a] != draws[b]);
+
+    // Seeding restarts this thread's stream
+    pSRandf(7);
+    float first = pRandf();
+    pSRandf(7);
+    CHECK(pRandf() == first);
+}
+
+////////////////////////////////////////////////////////
+// Schedulers
+
+// Each item is visited once, by subranges that start at multiples of the grain, including by ParallelFor() calls made from tasks
+void SchedulerCoversRange()
+{
+    for (auto& S : Schedulers()) {
+        for (size_t n : {0, 1, 7, 1000, 100003}) {
+            for (size_t grain : {1, 3, 64, 1024}) {
+                std::vector<std::atomic<int>> visits(n);
+                std::atomic<bool> aligned{true};
+                S->ParallelFor(n, grain, [&](size_t b, size_t e) {
+                    if (b % grain) aligned = false;
+                    for (size_t i = b; i < e; i++) visits[i]++;
+                });
+                CHECK(aligned);
+                bool once = true;
+                for (auto& v : visits) once = once && v == 1;
+                CHECK(once);
+            }
+        }
+
+        std::vector<std::atomic<int>> visits(64 * 64);
+        S->ParallelFor(64, 1, [&](size_t b, size_t e) {
+            for (size_t i = b; i < e; i++) S->ForEach(64, 4, [&](size_t j) { visits[i * 64 + j]++; });
+        });
+        bool once = true;
+        for (auto& v : visits) once = once && v == 1;
+        CHECK(once);
+    }
+
+    // The pool's threads steal the tasks of the calling thread
+    pThreadPool_t pool(4);
+    CHECK(ThreadsUsed(pool) > 1);
+}
+
+// An exception thrown by a task reaches the caller of ParallelFor(), and the scheduler still works afterward
+void SchedulerPropagatesExceptions()
+{
+    for (auto& S : Schedulers()) {
+        for (int rep = 0; rep < 20; rep++) {
+            bool caught = false;
+            try {
+                S->ParallelFor(10000, 16, [&](size_t b, size_t e) {
+                    if (b <= 5000 && 5000 < e) throw PErrNotImplemented("task 5000");
+                });
+            } catch (PErrNotImplemented& Er) {
+                caught = Er.ErrMsg == "task 5000";
+            }
+            CHECK(caught);
+
+            // Every task throws, so the calling thread does too
+            caught = false;
+            try {
+                S->ParallelFor(10000, 16, [&](size_t, size_t) { throw std::runtime_error("all"); });
+            } catch (std::runtime_error&) {
+                caught = true;
+            }
+            CHECK(caught);
+
+            std::atomic<size_t> sum{0};
+            S->ParallelFor(1000, 7, [&](size_t b, size_t e) {
+                for (size_t i = b; i < e; i++) sum += i;
+            });
+            CHECK(sum == 1000 * 999 / 2);
+        }
+    }
+
+    // The calling thread isn't left marked as running a task, which would make its later ParallelFor() calls serial
+    pThreadPool_t pool(4);
+    try {
+        pool.ParallelFor(64, 1, [&](size_t, size_t) { throw std::runtime_error("all"); });
+    } catch (std::runtime_error&) {
+    }
+    CHECK(ThreadsUsed(pool) > 1);
+}
+
+////////////////////////////////////////////////////////
+// Particle groups
+
+// A group mapped to a file keeps writing that file after more groups are made, which moves the groups in memory
+void MappedGroupKeepsFile()
+{
+    const std::string path = (std::filesystem::temp_directory_path() / "ParticleTestsMapped.bin").string();
+    {
+        ParticleContext_t P;
+        int g = P.GenParticleGroups(1, 1000);
+        P.CurrentGroup(g);
+        P.MapGroupToFile(path);
+        P.Source(1000, PDBox(pVec(-1.f), pVec(1.f)), pSourceState());
+
+        for (int i = 0; i < 10; i++) P.GenParticleGroups(i + 1, 10);
+        P.CurrentGroup(g);
+        P.Gravity(pVec(0, 0, -1.f));
+        P.Move(true, false);
+
+        size_t n = P.GetGroupCount();
+        CHECK(n == 1000);
+        std::vector<float> pos(n * 3);
+        P.GetParticles(0, n, pos.data(), false);
+
+        std::vector<Particle_t> file(n);
+        FILE* f = fopen(path.c_str(), "rb");
+        CHECK(f != NULL);
+        if (f) {
+            CHECK(fread(file.data(), sizeof(Particle_t), n, f) == n);
+            fclose(f);
+        }
+
+        bool same = true;
+        for (size_t i = 0; i < n; i++) same = same && file[i].pos == pVec(pos[i * 3], pos[i * 3 + 1], pos[i * 3 + 2]) && file[i].age == 1.f;
+        CHECK(same);
+    }
+    CHECK(std::filesystem::exists(path)); // Kept after the group is deleted
+    std::filesystem::remove(path);
+}
+
+// GetParticles() returns the particles from index to the end of the group when count runs past it, even if index + count overflows
+void GetParticlesClamps()
+{
+    ParticleContext_t P;
+    int g = P.GenParticleGroups(1, 100);
+    P.CurrentGroup(g);
+    P.Source(100, PDBox(pVec(-1.f), pVec(1.f)), pSourceState());
+
+    std::vector<float> pos(100 * 3);
+    CHECK(P.GetParticles(10, 1000, pos.data(), false) == 90);
+    CHECK(P.GetParticles(10, SIZE_MAX, pos.data(), false) == 90);
+    CHECK(P.GetParticles(100, SIZE_MAX, pos.data(), false) == 0);
+
+    bool caught = false;
+    try {
+        P.GetParticles(101, 1, pos.data(), false);
+    } catch (PErrParticleGroup&) {
+        caught = true;
+    }
+    CHECK(caught);
+}
+
+////////////////////////////////////////////////////////
+// Particle loops
+
+// A domain made inside a ParticleLoop on the pool's threads is slow, but works. Debug builds warn about it instead of throwing from the threads.
+void DomainInParticleLoop()
+{
+    size_t counts[2];
+    for (int inside = 0; inside < 2; inside++) {
+        ParticleContext_t P;
+        P.SetScheduler(std::make_shared<pThreadPool_t>(4));
+        P.Seed(1);
+        int g = P.GenParticleGroups(1, 100000);
+        P.CurrentGroup(g);
+        P.Source(100000, PDBox(pVec(-1.f), pVec(1.f)), pSourceState());
+
+        const PDPlane Floor(pVec(0.f), pVec(0, 0, 1.f));
+        P.ParticleLoop(std::execution::par_unseq, [&](Particle_t& m) {
+            if (inside)
+                P.Sink(m, false, PDPlane(pVec(0.f), pVec(0, 0, 1.f)));
+            else
+                P.Sink(m, false, Floor);
+        });
+        P.CommitKills();
+        counts[inside] = P.GetGroupCount();
+    }
+    CHECK(counts[0] == counts[1]);
+    CHECK(counts[0] > 0 && counts[0] < 100000);
+#ifdef _DEBUG
+    CHECK(pDomainInLoopWarned);
+#endif
+}
+
+////////////////////////////////////////////////////////
+// Action lists
+
+void ThrowingCallback(Particle_t&, const pdata_t, const float) { throw std::runtime_error("callback"); }
+
+std::atomic<size_t> Callbacks{0};
+
+void CountingCallback(Particle_t&, const pdata_t, const float) { Callbacks++; }
+
+// Throws once it has been called for data particles, so that the chunks before that have run
+void LateThrowingCallback(Particle_t&, const pdata_t data, const float)
+{
+    if (++Callbacks >= data) throw std::runtime_error("callback");
+}
+
+// Errors in actions reach the caller of the API when the context's scheduler has several threads, and the context and group keep working
+void ActionListPropagatesExceptions()
+{
+    for (pGroupLayout_E layout : {P_LAYOUT_AOS, P_LAYOUT_SOA}) {
+        ParticleContext_t P;
+        P.SetScheduler(std::make_shared<pThreadPool_t>(4));
+        P.SetWorkingSetSize(16 * 1024); // Many chunks
+        int g = P.GenParticleGroups(1, 201000, layout);
+        P.CurrentGroup(g);
+        pSourceState Young, Old;
+        Old.StartingAge(1.f);
+        P.Source(100000, PDBox(pVec(-1.f), pVec(1.f)), Young);
+        P.Source(100000, PDBox(pVec(-1.f), pVec(1.f)), Old);
+
+        // Domains without a Bounce() or Avoid() are rejected when the action is made, not when it runs in a task
+        int bad = P.GenActionLists(1);
+        P.NewActionList(bad);
+        bool caught = false;
+        try {
+            P.Bounce(0.f, 0.5f, 0.f, PDCylinder(pVec(0.f), pVec(0, 0, 1), 1.f));
+        } catch (PErrNotImplemented&) {
+            caught = true;
+        }
+        CHECK(caught);
+        P.EndActionList();
+
+        caught = false;
+        try {
+            P.Avoid(1.f, 0.1f, 1.f, PDCone(pVec(0.f), pVec(0, 0, 1), 1.f));
+        } catch (PErrNotImplemented&) {
+            caught = true;
+        }
+        CHECK(caught);
+
+        int throws = P.GenActionLists(1);
+        P.NewActionList(throws);
+        P.Gravity(pVec(0, 0, -0.01f));
+        P.Callback(ThrowingCallback, 0);
+        P.Move(true, false);
+        P.EndActionList();
+
+        // This one emits particles and tags the old ones in its first chunks before it throws
+        int throws_late = P.GenActionLists(1);
+        P.NewActionList(throws_late);
+        P.Source(1000, PDBox(pVec(-1.f), pVec(1.f)), Young);
+        P.Callback(LateThrowingCallback, 150000);
+        P.KillOld(0.5f);
+        P.EndActionList();
+
+        int works = P.GenActionLists(1);
+        P.NewActionList(works);
+        P.Gravity(pVec(0, 0, -0.01f));
+        P.Move(true, false);
+        P.EndActionList();
+
+        int kills = P.GenActionLists(1);
+        P.NewActionList(kills);
+        P.KillOld(-1.f); // Kills them all
+        P.EndActionList();
+
+        for (int rep = 0; rep < 10; rep++) {
+            caught = false;
+            Callbacks = 0;
+            try {
+                P.CallActionList(rep & 1 ? throws_late : throws);
+            } catch (std::runtime_error&) {
+                caught = true;
+            }
+            CHECK(caught);
+        }
+
+        // The particles emitted and killed by the lists that threw are forgotten
+        CHECK(P.GetGroupCount() == 200000);
+        P.CommitKills();
+        CHECK(P.GetGroupCount() == 200000);
+
+        P.CallActionList(works);
+        std::vector<float> age(200000);
+        CHECK(P.GetParticles(0, 200000, NULL, false, NULL, NULL, NULL, age.data()) == 200000);
+        CHECK(std::count(age.begin(), age.end(), 1.f) == 100000);
+        CHECK(std::count(age.begin(), age.end(), 2.f) == 100000);
+
+        P.CallActionList(kills);
+        CHECK(P.GetGroupCount() == 0);
+        P.ParticleLoop(std::execution::seq, [&](Particle_t&) {}); // Throws if the context still thinks it's in an action list
+    }
+}
+
+// A Source() after a kill in a list fills the room the kill made in a full group, and a Callback() after a kill isn't given the killed particles
+void KillOldThenSourceAtCapacity()
+{
+    for (pGroupLayout_E layout : {P_LAYOUT_AOS, P_LAYOUT_SOA, P_LAYOUT_AOSOA}) {
+        for (int threads : {0, 4}) {
+            ParticleContext_t P;
+            if (threads) P.SetScheduler(std::make_shared<pThreadPool_t>(threads));
+            P.SetWorkingSetSize(16 * 1024);
+            int g = P.GenParticleGroups(1, 10000, layout);
+            P.CurrentGroup(g);
+
+            pSourceState Young, Old;
+            Old.StartingAge(1.f);
+            P.Source(5000, PDBox(pVec(-1.f), pVec(1.f)), Young);
+            P.Source(5000, PDBox(pVec(-1.f), pVec(1.f)), Old);
+            CHECK(P.GetGroupCount() == 10000);
+
+            int list = P.GenActionLists(1);
+            P.NewActionList(list);
+            P.Gravity(pVec(0, 0, -0.01f));
+            P.KillOld(0.5f);
+            P.Callback(CountingCallback, 0);
+            P.Source(10000, PDBox(pVec(-1.f), pVec(1.f)), Young);
+            P.Move(true, false);
+            P.EndActionList();
+
+            Callbacks = 0;
+            P.CallActionList(list);
+            CHECK(Callbacks == 5000);
+            CHECK(P.GetGroupCount() == 10000);
+        }
+    }
+}
+
+// Particles emitted in a segment of a list get the later actions of the segment, and end up the same as when the actions are run immediately
+void EmittedParticlesMatchImmediate()
+{
+    pSourceState Src;
+    Src.Velocity(PDSphere(pVec(0, 0, 0.1f), 0.05f));
+    Src.Color(PDBox(pVec(0.f), pVec(1.f)));
+    auto Effect = [&](ParticleContext_t& P) {
+        P.Source(1000, PDSphere(pVec(0.f), 1.f), Src);
+        P.Gravity(pVec(0, 0, -0.01f));
+        P.Move(true, false);
+        P.KillOld(10.f);
+    };
+
+    for (bool preserve : {false, true}) {
+        Run_t Ref;
+        Ref.immediate = true;
+        Ref.preserve = preserve;
+        State_t Expected = RunEffect(Effect, Ref);
+        CHECK(Expected.size() == 9000); // Each frame emits 1000, which are killed when Move() ages them to 10
+
+        for (pGroupLayout_E layout : Layouts) {
+            for (int threads : {0, 4}) {
+                Run_t R;
+                R.layout = layout;
+                R.threads = threads;
+                R.working_set = 16 * 1024;
+                R.preserve = preserve;
+                CHECK(RunEffect(Effect, R) == Expected);
+            }
+        }
+    }
+}
+
+// An effect with most kinds of actions, emitting, killing, and in-place per-particle ones
+void FountainEffect(ParticleContext_t& P)
+{
+    pSourceState Src;
+    Src.Velocity(PDSphere(pVec(0, 0, 0.1f), 0.05f));
+    Src.Color(PDBox(pVec(0.f), pVec(1.f)));
+    P.Source(500, PDSphere(pVec(0.f), 1.f), Src);
+    P.Gravity(pVec(0, 0, -0.01f));
+    P.TargetColor(pVec(1, 0, 0), 0.5f, 0.1f);
+    P.Bounce(0.f, 0.5f, 0.f, PDDisc(pVec(0, 0, -1.f), pVec(0, 0, 1.f), 5));
+    P.Damping(pVec(0.99f));
+    P.RandomAccel(PDSphere(pVec(0.f), 0.001f));
+    P.Move(true, false);
+    P.KillOld(40.f);
+    P.Sink(false, PDPlane(pVec(0, 0, -3), pVec(0, 0, 1)));
+}
+
+// Every layout, thread count, and working set size gives the same particles as serial immediate mode, with and without preserving order
+void ParallelMatchesSerial()
+{
+    for (bool preserve : {false, true}) {
+        Run_t Ref;
+        Ref.immediate = true;
+        Ref.preserve = preserve;
+        State_t Expected = RunEffect(FountainEffect, Ref);
+        CHECK(Expected.size() > 5000);
+
+        for (pGroupLayout_E layout : Layouts) {
+            for (int threads : {0, 4}) {
+                for (int working_set : {16 * 1024, 1024 * 1024}) {
+                    for (bool immediate : {false, true}) {
+                        Run_t R;
+                        R.layout = layout;
+                        R.threads = threads;
+                        R.working_set = working_set;
+                        R.preserve = preserve;
+                        R.immediate = immediate;
+                        if (RunEffect(FountainEffect, R) == Expected) continue;
+                        printf("Layout %d, %d threads, %d byte working set, preserve %d, immediate %d differs\n", layout, threads, working_set, preserve,
+                               immediate);
+                        Failures++;
+                    }
+                }
+            }
+        }
+    }
+}
+
+// An effect on a large group, so that whole-group loops of its actions are worth running in parallel
+void LargeEffect(ParticleContext_t& P)
+{
+    pSourceState Src;
+    Src.Velocity(PDSphere(pVec(0, 0, 0.1f), 0.05f));
+    P.Source(100000, PDSphere(pVec(0.f), 1.f), Src);
+    P.RandomAccel(PDSphere(pVec(0.f), 0.001f));
+    P.Bounce(0.f, 0.5f, 0.f, PDDisc(pVec(0, 0, -1.f), pVec(0, 0, 1.f), 5));
+    P.Move(true, false);
+    P.KillOld(3.f);
+    P.Sink(false, PDPlane(pVec(0, 0, -100.f), pVec(0, 0, 1))); // Kill none, but test each particle
+    P.SinkVelocity(true, PDSphere(pVec(100.f), 1.f));
+}
+
+// Adaptive execution on a pool gives the same particles as serial loops, and its policies report the loops it ran
+void AdaptiveMatchesSerial()
+{
+    Run_t Ref;
+    Ref.immediate = true;
+    Ref.adaptive = false;
+    Ref.inspect = [](ParticleContext_t& P, int) { CHECK(P.GetActionPolicies().empty()); };
+    State_t Expected = RunEffect(LargeEffect, Ref, 400000, 6);
+    CHECK(Expected.size() == 200000);
+
+    for (int threads : {0, 4}) {
+        for (bool immediate : {false, true}) {
+            Run_t R;
+            R.threads = threads;
+            R.immediate = immediate;
+            R.inspect = [&](ParticleContext_t& P, int) {
+                std::vector<pActionPolicy_t> Policies = P.GetActionPolicies();
+                CHECK(!Policies.empty());
+                uint64_t parallel_calls = 0;
+                for (size_t i = 0; i < Policies.size(); i++) {
+                    const pActionPolicy_t& A = Policies[i];
+                    if (i) CHECK(Policies[i - 1].name < A.name);
+                    CHECK(A.calls > 0 && A.particles > 0);
+                    CHECK(A.parallel_calls <= A.calls);
+                    CHECK(A.ns_per_particle > 0.f && A.min_parallel_particles > 0);
+                    CHECK((A.grain > 0) == (A.parallel_calls > 0));
+                    parallel_calls += A.parallel_calls;
+                }
+                // A serial scheduler has no threads to split a loop among. The pool splits the whole-group loops of immediate mode.
+                if (!threads) CHECK(parallel_calls == 0);
+                if (threads && immediate) CHECK(parallel_calls > 0);
+                int sinks = 0; // Sink() and SinkVelocity() tag their kills in adaptive loops, too
+                for (const pActionPolicy_t& A : Policies) {
+                    if (A.name != "PASink" && A.name != "PASinkVelocity") continue;
+                    sinks++;
+                    if (threads && immediate) CHECK(A.parallel_calls > 0);
+                }
+                CHECK(sinks == 2);
+            };
+            CHECK(RunEffect(LargeEffect, R, 400000, 6) == Expected);
+        }
+    }
+}
+
+// A list that fuses into a single action splits the group among the pool's threads, and gets the same particles as serially
+void FusedListRunsInParallel()
+{
+    std::vector<float> pos[2], vel[2];
+    for (int threads : {0, 4}) {
+        ParticleContext_t P;
+        P.SetScheduler(threads ? std::shared_ptr<pScheduler_t>(std::make_shared<pThreadPool_t>(threads)) : std::make_shared<pSerialScheduler_t>());
+        P.Seed(1);
+        int g = P.GenParticleGroups(1, 400000);
+        P.CurrentGroup(g);
+        pSourceState Src;
+        Src.Velocity(PDSphere(pVec(0.f), 0.1f));
+        P.Source(400000, PDBox(pVec(-1.f), pVec(1.f)), Src);
+
+        int list = P.GenActionLists(1);
+        P.NewActionList(list);
+        P.Gravity(pVec(0, 0, -0.01f));
+        P.Damping(pVec(0.99f));
+        P.Move(true, false);
+        P.KillOld(5.5f);
+        P.EndActionList();
+        CHECK(P.GetActionProfile(list).size() == 1); // One PAFused
+
+        for (int f = 0; f < 5; f++) P.CallActionList(list);
+        const int t = threads ? 1 : 0;
+        pos[t].resize(400000 * 3);
+        vel[t].resize(400000 * 3);
+        CHECK(P.GetParticles(0, 400000, pos[t].data(), false, NULL, vel[t].data()) == 400000);
+        P.CallActionList(list);
+        CHECK(P.GetGroupCount() == 0); // The KillOld() in the PAFused
+
+        bool fused = false;
+        for (const pActionPolicy_t& A : P.GetActionPolicies()) {
+            if (A.name != "PAFused") continue;
+            fused = true;
+            CHECK(A.calls == 6);
+            if (threads) CHECK(A.parallel_calls > 0);
+        }
+        CHECK(fused);
+    }
+    CHECK(pos[0] == pos[1] && vel[0] == vel[1]);
+}
+
+// The working set tuner settles on one size in the allowed range within a bounded number of calls, and doesn't change the particles
+void TunerConverges()
+{
+    for (int threads : {0, 4}) {
+        ParticleContext_t P;
+        P.SetScheduler(threads ? std::shared_ptr<pScheduler_t>(std::make_shared<pThreadPool_t>(threads)) : std::make_shared<pSerialScheduler_t>());
+        P.SetWorkingSetSize(64 * 1024);
+        P.SetWorkingSetAutoTune(true);
+        int g = P.GenParticleGroups(1, 20000);
+        P.CurrentGroup(g);
+        P.Source(20000, PDSphere(pVec(0.f), 1.f), pSourceState()); // The tuner waits while the group's size changes
+
+        int list = P.GenActionLists(1);
+        P.NewActionList(list);
+        P.Gravity(pVec(0, 0, -0.01f));
+        P.Bounce(0.f, 0.5f, 0.f, PDDisc(pVec(0, 0, -1.f), pVec(0, 0, 1.f), 5));
+        P.Damping(pVec(0.99f));
+        P.Move(true, false);
+        P.EndActionList();
+        CHECK(P.GetWorkingSetSize(list) == 64 * 1024); // Not called yet
+
+        int last_size = 0, last_change = 0;
+        for (int f = 0; f < 40; f++) {
+            P.CallActionList(list);
+            int size = P.GetWorkingSetSize(list);
+            CHECK(size >= 16 * 1024 && size <= 8 * 1024 * 1024);
+            if (size != last_size) last_change = f;
+            last_size = size;
+        }
+        CHECK(last_change <= 20); // The first call isn't timed, then each of the ten sizes from 16 KB to 8 MB is timed for two calls at most
+        CHECK(P.GetWorkingSetSize() == 64 * 1024); // Immediate mode keeps the size it was given
+    }
+
+    for (int threads : {0, 4}) {
+        Run_t Ref, R;
+        Ref.threads = R.threads = threads;
+        Ref.working_set = R.working_set = 64 * 1024;
+        R.auto_tune = true;
+        CHECK(RunEffect(FountainEffect, R, 20000, 40) == RunEffect(FountainEffect, Ref, 20000, 40));
+    }
+}
+
+// The particles that the actions' profiles count as killed and created add up to the change in the group's size
+void ProfileCountsMatchGroupSize()
+{
+    for (pGroupLayout_E layout : {P_LAYOUT_AOS, P_LAYOUT_SOA}) {
+        for (int threads : {0, 4}) {
+            for (bool immediate : {false, true}) {
+                ParticleContext_t P;
+                P.SetScheduler(threads ? std::shared_ptr<pScheduler_t>(std::make_shared<pThreadPool_t>(threads)) : std::make_shared<pSerialScheduler_t>());
+                P.SetWorkingSetSize(16 * 1024);
+                P.SetActionProfiling(true);
+                int g = P.GenParticleGroups(1, 20000, layout);
+                P.CurrentGroup(g);
+
+                int list = P.GenActionLists(1);
+                P.NewActionList(list);
+                FountainEffect(P);
+                P.EndActionList();
+                const int profiled = immediate ? -1 : list;
+
+                uint64_t all_killed = 0;
+                for (int f = 0; f < 60; f++) {
+                    P.ResetActionProfile(profiled);
+                    size_t before = P.GetGroupCount();
+                    if (immediate)
+                        FountainEffect(P);
+                    else
+                        P.CallActionList(list);
+
+                    uint64_t killed = 0, emitted = 0;
+                    for (const pActionProfile_t& A : P.GetActionProfile(profiled)) {
+                        killed += A.killed;
+                        emitted += A.emitted;
+                    }
+                    CHECK(emitted == 500); // The group never fills
+                    CHECK(before + emitted - killed == P.GetGroupCount());
+                    all_killed += killed;
+                }
+                CHECK(all_killed > 0);
+            }
+        }
+    }
+}
+
+struct Test_t {
+    const char* name;
+    void (*func)();
+};
+
+const Test_t Tests[] = {
+    {"DefaultRandStreamsDiffer", DefaultRandStreamsDiffer},
+    {"SchedulerCoversRange", SchedulerCoversRange},
+    {"SchedulerPropagatesExceptions", SchedulerPropagatesExceptions},
+    {"MappedGroupKeepsFile", MappedGroupKeepsFile},
+    {"GetParticlesClamps", GetParticlesClamps},
+    {"DomainInParticleLoop", DomainInParticleLoop},
+    {"ActionListPropagatesExceptions", ActionListPropagatesExceptions},
+    {"KillOldThenSourceAtCapacity", KillOldThenSourceAtCapacity},
+    {"EmittedParticlesMatchImmediate", EmittedParticlesMatchImmediate},
+    {"ParallelMatchesSerial", ParallelMatchesSerial},
+    {"AdaptiveMatchesSerial", AdaptiveMatchesSerial},
+    {"FusedListRunsInParallel", FusedListRunsInParallel},
+    {"TunerConverges", TunerConverges},
+    {"ProfileCountsMatchGroupSize", ProfileCountsMatchGroupSize},
+};
+}; // namespace
+
+int main(int argc, char** argv)
+{
+    bool found = false;
+    for (const Test_t& T : Tests) {
+        if (argc > 1 && strcmp(argv[1], T.name)) continue;
+        found = true;
+
+        printf("%s\n", T.name);
+        try {
+            T.func();
+        } catch (PError_t& Er) {
+            printf("%s threw PError_t: %s\n", T.name, Er.ErrMsg.c_str());
+            Failures++;
+        } catch (std::exception& Er) {
+            printf("%s threw: %s\n", T.name, Er.what());
+            Failures++;
+        }
+    }
+
+    if (!found) {
+        printf("No test named %s\n", argv[1]);
+        return 1;
+    }
+
+    printf(Failures ? "%d FAILED\n" : "PASSED\n", Failures);
+    return Failures ? 1 : 0;
+}